@@ -0,0 +1,138 @@
+/*
+ * A hot path crosses several multiverse functions. Their selected variants
+ * are small, but each of them is followed by a large unselected variant, so
+ * every call lands on a different text page. We count the iTLB and L1
+ * i-cache misses of the hot path, once with the variants where the compiler
+ * placed them and once with the variants in the code cache.
+ */
+
+#define _GNU_SOURCE
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "multiverse.h"
+
+#define ITERATIONS 2000000
+
+__attribute__((multiverse)) int slow_mode;
+
+#define BENCH_FN(n)                                                     \
+    int __attribute__((multiverse)) fn##n(int x) {                      \
+        if (slow_mode) {                                                \
+            __asm__ volatile(".skip 4096, 0x90");                       \
+            return x + n;                                               \
+        }                                                               \
+        return x ^ n;                                                   \
+    }
+
+BENCH_FN(0) BENCH_FN(1) BENCH_FN(2) BENCH_FN(3)
+BENCH_FN(4) BENCH_FN(5) BENCH_FN(6) BENCH_FN(7)
+BENCH_FN(8) BENCH_FN(9) BENCH_FN(10) BENCH_FN(11)
+BENCH_FN(12) BENCH_FN(13) BENCH_FN(14) BENCH_FN(15)
+
+static __attribute__((noinline)) int hot_path(int x)
+{
+    x = fn0(x);  x = fn1(x);  x = fn2(x);  x = fn3(x);
+    x = fn4(x);  x = fn5(x);  x = fn6(x);  x = fn7(x);
+    x = fn8(x);  x = fn9(x);  x = fn10(x); x = fn11(x);
+    x = fn12(x); x = fn13(x); x = fn14(x); x = fn15(x);
+    return x;
+}
+
+
+static int perf_open(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+#define CACHE_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+    int fd;
+} counters[] = {
+    {"cycles",       PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1},
+    {"iTLB-misses",  PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_ITLB), -1},
+    {"L1i-misses",   PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_L1I), -1},
+};
+#define N_COUNTERS (sizeof(counters) / sizeof(counters[0]))
+
+
+static void measure(const char *label)
+{
+    struct timespec start, end;
+    volatile int sink = 0;
+    unsigned i;
+
+    for (i = 0; i < N_COUNTERS; i++) {
+        if (counters[i].fd < 0) continue;
+        ioctl(counters[i].fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counters[i].fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < ITERATIONS; i++) {
+        sink = hot_path(sink);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    for (i = 0; i < N_COUNTERS; i++) {
+        if (counters[i].fd >= 0)
+            ioctl(counters[i].fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    printf("%-12s %8.2f ns/iteration", label,
+           ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec))
+           / ITERATIONS);
+    for (i = 0; i < N_COUNTERS; i++) {
+        uint64_t value;
+        if (counters[i].fd < 0
+            || read(counters[i].fd, &value, sizeof(value)) != sizeof(value)) {
+            printf("  %s: n/a", counters[i].name);
+            continue;
+        }
+        printf("  %s: %.3f/iteration", counters[i].name,
+               (double) value / ITERATIONS);
+    }
+    printf("\n");
+}
+
+
+int main(int argc, char **argv)
+{
+    unsigned i;
+
+    multiverse_init();
+    for (i = 0; i < N_COUNTERS; i++) {
+        counters[i].fd = perf_open(counters[i].type, counters[i].config);
+    }
+
+    slow_mode = 0;
+    multiverse_commit();
+    measure("in place");
+
+    if (multiverse_enable_code_cache(1 << 21, 1) < 0) {
+        printf("code cache not available\n");
+        return 0;
+    }
+    // Select the variants again to copy them into the cache
+    multiverse_revert();
+    multiverse_commit();
+    measure("code cache");
+
+    return 0;
+}
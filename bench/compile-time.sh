@@ -0,0 +1,72 @@
+#!/bin/sh
+#
+# Compile-time benchmark of the plugin on generated translation units.
+#
+#   [VARS_PER_FN=k] compile-time.sh [SIZE...]
+#
+# For every SIZE, a unit with SIZE multiverse variables, SIZE multiverse
+# functions (each referencing k variables, default 2, which gives 2^k
+# variants), and SIZE callers is generated and compiled once with and
+# once without the plugin. If the plugin overhead per declaration stays
+# constant as SIZE grows, its symbol lookups scale linearly; with a large
+# k, half of the variants are equal and the elimination pass is measured.
+
+CC=${MY_CC:-gcc}
+PLUGIN=${PLUGIN:-../gcc-plugin/multiverse.so}
+CFLAGS="-O2 -c -I../libmultiverse"
+DIR=large-unit
+K=${VARS_PER_FN:-2}
+
+[ $# -gt 0 ] || set -- 250 500 1000 2000
+
+generate() {
+    n=$1
+    echo "typedef enum {false, true} bool;"
+    i=0
+    while [ $i -lt $n ]; do
+        echo "__attribute__((multiverse)) bool var_$i;"
+        i=$((i + 1))
+    done
+    i=0
+    while [ $i -lt $n ]; do
+        cat <<EOF
+__attribute__((multiverse)) int fn_$i(int x) {
+EOF
+        # The last variable does not change the result
+        k=0
+        while [ $k -lt $K ]; do
+            if [ $k -lt $((K - 1)) ]; then
+                echo "    if (var_$(((i + k) % n))) x ^= $((i + k + 1));"
+            else
+                echo "    if (var_$(((i + k) % n))) x += 0;"
+            fi
+            k=$((k + 1))
+        done
+        cat <<EOF
+    return x;
+}
+int call_$i(int x) { return fn_$i(x) + fn_$((i / 2))(x); }
+EOF
+        i=$((i + 1))
+    done
+}
+
+now_ms() {
+    echo $(($(date +%s%N) / 1000000))
+}
+
+compile_ms() {
+    start=$(now_ms)
+    $CC $CFLAGS "$@" -o $DIR/unit.o $DIR/unit.c || exit 1
+    echo $(($(now_ms) - start))
+}
+
+mkdir -p $DIR
+printf "%8s %12s %12s %14s\n" size plain_ms plugin_ms overhead_us/fn
+for size in "$@"; do
+    generate $size > $DIR/unit.c
+    plain=$(compile_ms -Wno-attributes) || exit 1
+    plugin=$(compile_ms -fplugin=$PLUGIN) || exit 1
+    printf "%8d %12d %12d %14d\n" $size $plain $plugin \
+           $(((plugin - plain) * 1000 / size))
+done
@@ -0,0 +1,72 @@
+/*
+ * Switch between two configurations, once with multiverse_commit() and once
+ * by applying two precomputed plans. Both variants pay for the mprotect()
+ * calls of the transaction; the plans skip selecting and decoding.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <time.h>
+#include "multiverse.h"
+
+#define ROUNDS 10000
+
+__attribute__((multiverse)) int mode;
+
+#define BENCH_FN(n)                                                     \
+    int __attribute__((multiverse)) fn##n(int x) {                      \
+        if (mode) return x + n;                                         \
+        return x ^ n;                                                   \
+    }
+
+#define BENCH_FN8(n)                                                    \
+    BENCH_FN(n##0) BENCH_FN(n##1) BENCH_FN(n##2) BENCH_FN(n##3)         \
+    BENCH_FN(n##4) BENCH_FN(n##5) BENCH_FN(n##6) BENCH_FN(n##7)
+
+BENCH_FN8(1) BENCH_FN8(2) BENCH_FN8(3) BENCH_FN8(4)
+BENCH_FN8(5) BENCH_FN8(6) BENCH_FN8(7) BENCH_FN8(8)
+
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+int main(int argc, char **argv)
+{
+    struct mv_plan *plan_a, *plan_b;
+    double start;
+    unsigned i;
+
+    multiverse_init();
+
+    start = now_ns();
+    for (i = 0; i < ROUNDS; i++) {
+        mode = i & 1;
+        multiverse_commit();
+    }
+    printf("multiverse_commit     %10.0f ns/switch\n", (now_ns() - start) / ROUNDS);
+
+    mode = 0;
+    plan_a = multiverse_plan_commit();
+    mode = 1;
+    plan_b = multiverse_plan_commit();
+    if (!plan_a || !plan_b) {
+        printf("planning failed\n");
+        return 1;
+    }
+
+    start = now_ns();
+    for (i = 0; i < ROUNDS; i++) {
+        multiverse_plan_apply((i & 1) ? plan_b : plan_a);
+    }
+    printf("multiverse_plan_apply %10.0f ns/switch (%u patches)\n",
+           (now_ns() - start) / ROUNDS, plan_a->n_patches);
+
+    multiverse_plan_free(plan_a);
+    multiverse_plan_free(plan_b);
+    return 0;
+}
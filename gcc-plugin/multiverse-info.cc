@@ -54,6 +54,8 @@ static tree get_array_decl(const char *name,
     SET_DECL_ASSEMBLER_NAME(ary, get_identifier(name));
     TREE_STATIC(ary) = 1;
     TREE_ADDRESSABLE(ary) = 1;
+    // Nothing references the descriptors; keep them (also through LTO)
+    DECL_PRESERVE_P(ary) = 1;
     DECL_NONALIASED(ary) = 1;
     DECL_VISIBILITY_SPECIFIED(ary) = 1;
     DECL_VISIBILITY(ary) = VISIBILITY_HIDDEN;
@@ -124,7 +126,7 @@ build_info_assignment(var_assign_t &assign_info, multiverse_info_types &types)
     CONSTRUCTOR_APPEND_ELT(obj, info_fields,
                            build1(ADDR_EXPR,
                                   build_pointer_type(void_type_node),
-                                  assign_info.variable->decl()));
+                                  assign_info.variable->ref()));
     info_fields = DECL_CHAIN(info_fields);
 
     /* lower limit */
@@ -182,6 +184,8 @@ static tree build_info_mvfn(mvfn_t &mvfn_info, multiverse_info_types &types)
     CONSTRUCTOR_APPEND_ELT(obj, info_fields,
                            build_int_cstu(TREE_TYPE(info_fields), 0));
     info_fields = DECL_CHAIN(info_fields);
+    CONSTRUCTOR_APPEND_ELT(obj, info_fields, null_pointer_node);
+    info_fields = DECL_CHAIN(info_fields);
 
     gcc_assert(!info_fields); // All fields are filled
 
@@ -237,11 +241,27 @@ static tree build_info_fn(func_t &fn_info, multiverse_info_types &types)
                                build1(ADDR_EXPR, types.mvfn_ptr_type, mvfn_ary));
     info_fields = DECL_CHAIN(info_fields);
 
+    /* hits */
+    if (fn_info.hit_counter != NULL_TREE)
+        CONSTRUCTOR_APPEND_ELT(obj, info_fields,
+                               build1(ADDR_EXPR, TREE_TYPE(info_fields),
+                                      fn_info.hit_counter));
+    else
+        CONSTRUCTOR_APPEND_ELT(obj, info_fields, null_pointer_node);
+    info_fields = DECL_CHAIN(info_fields);
+
     /* Fields initialized by the runtime system */
     CONSTRUCTOR_APPEND_ELT(obj, info_fields, null_pointer_node);
     info_fields = DECL_CHAIN(info_fields);
     CONSTRUCTOR_APPEND_ELT(obj, info_fields, null_pointer_node);
     info_fields = DECL_CHAIN(info_fields);
+    CONSTRUCTOR_APPEND_ELT(obj, info_fields,
+                           build_int_cst(TREE_TYPE(info_fields), 0));
+    info_fields = DECL_CHAIN(info_fields);
+    CONSTRUCTOR_APPEND_ELT(obj, info_fields, null_pointer_node);
+    info_fields = DECL_CHAIN(info_fields);
+    CONSTRUCTOR_APPEND_ELT(obj, info_fields, null_pointer_node);
+    info_fields = DECL_CHAIN(info_fields);
 
     gcc_assert(!info_fields); // All fields are filled
 
@@ -271,20 +291,23 @@ static tree build_info_var(variable_t &var_info, multiverse_info_types &types)
                            build1(ADDR_EXPR, TREE_TYPE(info_fields), var_string));
     info_fields = DECL_CHAIN(info_fields);
 
-    /* Pointer to variable as a (void *) */
+    /* Pointer to variable (or member) as a (void *) */
     CONSTRUCTOR_APPEND_ELT(obj, info_fields,
                            build1(ADDR_EXPR, build_pointer_type(void_type_node),
-                                  var_info.decl()));
+                                  var_info.ref()));
     info_fields = DECL_CHAIN(info_fields);
 
     /* information about the variable */
-    tree type = TREE_TYPE(var_info.decl());
+    tree type = var_info.type();
     int width = int_size_in_bytes(type);
     int flag_signed = !TYPE_UNSIGNED(type);
     int flag_tracked = !!var_info.tracked;
+    int flag_bits = var_info.bits != 0;
+    int flag_pointer = POINTER_TYPE_P(type);
     gcc_assert(width < 16);
     uint32_t info = ((!flag_tracked) << 31) | (flag_signed << 30) |
-                    (flag_tracked << 29) | width;
+                    (flag_tracked << 29) | (flag_bits << 27) |
+                    (flag_pointer << 26) | width;
     CONSTRUCTOR_APPEND_ELT(obj, info_fields,
                             build_int_cstu(TREE_TYPE(info_fields), info));
     info_fields = DECL_CHAIN(info_fields);
@@ -295,6 +318,8 @@ static tree build_info_var(variable_t &var_info, multiverse_info_types &types)
     info_fields = DECL_CHAIN(info_fields);
     CONSTRUCTOR_APPEND_ELT(obj, info_fields, null_pointer_node);
     info_fields = DECL_CHAIN(info_fields);
+    CONSTRUCTOR_APPEND_ELT(obj, info_fields, null_pointer_node);
+    info_fields = DECL_CHAIN(info_fields);
 
 
     gcc_assert(!info_fields); // All fields are filled
@@ -326,10 +351,16 @@ static tree build_info_callsite(callsite_t &cs_info, multiverse_info_types &type
 }
 
 
-static void build_info(multiverse_context *ctx, multiverse_info_types &types) {
+static void build_descriptors(multiverse_context *ctx, multiverse_info_types &types) {
     // Version ident
     // TODO: MV_VERSION ???
 
+    if (ctx->descriptors_emitted)
+        return;
+
+    // Members of struct variables that are defined, but not referenced
+    mv_add_member_variables(ctx);
+
     // Build the variables section.
     build_section_array("__multiverse_var_", ctx->variables, types.var_type,
                         build_info_var, types);
@@ -338,12 +369,34 @@ static void build_info(multiverse_context *ctx, multiverse_info_types &types) {
     build_section_array("__multiverse_fn_", ctx->functions, types.fn_type,
                         build_info_fn, types);
 
+    ctx->descriptors_emitted = true;
+}
+
+
+static void build_info(multiverse_context *ctx, multiverse_info_types &types) {
+    build_descriptors(ctx, types);
+
     // Build the callsites section.
     build_section_array("__multiverse_callsite_", ctx->callsites,
                         types.callsite_type, build_info_callsite, types);
 }
 
 
+/*
+ * Builds the variable and function descriptors before the end of the
+ * compilation unit. With -flto, they are streamed with the unit, while the
+ * callsites are only known in the LTRANS units (see mv_info_finish).
+ */
+void mv_info_build_descriptors(multiverse_context *ctx)
+{
+    if (ctx->descriptors_emitted)
+        return;
+
+    auto types = multiverse_info_types::build();
+    build_descriptors(ctx, types);
+}
+
+
 void mv_info_init(void *event_data, void *data)
 {
     (void) event_data;
@@ -0,0 +1,231 @@
+#include "gcc-common.h"
+#include <string>
+#include "multiverse.h"
+
+typedef multiverse_context::func_t func_t;
+typedef multiverse_context::mvfn_t mvfn_t;
+typedef multiverse_context::var_assign_t var_assign_t;
+typedef multiverse_report::function_t function_t;
+typedef multiverse_report::clone_t clone_t;
+
+
+multiverse_report mv_report;
+
+
+multiverse_report::function_t &multiverse_report::function(const char *name)
+{
+    function_t *&fn = index[name];
+    if (fn == nullptr) {
+        functions.emplace_back();
+        fn = &functions.back();
+        fn->name = name;
+        fn->generation_us = 0;
+        fn->elimination_us = 0;
+    }
+    return *fn;
+}
+
+
+multiverse_report::clone_t *multiverse_report::clone(const char *function,
+                                                     const char *name)
+{
+    auto it = index.find(function);
+    if (it == index.end())
+        return nullptr;
+    for (auto &clone : it->second->clones) {
+        if (clone.name == name)
+            return &clone;
+    }
+    return nullptr;
+}
+
+
+static void json_string(FILE *out, const char *s)
+{
+    if (!s) {
+        fputs("null", out);
+        return;
+    }
+    fputc('"', out);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(out, "\\u%04x", c);
+        else
+            fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+
+static void json_strings(FILE *out, const std::vector<std::string> &strings)
+{
+    fputc('[', out);
+    for (unsigned i = 0; i < strings.size(); i++) {
+        if (i > 0) fputc(',', out);
+        json_string(out, strings[i].c_str());
+    }
+    fputc(']', out);
+}
+
+
+static void json_assignments(FILE *out,
+                             const multiverse_context::var_assign_vector_t &assignments)
+{
+    bool first = true;
+    fputc('[', out);
+    for (const var_assign_t &assign : assignments) {
+        // Undefined assignments of tracked variables are not selectors
+        if (!assign.variable)
+            continue;
+        if (!first) fputc(',', out);
+        first = false;
+        fputs("{\"variable\":", out);
+        json_string(out, assign.variable->name());
+        if (assign.variable->bits)
+            fprintf(out, ",\"mask\":%u,\"pattern\":%u}", assign.lower_limit,
+                    assign.upper_limit);
+        else
+            fprintf(out, ",\"lower\":%u,\"upper\":%u}", assign.lower_limit,
+                    assign.upper_limit);
+    }
+    fputc(']', out);
+}
+
+
+static void write_function(FILE *out, func_t &fn_info, function_t *fn,
+                           unsigned n_callsites)
+{
+    bool first;
+
+    fputs("{\"name\":", out);
+    json_string(out, fn_info.name());
+    fprintf(out, ",\"function_pointer\":%s,\"definition\":%s",
+            fn_info.function_pointer ? "true" : "false",
+            fn_info.is_definition ? "true" : "false");
+    if (fn) {
+        fprintf(out, ",\"generation_us\":%ld,\"elimination_us\":%ld",
+                fn->generation_us, fn->elimination_us);
+    }
+
+    fputs(",\"variables\":[", out);
+    for (unsigned d = 0; fn && d < fn->dimensions.size(); d++) {
+        auto &dim = fn->dimensions[d];
+        if (d > 0) fputc(',', out);
+        fputs("{\"name\":", out);
+        json_string(out, dim.name.c_str());
+        fputs(",\"source\":", out);
+        json_string(out, dim.source);
+        fprintf(out, ",\"tracked\":%s", dim.tracked ? "true" : "false");
+        if (dim.mask)
+            fprintf(out, ",\"mask\":" HOST_WIDE_INT_PRINT_UNSIGNED, dim.mask);
+        fputs(",\"values\":[", out);
+        for (unsigned v = 0; v < dim.values.size(); v++) {
+            if (v > 0) fputc(',', out);
+            fprintf(out, "{\"value\":" HOST_WIDE_INT_PRINT_UNSIGNED ",\"label\":",
+                    dim.values[v].value);
+            json_string(out, dim.values[v].label);
+            fputc('}', out);
+        }
+        fputs("]}", out);
+    }
+
+    fputs("],\"clones\":[", out);
+    for (unsigned c = 0; fn && c < fn->clones.size(); c++) {
+        auto &clone = fn->clones[c];
+        if (c > 0) fputc(',', out);
+        fputs("{\"name\":", out);
+        json_string(out, clone.name.c_str());
+        fputs(",\"assignments\":", out);
+        json_assignments(out, clone.assignments);
+        fprintf(out, ",\"estimated_size\":%d,\"estimated_size_optimized\":",
+                clone.size_generated);
+        if (clone.size_optimized < 0)
+            fputs("null}", out);
+        else
+            fprintf(out, "%d}", clone.size_optimized);
+    }
+
+    fputs("],\"equivalence_classes\":[", out);
+    for (unsigned e = 0; fn && e < fn->equivalence_classes.size(); e++) {
+        if (e > 0) fputc(',', out);
+        json_strings(out, fn->equivalence_classes[e]);
+    }
+
+    // The selectors, as they are emitted into the descriptors
+    fputs("],\"selectors\":[", out);
+    first = true;
+    for (mvfn_t &mvfn : fn_info.mv_functions) {
+        if (!first) fputc(',', out);
+        first = false;
+        fputs("{\"body\":", out);
+        json_string(out, mvfn.name());
+        fputs(",\"assignments\":", out);
+        json_assignments(out, mvfn.assignments);
+        fputc('}', out);
+    }
+
+    fprintf(out, "],\"callsites\":%u,\"callers\":", n_callsites);
+    json_strings(out, fn ? fn->callers : std::vector<std::string>());
+    fputc('}', out);
+}
+
+
+void multiverse_report::write(multiverse_context *ctx)
+{
+    std::string file = path;
+    if (file.empty())
+        file = std::string(main_input_filename) + ".multiverse.json";
+
+    FILE *out = fopen(file.c_str(), "w");
+    if (!out) {
+        error(G_("cannot write the multiverse report %qs"), file.c_str());
+        return;
+    }
+
+    fprintf(out, "{\"version\":%d,\"unit\":", MV_VERSION);
+    json_string(out, main_input_filename);
+    fputs(",\"functions\":[", out);
+
+    std::unordered_map<const_tree, unsigned> n_callsites;
+    for (auto &cs : ctx->callsites)
+        n_callsites[DECL_ASSEMBLER_NAME(cs.fn_decl)]++;
+
+    bool first = true;
+    for (func_t &fn_info : ctx->functions) {
+        // Only functions that are defined here have variants
+        if (!fn_info.is_definition)
+            continue;
+        if (!first) fputs(",\n", out);
+        first = false;
+        auto it = index.find(fn_info.name());
+        function_t *fn = it == index.end() ? nullptr : it->second;
+        write_function(out, fn_info, fn, n_callsites[fn_info.identifier()]);
+    }
+    fputs("],\"variables\":[", out);
+    first = true;
+    for (auto &var : ctx->variables) {
+        if (!first) fputc(',', out);
+        first = false;
+        fputs("{\"name\":", out);
+        json_string(out, var.name());
+        fprintf(out, ",\"definition\":%s,\"tracked\":%s}",
+                var.is_definition ? "true" : "false",
+                var.tracked ? "true" : "false");
+    }
+    fputs("]}\n", out);
+    fclose(out);
+}
+
+
+void mv_report_finish(void *event_data, void *data)
+{
+    (void) event_data;
+    // LTRANS units only label callsites; the report of -flto units was
+    // written before they were streamed (see mv_lto_descriptors)
+    if (in_lto_p || flag_generate_lto)
+        return;
+    mv_report.write((multiverse_context *) data);
+}
@@ -25,9 +25,13 @@ static void build_info_fn_type(tree info_fn_type, tree info_mvfn_ptr_type)
 
         int n_mv_functions;
         struct mv_info_mvfn ** mv_functions;
+        unsigned long * hits;
 
         struct mv_patchpoint * patchpoints_head;
         struct mv_info_mvfn * active_mvfn;
+        int decoded;
+        struct mv_info_mvfn * lazy_mvfn;
+        struct mv_fn_tune * tune;
       };
     */
 
@@ -45,6 +49,9 @@ static void build_info_fn_type(tree info_fn_type, tree info_mvfn_ptr_type)
     /* mv_functions pointer */
     RECORD_FIELD(build_qualified_type(info_mvfn_ptr_type, TYPE_QUAL_CONST));
 
+    /* hits, the entry counter of the generic body */
+    RECORD_FIELD(build_pointer_type(long_unsigned_type_node));
+
     /* Fields initialized by the runtime system */
     /* patchpoints_head */
     RECORD_FIELD(build_pointer_type(void_type_node));
@@ -52,6 +59,15 @@ static void build_info_fn_type(tree info_fn_type, tree info_mvfn_ptr_type)
     /* active_mvfn */
     RECORD_FIELD(build_pointer_type(void_type_node));
 
+    /* decoded */
+    RECORD_FIELD(integer_type_node);
+
+    /* lazy_mvfn */
+    RECORD_FIELD(build_pointer_type(void_type_node));
+
+    /* tune */
+    RECORD_FIELD(build_pointer_type(void_type_node));
+
     finish_builtin_struct(info_fn_type, "__mv_info_fn", fields, NULL_TREE);
 }
 
@@ -74,6 +90,7 @@ static void build_info_var_type(tree info_variable_type)
 
         unsigned int n_functions;
         struct mv_info_fn **functions;
+        struct mv_var_policy *policy;
       };
     */
     tree field, fields = NULL_TREE;
@@ -92,6 +109,8 @@ static void build_info_var_type(tree info_variable_type)
     RECORD_FIELD(integer_type_node);
     /* functions */
     RECORD_FIELD(build_pointer_type(void_type_node));
+    /* policy */
+    RECORD_FIELD(build_pointer_type(void_type_node));
 
     finish_builtin_struct(info_variable_type, "__mv_info_var", fields, NULL_TREE);
 }
@@ -128,6 +147,7 @@ static void build_info_mvfn_type(tree info_mvfn_type, tree info_assignment_ptr_t
 
         int type;
         mv_value_t constant;
+        void * cached_body;
       };
     */
     tree field, fields = NULL_TREE;
@@ -148,6 +168,9 @@ static void build_info_mvfn_type(tree info_mvfn_type, tree info_assignment_ptr_t
     /* mv value integer */
     RECORD_FIELD(get_mv_unsigned_t());
 
+    /* cached_body */
+    RECORD_FIELD(build_pointer_type(void_type_node));
+
     finish_builtin_struct(info_mvfn_type, "__mv_info_mvfn", fields,
                           NULL_TREE);
 }
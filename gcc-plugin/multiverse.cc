@@ -13,16 +13,20 @@
 
 #include <algorithm>
 #include <assert.h>
+#include <limits.h>
 #include <bitset>
+#include <chrono>
 #include <list>
 #include <map>
 #include <set>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <set>
 
 #include "gcc-common.h"
+#include "cfghooks.h"
 #include "multiverse.h"
 
 #if BUILDING_GCC_VERSION < 6000 || BUILDING_GCC_VERSION >= 13000
@@ -73,6 +77,23 @@ const int TDF_NONE = 0;
 
 struct multiverse_context mv_ctx;
 
+// The attribute arguments of multiverse members, by FIELD_DECL
+static std::map<const_tree, multiverse_context::variable_args_t> mv_member_args;
+
+// The multiverse members, by the identifier of their struct variable
+static std::unordered_map<const_tree, std::vector<variable_t *>> mv_members;
+
+// -fplugin-arg-multiverse-hotness: count the calls of generic bodies
+static bool mv_hotness_counters = false;
+
+// Time spent in a pass, for the build report
+typedef std::chrono::steady_clock mv_clock;
+static long elapsed_us(mv_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        mv_clock::now() - start).count();
+}
+
 /*
  * Handler for multiverse attribute of variables. Here we collect all variables
  * that are defined in this compilation unit.
@@ -84,11 +105,23 @@ static tree handle_mv_attribute(tree *node, tree name, tree args, int flags,
     (void) no_add_attrs;
 
     int type = TREE_CODE(TREE_TYPE(*node));
+    // Data pointers are specialized for NULL and non-NULL
+    bool data_pointer = type == POINTER_TYPE
+        && TREE_CODE(TREE_TYPE(TREE_TYPE(*node))) != FUNCTION_TYPE;
     // FIXME: Error on weak attributed variables?
-    if (type == INTEGER_TYPE || type == ENUMERAL_TYPE || type == BOOLEAN_TYPE) {
+    if (type == INTEGER_TYPE || type == ENUMERAL_TYPE || type == BOOLEAN_TYPE
+        || data_pointer) {
         tree var_decl = *node;
-        DECL_PRESERVE_P(var_decl) = 1;
-        variable_t &var_info = mv_ctx.variables.add(var_decl);
+        // The members of struct types become variables with the global
+        // variables of these types (see mv_add_member_variables)
+        multiverse_context::variable_args_t *args_info;
+        if (TREE_CODE(var_decl) == FIELD_DECL) {
+            args_info = &mv_member_args[var_decl];
+        } else {
+            DECL_PRESERVE_P(var_decl) = 1;
+            args_info = &mv_ctx.variables.add(var_decl);
+        }
+        multiverse_context::variable_args_t &var_info = *args_info;
 
         location_t loc = DECL_SOURCE_LOCATION(*node);
         for (tree p = args; p; p = TREE_CHAIN(p)) {
@@ -129,8 +162,28 @@ static tree handle_mv_attribute(tree *node, tree name, tree args, int flags,
                     }
                 }
                 if (arg == "values") {
+                    if (data_pointer) {
+                        error_at(loc, "multiverse attribute argument %qs requires "
+                                 "an integer, boolean or enumeral type", arg.c_str());
+                        continue;
+                    }
                     // TODO: A warning should be generated if we have different values in decls.
                     var_info.values.insert(values.begin(), values.end());
+                } else if (arg == "bits") {
+                    // ("bits", MASK): only the tested bits of MASK are
+                    // specialized, the other bits stay dynamic
+                    if (type != INTEGER_TYPE) {
+                        error_at(loc, "multiverse attribute argument %qs requires "
+                                 "an integer type", arg.c_str());
+                        continue;
+                    }
+                    unsigned precision = TYPE_PRECISION(TREE_TYPE(var_decl));
+                    for (auto val : values)
+                        var_info.bits |= val;
+                    if (precision < 32)
+                        var_info.bits &= (HOST_WIDE_INT_1U << precision) - 1;
+                    else
+                        var_info.bits &= 0xffffffff;
                 } else {
                 invalid_argument:
                     error_at(loc, "unknown multi-valued multiverse attribute argument %qs",
@@ -149,15 +202,17 @@ static tree handle_mv_attribute(tree *node, tree name, tree args, int flags,
                                            tree_cons(get_identifier("noinline"), NULL,
                                                      DECL_ATTRIBUTES(*node)));
         DECL_UNINLINABLE(*node) = 1;
-    } else if (type == POINTER_TYPE
-               && (TREE_CODE(TREE_TYPE(TREE_TYPE(*node))) == FUNCTION_TYPE)) {
+    } else if (type == POINTER_TYPE && TREE_CODE(*node) == FIELD_DECL) {
+        error("member %qD with %qE attribute must not be a function pointer",
+              *node, name);
+    } else if (type == POINTER_TYPE) {
         // This is the third possibility how the multiverse attribute can be used.
         // We ensured that the pointer is a function pointer.
         func_t &func = mv_ctx.functions.add(*node);
         func.function_pointer = true;
     } else {
-        error("variable %qD with %qE attribute must be an integer, boolean "
-              "or enumeral type or a function pointer", *node, name);
+        error("variable %qD with %qE attribute must be an integer, boolean, "
+              "enumeral or pointer type", *node, name);
     }
 
     return NULL_TREE;
@@ -216,11 +271,32 @@ struct cgraph_node *get_fn_cnode(const_tree fndecl)
 }
 
 
+/*
+ * Return true if ref is a multiverse member of a global struct variable:
+ * a chain of component references (cfg.sub.verbose) down to the variable.
+ */
+static bool is_multiverse_member(tree ref)
+{
+    tree field = TREE_OPERAND(ref, 1);
+    if (DECL_BIT_FIELD(field)
+        || lookup_attribute("multiverse", DECL_ATTRIBUTES(field)) == NULL_TREE)
+        return false;
+
+    tree base = ref;
+    while (TREE_CODE(base) == COMPONENT_REF)
+        base = TREE_OPERAND(base, 0);
+    return TREE_CODE(base) == VAR_DECL && is_global_var(base);
+}
+
+
 /*
  * Return true if var is multiverse attributed.
  */
 static bool is_multiverse_var(tree &var)
 {
+    if (TREE_CODE(var) == COMPONENT_REF)
+        return is_multiverse_member(var);
+
     if (!is_global_var(var) || TREE_CODE(var) != VAR_DECL)
         return false;
 
@@ -264,6 +340,201 @@ static bool is_multiverse_fp(tree &fp)
 }
 
 
+multiverse_context::variable_t::variable_t(tree decl)
+    : decl_ref_t(get_base_address(decl)), stored_open(false), member_name(NULL)
+{
+    if (TREE_CODE(decl) != COMPONENT_REF)
+        return;
+    for (tree ref = decl; TREE_CODE(ref) == COMPONENT_REF; ref = TREE_OPERAND(ref, 0))
+        fields.insert(fields.begin(), TREE_OPERAND(ref, 1));
+    member_name = key(decl);
+}
+
+
+/*
+ * Members are named after their variable and the named fields on the way
+ * (fields of anonymous structs have no name): cfg.sub.verbose
+ */
+const_tree multiverse_context::variable_t::key(tree decl)
+{
+    if (TREE_CODE(decl) != COMPONENT_REF)
+        return DECL_ASSEMBLER_NAME(decl);
+
+    std::string name;
+    tree ref;
+    for (ref = decl; TREE_CODE(ref) == COMPONENT_REF; ref = TREE_OPERAND(ref, 0)) {
+        tree field = TREE_OPERAND(ref, 1);
+        if (DECL_NAME(field))
+            name = "." + std::string(IDENTIFIER_POINTER(DECL_NAME(field))) + name;
+    }
+    name = IDENTIFIER_POINTER(DECL_ASSEMBLER_NAME(ref)) + name;
+    return get_identifier(name.c_str());
+}
+
+
+tree multiverse_context::variable_t::type()
+{
+    if (!fields.empty())
+        return TREE_TYPE(fields.back());
+    return TREE_TYPE(decl());
+}
+
+
+tree multiverse_context::variable_t::ref()
+{
+    tree ref = decl();
+    if (ref == NULL_TREE)
+        return NULL_TREE;
+    for (tree field : fields)
+        ref = build3(COMPONENT_REF, TREE_TYPE(field), ref, field, NULL_TREE);
+    return ref;
+}
+
+
+/*
+ * Return true if the member reference ref names the member, that is, it
+ * has the same named fields (see variable_t::key). The caller compares
+ * the struct variables.
+ */
+static bool member_path_is(variable_t *member, tree ref)
+{
+    auto field = member->fields.rbegin();
+    for (; TREE_CODE(ref) == COMPONENT_REF; ref = TREE_OPERAND(ref, 0)) {
+        tree name = DECL_NAME(TREE_OPERAND(ref, 1));
+        if (!name)
+            continue;
+        while (field != member->fields.rend() && !DECL_NAME(*field))
+            ++field;
+        if (field == member->fields.rend() || DECL_NAME(*field) != name)
+            return false;
+        ++field;
+    }
+    while (field != member->fields.rend() && !DECL_NAME(*field))
+        ++field;
+    return field == member->fields.rend();
+}
+
+
+/*
+ * Return the multiverse members of the global struct variable that ref
+ * refers to, or NULL.
+ */
+static std::vector<variable_t *> *members_of(tree ref)
+{
+    if (mv_members.empty())
+        return NULL;
+    tree base = get_base_address(ref);
+    if (!base || TREE_CODE(base) != VAR_DECL || !is_global_var(base))
+        return NULL;
+    auto it = mv_members.find(DECL_ASSEMBLER_NAME(base));
+    if (it == mv_members.end())
+        return NULL;
+    return &it->second;
+}
+
+
+/*
+ * Return true if the operand op references the multiverse variable.
+ */
+static bool refers_to(tree op, variable_t *var_info)
+{
+    if (op == NULL_TREE)
+        return false;
+    if (var_info->fields.empty())
+        return TREE_CODE(op) == VAR_DECL && DECL_ASSEMBLER_NAME_SET_P(op)
+            && DECL_ASSEMBLER_NAME(op) == var_info->identifier();
+    return TREE_CODE(op) == COMPONENT_REF && is_multiverse_member(op)
+        && var_info->is_ref_to(get_base_address(op))
+        && member_path_is(var_info, op);
+}
+
+
+/*
+ * Return the multiverse variable of a multiverse attributed operand. A
+ * member is added as variable when it is referenced first; members are
+ * looked up among those of their struct variable, without building
+ * their names.
+ */
+static variable_t *lookup_variable(multiverse_context *ctx, tree var)
+{
+    if (TREE_CODE(var) != COMPONENT_REF)
+        return ctx->variables.get(var);
+
+    std::vector<variable_t *> *members = members_of(var);
+    if (members) {
+        for (variable_t *member : *members) {
+            if (member_path_is(member, var))
+                return member;
+        }
+    }
+
+    variable_t *var_info = &ctx->variables.add(var);
+    static_cast<multiverse_context::variable_args_t &>(*var_info) =
+        mv_member_args[TREE_OPERAND(var, 1)];
+    DECL_PRESERVE_P(get_base_address(var)) = 1;
+    mv_members[var_info->decl_ref_t::identifier()].push_back(var_info);
+    return var_info;
+}
+
+
+static void add_members(multiverse_context *ctx, tree ref, tree type)
+{
+    for (tree field = TYPE_FIELDS(type); field; field = DECL_CHAIN(field)) {
+        if (TREE_CODE(field) != FIELD_DECL)
+            continue;
+        tree member = build3(COMPONENT_REF, TREE_TYPE(field), ref, field, NULL_TREE);
+        if (RECORD_OR_UNION_TYPE_P(TREE_TYPE(field)))
+            add_members(ctx, member, TREE_TYPE(field));
+        else if (is_multiverse_member(member))
+            lookup_variable(ctx, member);
+    }
+}
+
+
+/*
+ * The multiverse members of the global struct variables of the unit are
+ * variables of their own. The unit that defines a struct variable emits
+ * their descriptors, even if it does not reference them.
+ */
+void mv_add_member_variables(multiverse_context *ctx)
+{
+    varpool_node *node;
+
+    if (mv_member_args.empty())
+        return;
+    FOR_EACH_VARIABLE(node) {
+        tree decl = node->decl;
+        if (is_global_var(decl) && RECORD_OR_UNION_TYPE_P(TREE_TYPE(decl)))
+            add_members(ctx, decl, TREE_TYPE(decl));
+    }
+}
+
+
+/*
+ * Return true if a store to ref may change the member: ref is the struct
+ * variable of the member, or a struct on the path to the member, or a
+ * member of a union on that path.
+ */
+static bool member_overlaps(variable_t &member, tree ref)
+{
+    std::vector<tree> path;
+    tree base = ref;
+    for (; TREE_CODE(base) == COMPONENT_REF; base = TREE_OPERAND(base, 0))
+        path.insert(path.begin(), TREE_OPERAND(base, 1));
+    // Array and memory references (MEM[&cfg] = ...) may cover the member
+    if (TREE_CODE(base) != VAR_DECL)
+        return get_base_address(base) == member.decl();
+    if (base != member.decl())
+        return false;
+
+    for (unsigned i = 0; i < path.size() && i < member.fields.size(); i++) {
+        if (path[i] != member.fields[i])
+            return TREE_CODE(DECL_CONTEXT(path[i])) == UNION_TYPE;
+    }
+    return true;
+}
+
+
 /*
  * Build a clone of FNDECL with a modified name.
  *
@@ -315,9 +586,9 @@ static tree clone_fndecl(tree fndecl, std::string fname)
 /*
  * Replace all occurrences of old_var in cfun with value.
  */
-static void replace_and_constify(tree old_var, const int value)
+static void replace_and_constify(variable_t *old_var, const int value)
 {
-    tree new_var = build_int_cst(TREE_TYPE(old_var), value);
+    tree new_var = build_int_cst(old_var->type(), value);
 
     basic_block bb;
     FOR_EACH_BB_FN(bb, cfun) {
@@ -332,7 +603,7 @@ static void replace_and_constify(tree old_var, const int value)
             // check if any operand is a multiverse variable
             for (unsigned num = 1; num < gimple_num_ops(stmt); num++) {
                 tree var = gimple_op(stmt, num);
-                if (var != old_var)
+                if (!refers_to(var, old_var))
                     continue;
 
                 gimple_set_op(stmt, num, new_var);
@@ -348,6 +619,137 @@ static void replace_and_constify(tree old_var, const int value)
 }
 
 
+/*
+ * Collects the statements that test bits of a loaded "bits" variable
+ * (value & CONSTANT), also behind integral conversions that keep the
+ * bits of the variable.
+ */
+static void find_bit_tests(tree value, std::vector<gimple> &tests)
+{
+    gimple use_stmt;
+    imm_use_iterator imm_iter;
+    FOR_EACH_IMM_USE_STMT(use_stmt, imm_iter, value) {
+        if (!is_gimple_assign(use_stmt))
+            continue;
+        tree lhs = gimple_assign_lhs(use_stmt);
+        enum tree_code code = gimple_assign_rhs_code(use_stmt);
+        if (code == BIT_AND_EXPR && gimple_assign_rhs1(use_stmt) == value
+            && TREE_CODE(gimple_assign_rhs2(use_stmt)) == INTEGER_CST) {
+            tests.push_back(use_stmt);
+        } else if (CONVERT_EXPR_CODE_P(code) && TREE_CODE(lhs) == SSA_NAME
+                   && INTEGRAL_TYPE_P(TREE_TYPE(lhs))
+                   && TYPE_PRECISION(TREE_TYPE(lhs)) >= TYPE_PRECISION(TREE_TYPE(value))) {
+            find_bit_tests(lhs, tests);
+        }
+    }
+}
+
+
+/*
+ * Replace the bit tests of old_var in cfun, whose bits are all in mask,
+ * with their result for the given pattern. Other uses stay dynamic.
+ */
+static void replace_bits_and_constify(variable_t *old_var, mv_value_t mask,
+                                      mv_value_t pattern)
+{
+    std::vector<gimple> tests;
+
+    basic_block bb;
+    FOR_EACH_BB_FN(bb, cfun) {
+        gimple_stmt_iterator gsi;
+        for (gsi = gsi_start_bb(bb); !gsi_end_p(gsi); gsi_next(&gsi)) {
+            gimple stmt = gsi_stmt(gsi);
+            if (gimple_assign_single_p(stmt) && refers_to(gimple_assign_rhs1(stmt), old_var)
+                && TREE_CODE(gimple_assign_lhs(stmt)) == SSA_NAME)
+                find_bit_tests(gimple_assign_lhs(stmt), tests);
+        }
+    }
+
+    for (gimple stmt : tests) {
+        mv_value_t bits = int_cst_value(gimple_assign_rhs2(stmt));
+        if (bits & ~mask)
+            continue;
+
+        tree type = TREE_TYPE(gimple_assign_lhs(stmt));
+        gimple_stmt_iterator gsi = gsi_for_stmt(stmt);
+        gimple_assign_set_rhs_from_tree(&gsi, build_int_cst(type, pattern & bits));
+        update_stmt(gsi_stmt(gsi));
+
+        if (dump_file) {
+            debug_printf(".. found bit test of multiverse variable, replacing: ");
+            print_gimple_stmt(dump_file, gsi_stmt(gsi), 0, TDF_SLIM);
+        }
+    }
+}
+
+
+/*
+ * Replace the NULL tests of the pointer old_var in cfun with their result. A
+ * NULL pointer is replaced everywhere; a non-NULL pointer stays dynamic,
+ * only its comparisons with NULL are constant.
+ */
+static void replace_pointer_and_constify(variable_t *old_var, bool non_null)
+{
+    if (!non_null) {
+        replace_and_constify(old_var, 0);
+        return;
+    }
+
+    std::vector<gimple> tests;
+    basic_block bb;
+    FOR_EACH_BB_FN(bb, cfun) {
+        gimple_stmt_iterator gsi;
+        for (gsi = gsi_start_bb(bb); !gsi_end_p(gsi); gsi_next(&gsi)) {
+            gimple stmt = gsi_stmt(gsi);
+            if (!gimple_assign_single_p(stmt) || !refers_to(gimple_assign_rhs1(stmt), old_var)
+                || TREE_CODE(gimple_assign_lhs(stmt)) != SSA_NAME)
+                continue;
+
+            tree value = gimple_assign_lhs(stmt);
+            gimple use_stmt;
+            imm_use_iterator imm_iter;
+            FOR_EACH_IMM_USE_STMT(use_stmt, imm_iter, value) {
+                if (gimple_code(use_stmt) == GIMPLE_COND) {
+                    if ((gimple_cond_code(use_stmt) == EQ_EXPR
+                         || gimple_cond_code(use_stmt) == NE_EXPR)
+                        && gimple_cond_lhs(use_stmt) == value
+                        && integer_zerop(gimple_cond_rhs(use_stmt)))
+                        tests.push_back(use_stmt);
+                } else if (is_gimple_assign(use_stmt)) {
+                    if ((gimple_assign_rhs_code(use_stmt) == EQ_EXPR
+                         || gimple_assign_rhs_code(use_stmt) == NE_EXPR)
+                        && gimple_assign_rhs1(use_stmt) == value
+                        && integer_zerop(gimple_assign_rhs2(use_stmt)))
+                        tests.push_back(use_stmt);
+                }
+            }
+        }
+    }
+
+    for (gimple stmt : tests) {
+        if (gimple_code(stmt) == GIMPLE_COND) {
+            gcond *cond = as_a_gcond(stmt);
+            if (gimple_cond_code(cond) == NE_EXPR)
+                gimple_cond_make_true(cond);
+            else
+                gimple_cond_make_false(cond);
+            update_stmt(stmt);
+        } else {
+            tree type = TREE_TYPE(gimple_assign_lhs(stmt));
+            bool result = gimple_assign_rhs_code(stmt) == NE_EXPR;
+            gimple_stmt_iterator gsi = gsi_for_stmt(stmt);
+            gimple_assign_set_rhs_from_tree(&gsi, constant_boolean_node(result, type));
+            update_stmt(gsi_stmt(gsi));
+        }
+
+        if (dump_file) {
+            debug_printf(".. found NULL test of multiverse variable, replacing: ");
+            print_gimple_stmt(dump_file, stmt, 0, TDF_SLIM);
+        }
+    }
+}
+
+
 /*
  * Clone the current function and replace all variables in @assignment with the
  * associated values.
@@ -371,6 +773,8 @@ static unsigned int multiverse_function(func_t &fn_info,
         ss << "." << assign.variable->name() << "_";
         if (assign.label)
             ss << assign.label;
+        else if (assign.variable->bits)
+            ss << "bits" << assign.upper_limit; // The mask is per function
         else
             ss << assign.lower_limit;
     }
@@ -382,13 +786,30 @@ static unsigned int multiverse_function(func_t &fn_info,
     clone = clone_fndecl(fndecl, fname);
     gcc_assert(clone != fndecl);
 
+    // All variants are placed in a dedicated section. After
+    // multiverse_seal(), the runtime drops the pages that contain only
+    // variants that can never be selected again.
+    if (!DECL_SECTION_NAME(fndecl))
+        set_decl_section_name(clone, "__multiverse_text_");
+
     clone_func = DECL_STRUCT_FUNCTION(clone);
     push_cfun(clone_func);
     mvfn_t mvfn(clone);
     mvfn.assignments = assignments;
 
     for ( var_assign_t &assign : assignments) {
-        replace_and_constify(assign.variable->decl(), assign.lower_limit);
+        if (assign.variable->bits)
+            replace_bits_and_constify(assign.variable, assign.lower_limit,
+                                      assign.upper_limit);
+        else if (POINTER_TYPE_P(assign.variable->type()))
+            replace_pointer_and_constify(assign.variable, assign.lower_limit != 0);
+        else
+            replace_and_constify(assign.variable, assign.lower_limit);
+    }
+
+    if (mv_report.enabled) {
+        mv_report.function(fn_info.name()).clones.push_back(
+            {fname, assignments, estimate_num_insns_fn(clone, &eni_size_weights), -1});
     }
 
     fn_info.mv_functions.push_back(mvfn);
@@ -399,6 +820,44 @@ static unsigned int multiverse_function(func_t &fn_info,
 }
 
 
+/*
+ * Count the calls of the generic function body in a static counter. Once
+ * the function is committed, the entry of the generic body is patched with a
+ * jump to the selected variant, and the counter is not reached anymore.
+ */
+static void instrument_hotness(func_t &fn_info)
+{
+    std::string name = std::string(fn_info.name()) + ".multiverse_hits";
+    tree type = long_unsigned_type_node;
+
+    tree counter = build_decl(DECL_SOURCE_LOCATION(cfun->decl), VAR_DECL,
+                              get_identifier(name.c_str()), type);
+    TREE_STATIC(counter) = 1;
+    TREE_USED(counter) = 1;
+    TREE_ADDRESSABLE(counter) = 1;
+    DECL_ARTIFICIAL(counter) = 1;
+    DECL_PRESERVE_P(counter) = 1;
+    DECL_INITIAL(counter) = build_int_cst(type, 0);
+    varpool_node::finalize_decl(counter);
+
+    // A fresh block behind the entry, as the first block may be a loop header
+    basic_block bb = split_edge(single_succ_edge(ENTRY_BLOCK_PTR_FOR_FN(cfun)));
+    gimple_stmt_iterator gsi = gsi_start_bb(bb);
+
+    tree old_value = make_ssa_name(type);
+    tree new_value = make_ssa_name(type);
+    gsi_insert_after(&gsi, gimple_build_assign(old_value, counter), GSI_NEW_STMT);
+    gsi_insert_after(&gsi, gimple_build_assign(new_value, PLUS_EXPR, old_value,
+                                               build_int_cst(type, 1)),
+                     GSI_NEW_STMT);
+    gsi_insert_after(&gsi, gimple_build_assign(counter, new_value), GSI_NEW_STMT);
+    mark_virtual_operands_for_renaming(cfun);
+
+    fn_info.hit_counter = counter;
+    debug_printf("instrumented %s with a hotness counter\n", fn_info.name());
+}
+
+
 void multiverse_variant_generator::add_variable(variable_t *variable)
 {
     bool found = false;
@@ -437,6 +896,26 @@ void multiverse_variant_generator::add_variable_value(variable_t *variable,
 }
 
 
+void multiverse_variant_generator::add_variable_bits(variable_t *variable,
+                                                     mv_value_t mask,
+                                                     mv_value_t pattern)
+{
+    bool found = false;
+    for (auto &var : variables) {
+        if (var.first == variable) {
+            found = true;
+            var_assign_t assign;
+            assign.variable = variable;
+            assign.lower_limit = mask;
+            assign.upper_limit = pattern;
+            assign.label = NULL;
+            var.second.push_back(assign);
+        }
+    }
+    assert(found && "Dimension not found");
+}
+
+
 void multiverse_variant_generator::start(int maximal_elements)
 {
     state.clear();
@@ -483,7 +962,7 @@ var_assign_vector_t multiverse_variant_generator::next()
         var_assign_t &assign = variables[i].second[state[i]];
         // Is undefined? If the assignment is
         // undefined/untracked/unbound. Don't add it as a vector
-        if (assign.lower_limit <= assign.upper_limit)
+        if (assign.variable)
             ret.push_back(assign);
     }
     // And increment to the next element
@@ -501,6 +980,165 @@ var_assign_vector_t multiverse_variant_generator::next()
 }
 
 
+// More inferred values make more variants than they can save
+#define MAX_STORED_VALUES 16
+// Tested bits of a "bits" variable give 2^n variants
+#define MAX_TESTED_BITS 6
+
+
+static void mark_stores_open(variable_t *var_info, location_t loc, bool escapes)
+{
+    if (var_info->stored_open)
+        return;
+    var_info->stored_open = true;
+    if (!var_info->values.empty() || var_info->bits
+        || TREE_CODE(var_info->type()) != INTEGER_TYPE)
+        return;
+    if (escapes)
+        warning_at(loc, OPT_Wextra, "address of multiverse variable %qs escapes; "
+                   "its values are not inferred", var_info->name());
+    else
+        warning_at(loc, OPT_Wextra, "non-constant value stored to multiverse "
+                   "variable %qs; its values are not inferred", var_info->name());
+}
+
+
+/*
+ * Stores to a struct variable, or to a struct on the path to a member,
+ * and the escapes of their addresses may change its multiverse members.
+ */
+static void mark_members_open(tree ref, location_t loc, bool escapes)
+{
+    std::vector<variable_t *> *members = members_of(ref);
+    if (!members)
+        return;
+    for (variable_t *member : *members) {
+        if (member_overlaps(*member, ref))
+            mark_stores_open(member, loc, escapes);
+    }
+}
+
+
+/*
+ * Records the stores of a statement to multiverse variables: assignments
+ * of constants, and the escapes of their addresses, which may lead to
+ * any value. The multiverse_*() functions of the run-time library take
+ * the addresses of variables without storing to them.
+ */
+static void record_stores(gimple stmt)
+{
+    location_t loc = gimple_location(stmt);
+
+    // Assignments, and calls that return into memory
+    tree lhs = gimple_get_lhs(stmt);
+    if (lhs && is_multiverse_var(lhs)) {
+        variable_t *var_info = lookup_variable(&mv_ctx, lhs);
+        if (var_info) {
+            if (gimple_assign_single_p(stmt)
+                && TREE_CODE(gimple_assign_rhs1(stmt)) == INTEGER_CST)
+                var_info->stored.insert(int_cst_value(gimple_assign_rhs1(stmt)));
+            else
+                mark_stores_open(var_info, loc, false);
+        }
+    } else if (lhs) {
+        mark_members_open(lhs, loc, false);
+    }
+
+    if (is_gimple_call(stmt)) {
+        tree callee = gimple_call_fndecl(stmt);
+        if (callee && DECL_NAME(callee)
+            && !strncmp(IDENTIFIER_POINTER(DECL_NAME(callee)), "multiverse_", 11))
+            return;
+    }
+    for (unsigned num = 0; num < gimple_num_ops(stmt); num++) {
+        tree op = gimple_op(stmt, num);
+        if (!op || TREE_CODE(op) != ADDR_EXPR)
+            continue;
+        tree var = TREE_OPERAND(op, 0);
+        variable_t *var_info;
+        if (is_multiverse_var(var)) {
+            if ((var_info = lookup_variable(&mv_ctx, var)))
+                mark_stores_open(var_info, loc, true);
+        } else {
+            mark_members_open(var, loc, true);
+        }
+    }
+}
+
+
+/*
+ * The initial value of a variable or member: NULL_TREE for zero, or
+ * error_mark_node if it is unknown.
+ */
+static tree initial_value(variable_t &var_info)
+{
+    tree init = DECL_INITIAL(var_info.decl());
+    for (tree field : var_info.fields) {
+        if (init == NULL_TREE)
+            return NULL_TREE;
+        if (TREE_CODE(init) != CONSTRUCTOR)
+            return error_mark_node;
+        tree index, value, found = NULL_TREE;
+        unsigned i;
+        FOR_EACH_CONSTRUCTOR_ELT(CONSTRUCTOR_ELTS(init), i, index, value) {
+            if (index == field)
+                found = value;
+        }
+        // Another member of a union may be initialized
+        if (found == NULL_TREE && TREE_CODE(DECL_CONTEXT(field)) == UNION_TYPE)
+            return error_mark_node;
+        init = found;
+    }
+    return init;
+}
+
+
+/*
+ * Collects the constants that the unit stores to its multiverse variables.
+ * This runs once, when the generation pass sees the first function; the
+ * bodies of all functions of the unit are lowered to GIMPLE by then. If a
+ * variable is stored to, its initial value is one of the values as well.
+ */
+static void infer_stored_values()
+{
+    static bool done = false;
+    cgraph_node *node;
+
+    if (done)
+        return;
+    done = true;
+
+    mv_add_member_variables(&mv_ctx);
+
+    FOR_EACH_FUNCTION_WITH_GIMPLE_BODY(node) {
+        function *fn = DECL_STRUCT_FUNCTION(node->decl);
+        basic_block bb;
+        if (!fn || !fn->cfg)
+            continue;
+        FOR_EACH_BB_FN(bb, fn) {
+            gimple_stmt_iterator gsi;
+            for (gsi = gsi_start_bb(bb); !gsi_end_p(gsi); gsi_next(&gsi))
+                record_stores(gsi_stmt(gsi));
+        }
+    }
+
+    for (auto &var_info : mv_ctx.variables) {
+        if (var_info.stored.empty() || !var_info.is_definition)
+            continue;
+        tree decl = var_info.decl();
+        if (!decl)
+            continue;
+        tree init = initial_value(var_info);
+        if (init == NULL_TREE)
+            var_info.stored.insert(0);
+        else if (TREE_CODE(init) == INTEGER_CST)
+            var_info.stored.insert(int_cst_value(init));
+        else
+            var_info.stored_open = true;
+    }
+}
+
+
 /*
  * Pass to find multiverse attributed variables in the current function.  In
  * case such variables are used in assignments or conditional statements, the
@@ -516,9 +1154,13 @@ static unsigned int mv_variant_generation_execute()
         return 0;
     }
 
-    std::map<tree, std::set<mv_value_t>> mv_vars;
+    mv_clock::time_point start = mv_clock::now();
+    std::map<variable_t *, std::set<mv_value_t>> mv_vars;
+    std::map<variable_t *, mv_value_t> mv_bits;
 
-    std::set<tree> mv_blacklist;
+    infer_stored_values();
+
+    std::set<variable_t *> mv_blacklist;
     basic_block bb;
     /* Iterate over each basic block in current function. */
     FOR_EACH_BB_FN(bb, cfun) {
@@ -540,16 +1182,36 @@ static unsigned int mv_variant_generation_execute()
             if (is_multiverse_var(lhs)) {
                 location_t loc = gimple_location(stmt);
                 warning_at(loc, OPT_Wextra, "multiverse variable used as lvalue in multiverse function");
-                mv_blacklist.insert(lhs);
+                if (variable_t *var_info = lookup_variable(&mv_ctx, lhs))
+                    mv_blacklist.insert(var_info);
                 continue;
             }
 
+            /*
+             * A store to the struct of a member, or to a struct on its
+             * path (cfg = defaults, cfg.sub = x), changes the member, too.
+             */
+            if (std::vector<variable_t *> *members = members_of(lhs)) {
+                for (variable_t *member : *members) {
+                    if (!member_overlaps(*member, lhs))
+                        continue;
+                    warning_at(gimple_location(stmt), OPT_Wextra,
+                               "multiverse member %qs changed in multiverse function",
+                               member->name());
+                    mv_blacklist.insert(member);
+                }
+            }
+
             /* Check if any operand is a multiverse variable */
             for (unsigned num = 1; num < gimple_num_ops(stmt); num++) {
                 tree var = gimple_op(stmt, num);
 
                 if (!is_multiverse_var(var))
                     continue;
+                // Function pointers are no variables
+                variable_t *var_info = lookup_variable(&mv_ctx, var);
+                if (!var_info)
+                    continue;
 
                 if (dump_file) {
                     debug_printf("found multiverse operand: ");
@@ -557,8 +1219,22 @@ static unsigned int mv_variant_generation_execute()
                 }
 
                 // Insert variable. Initially without hints
-                if (mv_vars.find(var) == mv_vars.end()) {
-                    mv_vars[var] = std::set<mv_value_t>();
+                if (mv_vars.find(var_info) == mv_vars.end()) {
+                    mv_vars[var_info] = std::set<mv_value_t>();
+                }
+
+                if (var_info->bits) {
+                    // Collect the bits of the mask that this function tests
+                    std::vector<gimple> tests;
+                    if (gimple_num_ops(stmt) == 2
+                        && TREE_CODE(gimple_op(stmt, 0)) == SSA_NAME)
+                        find_bit_tests(gimple_op(stmt, 0), tests);
+                    for (gimple test : tests) {
+                        mv_value_t bits = int_cst_value(gimple_assign_rhs2(test));
+                        if (!(bits & ~var_info->bits))
+                            mv_bits[var_info] |= bits;
+                    }
+                    continue;
                 }
 
                 if (gimple_num_ops(stmt) == 2 && TREE_CODE(TREE_TYPE(var)) == INTEGER_TYPE) {
@@ -581,7 +1257,7 @@ static unsigned int mv_variant_generation_execute()
                             if (!CONSTANT_CLASS_P(comparand)) continue;
 
                             mv_value_t constant = int_cst_value(comparand);
-                            mv_vars[var].insert(constant);
+                            mv_vars[var_info].insert(constant);
                         }
                     }
                 }
@@ -597,6 +1273,28 @@ static unsigned int mv_variant_generation_execute()
         mv_vars.erase(black);
     }
 
+    // "bits" variables, whose bits are not tested, are not specialized.
+    // Of many tested bits, only the lowest ones are.
+    for (auto it = mv_vars.begin(); it != mv_vars.end();) {
+        variable_t *var_info = it->first;
+        if (!var_info->bits) {
+            ++it;
+            continue;
+        }
+        mv_value_t &tested = mv_bits[it->first];
+        unsigned n = 0;
+        for (mv_value_t bits = tested; bits; bits &= bits - 1) {
+            if (++n > MAX_TESTED_BITS)
+                tested &= ~(bits & -bits);
+        }
+        if (tested == 0) {
+            debug_printf("...no bits of '%s' are tested\n", var_info->name());
+            it = mv_vars.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
     // If a multiverse-attributed function does not reference multiverse
     // variables, throw a warning
     const int numvars = mv_vars.size();
@@ -611,30 +1309,38 @@ static unsigned int mv_variant_generation_execute()
 
     //TODO: comments for the code below & for the mv_variant_generator_decl
     multiverse_variant_generator generator;
+    std::map<variable_t *, const char *> value_sources;
     for (auto & item : mv_vars) {
-        auto &variable = item.first;
+        variable_t *var_info = item.first;
         auto &hints = item.second;
-
-        variable_t *var_info = mv_ctx.variables.get(variable);
-
-        assert (var_info != nullptr && "We should always find these variables");
+        tree type = var_info->type();
 
         // We reference the variable in this function. Therefore, we
         // add it to the current variant generator instance.
         generator.add_variable(var_info);
 
-        // If there are explicit values, we add only these to the
-        // generator
-        if (!var_info->values.empty()) {
+        // For "bits" variables, we add every pattern of the tested bits
+        if (var_info->bits) {
+            value_sources[var_info] = "bits";
+            mv_value_t mask = mv_bits[var_info], pattern = 0;
+            do {
+                generator.add_variable_bits(var_info, mask, pattern);
+                pattern = (pattern - mask) & mask;
+            } while (pattern != 0);
+        } else if (!var_info->values.empty()) {
+            // If there are explicit values, we add only these to the
+            // generator
+            value_sources[var_info] = "attribute";
             for (auto val : var_info->values) {
                 generator.add_variable_value(var_info, NULL, val);
             }
         } else {
             // Ok no explicit values. Start guessing.
-            if (TREE_CODE(TREE_TYPE(variable)) == ENUMERAL_TYPE) {
+            if (TREE_CODE(type) == ENUMERAL_TYPE) {
                 // For enumeration types: we add all enumeration values
+                value_sources[var_info] = "enum";
                 tree element;
-                for (element = TYPE_VALUES (TREE_TYPE (variable));
+                for (element = TYPE_VALUES (type);
                      element != NULL_TREE;
                      element = TREE_CHAIN (element)) {
                     const char * label = IDENTIFIER_POINTER(TREE_PURPOSE(element));
@@ -643,9 +1349,19 @@ static unsigned int mv_variant_generation_execute()
                         generator.add_variable_value(var_info, label, val);
                     }
                 }
-            } else if (TREE_CODE(TREE_TYPE(variable)) == INTEGER_TYPE) {
-                // For integer types, we add the hints, we extracted from this
+            } else if (TREE_CODE(type) == INTEGER_TYPE
+                       && !var_info->stored.empty() && !var_info->stored_open
+                       && var_info->stored.size() <= MAX_STORED_VALUES) {
+                // For integer types, we add the constants that are stored
+                // to the variable, if we know them all
+                value_sources[var_info] = "stores";
+                for (auto val : var_info->stored) {
+                    generator.add_variable_value(var_info, NULL, val);
+                }
+            } else if (TREE_CODE(type) == INTEGER_TYPE) {
+                // Otherwise, we add the hints, we extracted from this
                 // function body, or [0,1] as a default
+                value_sources[var_info] = hints.empty() ? "default" : "hints";
                 if (!hints.empty()) {
                     for (auto val : hints) {
                         generator.add_variable_value(var_info, NULL, val);
@@ -654,9 +1370,15 @@ static unsigned int mv_variant_generation_execute()
                     generator.add_variable_value(var_info, NULL, 0);
                     generator.add_variable_value(var_info, NULL, 1);
                 }
-            } else if(TREE_CODE(TREE_TYPE(variable)) == BOOLEAN_TYPE) {
+            } else if(TREE_CODE(type) == BOOLEAN_TYPE) {
+                    value_sources[var_info] = "default";
                     generator.add_variable_value(var_info, NULL, 0);
                     generator.add_variable_value(var_info, NULL, 1);
+            } else if (POINTER_TYPE_P(type)) {
+                // For pointers: NULL (0) and non-NULL (1)
+                value_sources[var_info] = "pointer";
+                generator.add_variable_value(var_info, "null", 0);
+                generator.add_variable_value(var_info, "nonnull", 1);
             }
         }
     }
@@ -676,6 +1398,35 @@ static unsigned int mv_variant_generation_execute()
     debug_printf("Generated %d specialized functions for %s\n",
                  num_clones, fname.c_str());
 
+    if (mv_report.enabled) {
+        auto &report = mv_report.function(fn_data.name());
+        for (auto &dim : generator.dimensions()) {
+            multiverse_report::dimension_t dimension;
+            dimension.name = dim.first->name();
+            dimension.source = value_sources[dim.first];
+            dimension.tracked = dim.first->tracked;
+            dimension.mask = 0;
+            for (auto &assign : dim.second) {
+                if (!assign.variable)
+                    continue;
+                if (dim.first->bits) {
+                    dimension.mask = assign.lower_limit;
+                    dimension.values.push_back({assign.upper_limit, assign.label});
+                } else {
+                    dimension.values.push_back({assign.lower_limit, assign.label});
+                }
+            }
+            report.dimensions.push_back(dimension);
+        }
+        report.generation_us += elapsed_us(start);
+    }
+
+    // The variants are cloned already, only the generic body is counted
+    if (mv_hotness_counters && num_clones > 0) {
+        instrument_hotness(fn_data);
+        return TODO_update_ssa;
+    }
+
     return 0;
 }
 
@@ -690,56 +1441,221 @@ typedef std::vector<
 
 
 /*
- * For two assignment maps, we test if they differ only in one variable
- * assignment. If they differ, we furthermore test whether their intervals are
- * next to each other. In this case, we merge b into a, and say: yes, we merged
- * something here.
+ * A selector (assignment map) as a box: one interval per dimension.  The
+ * boxes of one merge group constrain the same variables, in the order
+ * given by the group. A "bits" variable spans one dimension per bit,
+ * which is [0,0], [1,1], or [0,1] if the bit is not in the mask.
  */
-static bool
-merge_if_possible(std::vector<var_assign_t> &a,
-                  std::vector<var_assign_t> &b)
+typedef std::vector<std::pair<unsigned, unsigned>> selector_box;
+
+// Upper bounds for the exact minimization of one merge group
+#define MAX_SELECTOR_BOXES 4096
+#define MAX_COVER_STEPS 100000
+
+
+static bool box_contains(const selector_box &outer, const selector_box &inner)
 {
-    if (a.size() != b.size()) return false;
-    // FIXME: Some sort of variable sorting here to normalize the assignment maps
+    for (unsigned d = 0; d < outer.size(); d++) {
+        if (inner[d].first < outer[d].first || inner[d].second > outer[d].second)
+            return false;
+    }
+    return true;
+}
+
 
+/*
+ * Two boxes that are equal in all but one dimension, and whose intervals
+ * in that dimension are next to each other, combine into one box. Only
+ * neighboring values are joined, as the variants are not specialized for
+ * values between the generated ones.
+ */
+static bool box_combine(const selector_box &a, const selector_box &b,
+                        selector_box &out)
+{
     unsigned differences = 0, idx = 0;
-    bool compatible = false;
-    unsigned lower, upper;
-    for (unsigned i = 0; i < a.size() ; i++) {
-        // If two assignments have not exactly the same variable
-        // order, we cannot compare them.
-        if (a[i].variable != b[i].variable)
+    for (unsigned d = 0; d < a.size(); d++) {
+        if (a[d] != b[d]) {
+            differences++;
+            idx = d;
+        }
+    }
+    if (differences != 1)
+        return false;
+    const std::pair<unsigned, unsigned> &lo = std::min(a[idx], b[idx]);
+    const std::pair<unsigned, unsigned> &hi = std::max(a[idx], b[idx]);
+    if (lo.second == UINT_MAX || lo.second + 1 != hi.first)
+        return false;
+    out = a;
+    out[idx] = {lo.first, hi.second};
+    return true;
+}
+
+
+static void box_cells(const selector_box &box, selector_box &cell, unsigned d,
+                      std::set<selector_box> &cells)
+{
+    if (d == box.size()) {
+        cells.insert(cell);
+        return;
+    }
+    for (unsigned v = box[d].first; ; v++) {
+        cell[d] = {v, v};
+        box_cells(box, cell, d + 1, cells);
+        if (v == box[d].second)
+            break;
+    }
+}
+
+
+/*
+ * Branch and bound over the prime boxes: branch on the uncovered cell with
+ * the fewest covering primes, and cut when the cover cannot get smaller
+ * than the best one found so far.
+ */
+static void min_cover_search(const std::vector<std::vector<unsigned>> &prime_cells,
+                             const std::vector<std::vector<unsigned>> &cell_primes,
+                             std::vector<unsigned> &covered,
+                             std::vector<unsigned> &chosen,
+                             std::vector<unsigned> &best,
+                             unsigned &steps)
+{
+    if (steps == 0)
+        return;
+    steps--;
+
+    int cell = -1;
+    for (unsigned c = 0; c < covered.size(); c++) {
+        if (!covered[c] && (cell == -1
+                            || cell_primes[c].size() < cell_primes[cell].size()))
+            cell = c;
+    }
+    if (cell == -1) {
+        if (chosen.size() < best.size())
+            best = chosen;
+        return;
+    }
+    if (chosen.size() + 1 >= best.size())
+        return;
+
+    for (unsigned p : cell_primes[cell]) {
+        chosen.push_back(p);
+        for (unsigned c : prime_cells[p])
+            covered[c]++;
+        min_cover_search(prime_cells, cell_primes, covered, chosen, best, steps);
+        for (unsigned c : prime_cells[p])
+            covered[c]--;
+        chosen.pop_back();
+    }
+}
+
+
+/*
+ * Computes a minimal set of boxes that covers exactly the cells of the
+ * given boxes (Quine-McCluskey over intervals): all boxes whose cells are
+ * in the set are built by combining neighbors, the maximal ones are the
+ * primes, and a minimal subset of the primes covers all cells. Returns
+ * false if the group is too large to be minimized.
+ */
+static bool minimize_boxes(const std::vector<selector_box> &boxes,
+                           std::vector<selector_box> &result)
+{
+    std::set<selector_box> cells;
+    for (auto &box : boxes) {
+        selector_box cell(box.size());
+        box_cells(box, cell, 0, cells);
+        if (cells.size() > MAX_SELECTOR_BOXES)
             return false;
-        if (a[i].lower_limit == b[i].lower_limit
-            && a[i].upper_limit == b[i].upper_limit)
-            continue;
-        differences ++;
-        if (a[i].lower_limit == (b[i].upper_limit-1)
-            || b[i].lower_limit == (a[i].upper_limit +1)) {
-            idx = i;
-            lower = std::min(a[i].lower_limit, b[i].lower_limit);
-            upper = std::max(a[i].upper_limit, b[i].upper_limit);
-            compatible = true;
+    }
+
+    // Close the cells under combination
+    std::set<selector_box> all(cells.begin(), cells.end());
+    std::vector<selector_box> worklist(cells.begin(), cells.end());
+    while (!worklist.empty()) {
+        selector_box box = worklist.back();
+        worklist.pop_back();
+        std::vector<selector_box> found;
+        for (auto &other : all) {
+            selector_box combined;
+            if (box_combine(box, other, combined) && !all.count(combined))
+                found.push_back(combined);
+        }
+        for (auto &combined : found) {
+            if (all.insert(combined).second)
+                worklist.push_back(combined);
+        }
+        if (all.size() > MAX_SELECTOR_BOXES)
+            return false;
+    }
+
+    std::vector<selector_box> primes;
+    for (auto &box : all) {
+        bool maximal = true;
+        for (auto &other : all) {
+            if (other != box && box_contains(other, box)) {
+                maximal = false;
+                break;
+            }
+        }
+        if (maximal)
+            primes.push_back(box);
+    }
+
+    std::vector<selector_box> cell_list(cells.begin(), cells.end());
+    std::vector<std::vector<unsigned>> prime_cells(primes.size());
+    std::vector<std::vector<unsigned>> cell_primes(cell_list.size());
+    for (unsigned p = 0; p < primes.size(); p++) {
+        for (unsigned c = 0; c < cell_list.size(); c++) {
+            if (box_contains(primes[p], cell_list[c])) {
+                prime_cells[p].push_back(c);
+                cell_primes[c].push_back(p);
+            }
         }
     }
-    // We are only allowed to touch the a assignment, iff we are sure
-    // merging worked.
-    if (differences == 1 && compatible) {
-        a[idx].lower_limit = lower;
-        a[idx].upper_limit = upper;
-        return true;
+
+    // Greedy cover as the first bound
+    std::vector<unsigned> covered(cell_list.size(), 0), best;
+    unsigned left = cell_list.size();
+    while (left > 0) {
+        unsigned pick = 0, gain = 0;
+        for (unsigned p = 0; p < primes.size(); p++) {
+            unsigned g = 0;
+            for (unsigned c : prime_cells[p])
+                g += !covered[c];
+            if (g > gain) {
+                gain = g;
+                pick = p;
+            }
+        }
+        best.push_back(pick);
+        for (unsigned c : prime_cells[pick]) {
+            if (!covered[c]++)
+                left--;
+        }
     }
-    return false;
+
+    std::fill(covered.begin(), covered.end(), 0);
+    std::vector<unsigned> chosen;
+    unsigned steps = MAX_COVER_STEPS;
+    min_cover_search(prime_cells, cell_primes, covered, chosen, best, steps);
+
+    result.clear();
+    for (unsigned p : best)
+        result.push_back(primes[p]);
+    return true;
 }
 
 
 /*
  * In a mvfn selector equivalence class, all selectors point to the same mvfn
  * function body. Nevertheless, their guarding assignment maps may be different.
- * In some cases, we can reduce the number of descriptors by merging their
- * intervals.
+ * We reduce the number of descriptors by replacing the selectors with a
+ * minimal set of boxes that covers the same assignments.
  *
- * WARNING/TODO: I think this merging is not optimal
+ * Selectors are only merged with selectors that constrain the same
+ * variables (a tracked variable may be unconstrained). Of all selectors
+ * that match, the runtime picks the last; the selectors are therefore
+ * sorted stably by the number of constrained variables, which puts the
+ * more specific selectors behind the ones they overlap.
  */
 static
 int merge_mvfn_selectors(func_t &fn_info,
@@ -749,70 +1665,173 @@ int merge_mvfn_selectors(func_t &fn_info,
                  fn_info.name(),
                  ec.size());
 
-    bool changed = true;
-    while (changed) {
-        changed = false;
-        // We want to merge b into a if possible
-        for (unsigned a = 0; a < ec.size(); a++) {
-            for (unsigned b = a+1; b < ec.size(); b++) {
-                if (dump_file) {
-                    ec[a].first->dump(dump_file);
-                    debug_printf(" <-> ");
-                    ec[b].first->dump(dump_file);
-                    debug_printf("\n");
+    // Normalized order of the variables: as they first appear in fn_info
+    std::vector<variable_t *> dimensions;
+    for (auto &mvfn : fn_info.mv_functions) {
+        for (auto &assign : mvfn.assignments) {
+            if (std::find(dimensions.begin(), dimensions.end(), assign.variable)
+                == dimensions.end())
+                dimensions.push_back(assign.variable);
+        }
+    }
+
+    // Group the selectors by the variables they constrain
+    std::map<std::vector<unsigned>, std::vector<unsigned>> groups;
+    for (unsigned i = 0; i < ec.size(); i++) {
+        std::vector<unsigned> signature;
+        for (auto &assign : ec[i].first->assignments) {
+            signature.push_back(std::find(dimensions.begin(), dimensions.end(),
+                                          assign.variable) - dimensions.begin());
+        }
+        std::sort(signature.begin(), signature.end());
+        groups[signature].push_back(i);
+    }
+
+    std::vector<unsigned> removed;
+    for (auto &group : groups) {
+        const std::vector<unsigned> &signature = group.first;
+        const std::vector<unsigned> &members = group.second;
+        if (members.size() < 2)
+            continue;
+
+        // The box dimensions of the variables: (first, bits), where
+        // bits are the masks of a "bits" variable together, or 0
+        std::vector<std::pair<unsigned, mv_value_t>> columns(signature.size());
+        for (unsigned i : members) {
+            for (auto &assign : ec[i].first->assignments) {
+                unsigned dim = std::find(dimensions.begin(), dimensions.end(),
+                                         assign.variable) - dimensions.begin();
+                unsigned d = std::lower_bound(signature.begin(), signature.end(), dim)
+                    - signature.begin();
+                if (assign.variable->bits)
+                    columns[d].second |= assign.lower_limit;
+            }
+        }
+        unsigned n_columns = 0;
+        for (auto &column : columns) {
+            column.first = n_columns;
+            n_columns += column.second ? popcount_hwi(column.second) : 1;
+        }
+
+        std::vector<selector_box> boxes, result;
+        for (unsigned i : members) {
+            selector_box box(n_columns);
+            for (auto &assign : ec[i].first->assignments) {
+                unsigned dim = std::find(dimensions.begin(), dimensions.end(),
+                                         assign.variable) - dimensions.begin();
+                unsigned d = std::lower_bound(signature.begin(), signature.end(), dim)
+                    - signature.begin();
+                if (!columns[d].second) {
+                    box[columns[d].first] = {assign.lower_limit, assign.upper_limit};
+                    continue;
                 }
-                // Merge B in A
-                bool merged = merge_if_possible(ec[a].first->assignments,
-                                                ec[b].first->assignments);
-                unsigned dst = a, remove = b;
-                if (!merged) {
-                    // Did not work? Merge A into B
-                    merged = merge_if_possible(ec[b].first->assignments,
-                                               ec[a].first->assignments);
-                    remove = a; dst = b;
+                unsigned c = columns[d].first;
+                for (mv_value_t bits = columns[d].second; bits; bits &= bits - 1, c++) {
+                    mv_value_t bit = bits & -bits;
+                    if (!(assign.lower_limit & bit))
+                        box[c] = {0, 1};
+                    else if (assign.upper_limit & bit)
+                        box[c] = {1, 1};
+                    else
+                        box[c] = {0, 0};
                 }
-                if (merged) {
-                    if (dump_file) {
-                        debug_printf(" ->>  Merged: ");
-                        ec[dst].first->dump(dump_file);
-                        debug_printf("\n");
-                    }
-                    changed = true;
-                    // Remove from the global list of mvfn_function descriptors
-                    for (auto it = fn_info.mv_functions.begin();
-                         it != fn_info.mv_functions.end(); it++) {
-                        if (&*it == ec[remove].first) {
-                            fn_info.mv_functions.erase(it);
-                            break;
-                        }
-                    }
-                    // Remove second mvfn descriptor
-                    delete ec[remove].second; // sem_function *
-                    ec.erase(ec.begin() + remove);
+            }
+            boxes.push_back(box);
+        }
+
+        if (!minimize_boxes(boxes, result) || result.size() >= members.size())
+            continue;
+
+        // The first selectors of the group take the boxes, the others go
+        for (unsigned r = 0; r < members.size(); r++) {
+            mvfn_t *mvfn = ec[members[r]].first;
+            if (r >= result.size()) {
+                removed.push_back(members[r]);
+                continue;
+            }
+            for (auto &assign : mvfn->assignments) {
+                unsigned dim = std::find(dimensions.begin(), dimensions.end(),
+                                         assign.variable) - dimensions.begin();
+                unsigned d = std::lower_bound(signature.begin(), signature.end(), dim)
+                    - signature.begin();
+                if (!columns[d].second) {
+                    assign.lower_limit = result[r][columns[d].first].first;
+                    assign.upper_limit = result[r][columns[d].first].second;
+                    continue;
+                }
+                unsigned c = columns[d].first;
+                assign.lower_limit = assign.upper_limit = 0;
+                for (mv_value_t bits = columns[d].second; bits; bits &= bits - 1, c++) {
+                    mv_value_t bit = bits & -bits;
+                    if (result[r][c].first != result[r][c].second)
+                        continue;
+                    assign.lower_limit |= bit;
+                    if (result[r][c].first)
+                        assign.upper_limit |= bit;
                 }
             }
+            if (dump_file) {
+                debug_printf(" ->>  Merged: ");
+                mvfn->dump(dump_file);
+                debug_printf("\n");
+            }
+        }
+    }
+
+    if (removed.empty())
+        return 0;
+
+    // Remove from the global list of mvfn_function descriptors, and from
+    // the equivalence class (back to front, to keep the indices valid)
+    std::sort(removed.rbegin(), removed.rend());
+    for (unsigned remove : removed) {
+        for (auto it = fn_info.mv_functions.begin();
+             it != fn_info.mv_functions.end(); it++) {
+            if (&*it == ec[remove].first) {
+                fn_info.mv_functions.erase(it);
+                break;
+            }
         }
+        delete ec[remove].second; // sem_function *
+        ec.erase(ec.begin() + remove);
     }
+
+    fn_info.mv_functions.sort([](const mvfn_t &a, const mvfn_t &b) {
+            return a.assignments.size() < b.assignments.size();
+        });
     return 0;
 }
 
 
 /*
- * TODO: some nice description
+ * Find the variants of every multiverse function that are equal after
+ * the generation pass optimized them, let their selectors share one body,
+ * and make the other bodies removable. Equal functions have equal ICF
+ * hashes, so the variants are bucketed by hash and only compared with
+ * the equivalence classes in their bucket.
  */
 static unsigned int mv_variant_elimination_execute()
 {
     using namespace ipa_icf;
 
+    // With -flto, this happened before the unit was streamed
+    if (mv_ctx.descriptors_emitted)
+        return 0;
+
     bitmap_obstack bmstack;
     bitmap_obstack_initialize(&bmstack);
 
     for (auto &fn_info : mv_ctx.functions) {
+        mv_clock::time_point start = mv_clock::now();
         debug_printf("\nmerge function bodies for: %s\n",
                      fn_info.name());
 
         std::list<equivalence_class> classes;
+        std::unordered_map<hashval_t, std::vector<equivalence_class *>> buckets;
         hash_map <symtab_node *, sem_item *> ignored_nodes;
+
+        // Build the semantic functions of all variants in one sweep
+        std::vector<std::pair<mvfn_t *, sem_function *>> items;
         for (auto &mvfn_info : fn_info.mv_functions) {
             cgraph_node *node = get_fn_cnode(mvfn_info.decl());
 #if BUILDING_GCC_MAJOR > 6 || (BUILDING_GCC_MAJOR == 6 && BUILDING_GCC_MINOR >= 3 )
@@ -827,26 +1846,43 @@ static unsigned int mv_variant_elimination_execute()
             func->init();
 #endif
 
-            debug_printf("%s ", mvfn_info.name());
+            multiverse_report::clone_t *clone;
+            if (mv_report.enabled && (clone = mv_report.clone(fn_info.name(), mvfn_info.name()))
+                && gimple_has_body_p(node->decl)) {
+                clone->size_optimized = estimate_num_insns_fn(node->decl,
+                                                              &eni_size_weights);
+            }
+            items.push_back({&mvfn_info, func});
+        }
 
+        for (auto &item : items) {
+            auto &bucket = buckets[item.second->get_hash()];
             bool found = false;
-            for (auto &ec : classes) {
-                bool eq = ec.front().second->equals(func, ignored_nodes);
+            for (equivalence_class *ec : bucket) {
+                bool eq = ec->front().second->equals(item.second, ignored_nodes);
                 if (eq) {
-                    debug_printf(" EQ; add to existing equivalence class\n");
-                    ec.push_back({&mvfn_info, func});
+                    debug_printf("%s EQ; add to existing equivalence class\n",
+                                 item.first->name());
+                    ec->push_back(item);
                     found = true;
                     break;
                 }
             }
             // None found? Start a new one!
             if (!found) {
-                debug_printf("NEQ; new equivalence class\n");
-                classes.push_back({{&mvfn_info,func}});
+                debug_printf("%s NEQ; new equivalence class\n", item.first->name());
+                classes.push_back({item});
+                bucket.push_back(&classes.back());
             }
         }
         for (auto &ec : classes) {
             debug_printf("found function equivalence class of size %ld\n", ec.size());
+            if (mv_report.enabled) {
+                std::vector<std::string> members;
+                for (auto &item : ec)
+                    members.push_back(item.first->name());
+                mv_report.function(fn_info.name()).equivalence_classes.push_back(members);
+            }
             /* If multiple multiverse functions are equivalent. Let
                them all point to the same function body. */
             if (ec.size() > 1) {
@@ -876,6 +1912,8 @@ static unsigned int mv_variant_elimination_execute()
                 delete item.second;
             }
         }
+        if (mv_report.enabled && !fn_info.mv_functions.empty())
+            mv_report.function(fn_info.name()).elimination_us += elapsed_us(start);
     }
 
     bitmap_obstack_release(&bmstack);
@@ -923,6 +1961,42 @@ static bool mv_variant_elimination_gate() {
 #define NO_VARIABLE_TRANSFORM
 #include "gcc-generate-ipa-pass.h"
 
+
+/*
+ * With -flto, the IPA passes execute at link time, where the multiverse
+ * context of the unit is gone, and PLUGIN_FINISH_UNIT is only reached after
+ * the unit was streamed. While the IPA summaries are generated, right
+ * before the unit is streamed (and after IPA-ICF set up its optimizer), we
+ * therefore eliminate the duplicated variants and build the variable and
+ * function descriptors: as data with references to the variables and
+ * variants, they carry the context through LTO. The callsites are labeled
+ * in the LTRANS units, after cross-module inlining.
+ */
+static bool mv_lto_descriptors_gate()
+{
+    return flag_generate_lto && !in_lto_p;
+}
+
+static void mv_lto_descriptors_generate_summary()
+{
+    if (mv_variant_elimination_gate())
+        mv_variant_elimination_execute();
+    mv_info_build_descriptors(&mv_ctx);
+    if (mv_report.enabled)
+        mv_report.write(&mv_ctx);
+}
+
+#define PASS_NAME mv_lto_descriptors
+#define NO_READ_SUMMARY
+#define NO_WRITE_SUMMARY
+#define NO_READ_OPTIMIZATION_SUMMARY
+#define NO_WRITE_OPTIMIZATION_SUMMARY
+#define NO_STMT_FIXUP
+#define NO_FUNCTION_TRANSFORM
+#define NO_VARIABLE_TRANSFORM
+#define NO_EXECUTE
+#include "gcc-generate-ipa-pass.h"
+
 /*
  * Pass to find call instructions in the RTL that reference a multiverse
  * function. For such callsites, we insert a label and record it for the
@@ -971,6 +2045,13 @@ static unsigned int mv_callsites_execute()
                 callsite.fn_decl = decl;
                 callsite.callsite_label = tree_label;
                 mv_ctx.callsites.push_back(callsite);
+
+                if (mv_report.enabled) {
+                    auto &callers = mv_report.function(
+                        IDENTIFIER_POINTER(DECL_ASSEMBLER_NAME(decl))).callers;
+                    if (std::find(callers.begin(), callers.end(), fname) == callers.end())
+                        callers.push_back(fname);
+                }
             }
         }
     }
@@ -992,6 +2073,7 @@ int plugin_init(struct plugin_name_args *info, struct plugin_gcc_version *versio
     const char * plugin_name = info->base_name;
     struct register_pass_info mv_variant_generation_info;
     struct register_pass_info mv_variant_elimination_info;
+    struct register_pass_info mv_lto_descriptors_info;
     struct register_pass_info mv_callsites_info;
 
     if (!plugin_default_version_check(version, &gcc_version)) {
@@ -999,6 +2081,20 @@ int plugin_init(struct plugin_name_args *info, struct plugin_gcc_version *versio
         return 1;
     }
 
+    for (int i = 0; i < info->argc; i++) {
+        std::string key = info->argv[i].key;
+        if (key == "hotness") {
+            mv_hotness_counters = true;
+        } else if (key == "report") {
+            mv_report.enabled = true;
+            if (info->argv[i].value)
+                mv_report.path = info->argv[i].value;
+        } else {
+            error(G_("unknown multiverse plugin argument %qs"), key.c_str());
+            return 1;
+        }
+    }
+
     // Initialize types and the multiverse info structures.
     register_callback(plugin_name, PLUGIN_START_UNIT, mv_info_init, &mv_ctx);
 
@@ -1022,6 +2118,13 @@ int plugin_init(struct plugin_name_args *info, struct plugin_gcc_version *versio
     mv_variant_elimination_info.pos_op = PASS_POS_INSERT_BEFORE;
     register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &mv_variant_elimination_info);
 
+    // Register pass: with -flto, build the descriptors before streaming
+    mv_lto_descriptors_info.pass = make_mv_lto_descriptors_pass();
+    mv_lto_descriptors_info.reference_pass_name = "icf";
+    mv_lto_descriptors_info.ref_pass_instance_number = 0;
+    mv_lto_descriptors_info.pos_op = PASS_POS_INSERT_AFTER;
+    register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &mv_lto_descriptors_info);
+
     // Register the multiverse RTL pass which adds labels to callsites
     mv_callsites_info.pass = make_mv_callsites_pass();
     mv_callsites_info.reference_pass_name = "final";
@@ -1032,5 +2135,9 @@ int plugin_init(struct plugin_name_args *info, struct plugin_gcc_version *versio
     // Finish off the generation of multiverse info
     register_callback(plugin_name, PLUGIN_FINISH_UNIT, mv_info_finish, &mv_ctx);
 
+    // Write the build report, after the descriptors are final
+    if (mv_report.enabled)
+        register_callback(plugin_name, PLUGIN_FINISH_UNIT, mv_report_finish, &mv_ctx);
+
     return 0;
 }
@@ -6,6 +6,7 @@
 #include <vector>
 #include <list>
 #include <set>
+#include <unordered_map>
 
 #include "gcc-common.h"
 
@@ -21,7 +22,8 @@ struct multiverse_context {
        GCC tree object. Due to optimizations and different phases in
        the compiler, tree references can become invalid. Therefore, we
        reference into the internal GCC structures by saving the
-       assembler name.
+       assembler name. Identifiers are unique in GCC, so two references
+       name the same declaration iff their identifier nodes are equal.
     */
     struct decl_ref_t {
     private:
@@ -33,13 +35,22 @@ struct multiverse_context {
             : asm_name(DECL_ASSEMBLER_NAME(decl)),
               is_definition(!DECL_EXTERNAL(decl)) {}
 
+        // Not for elements of a decl_ref_container, which are indexed
+        // by their identifier
         void relink_to(decl_ref_t *other) {
             this->asm_name = other->asm_name;
         }
 
         bool is_ref_to(tree decl) {
-            return !strcmp(this->name(),
-                           IDENTIFIER_POINTER(DECL_ASSEMBLER_NAME(decl)));
+            return this->asm_name == DECL_ASSEMBLER_NAME(decl);
+        }
+
+        static const_tree key(tree decl) {
+            return DECL_ASSEMBLER_NAME(decl);
+        }
+
+        const_tree identifier() const {
+            return asm_name;
         }
 
         tree decl() {
@@ -54,15 +65,46 @@ struct multiverse_context {
         }
     };
 
-    struct variable_t : public decl_ref_t {
-        variable_t(tree decl) : decl_ref_t(decl), tracked(false) {}
+    // The arguments of the multiverse attribute of a variable or member
+    struct variable_args_t {
+        variable_args_t() : tracked(false), bits(0) {}
 
         std::set<mv_value_t> values; // Comes from the attribute
         bool tracked;
+        mv_value_t bits;             // Mask of ("bits", MASK), 0 if none
+    };
+
+    /* A multiverse variable is a global variable (a VAR_DECL), or a
+       multiverse member of a global struct variable (a COMPONENT_REF
+       chain, cfg.verbose). A member references the struct variable, and
+       is named and indexed by its own identifier. */
+    struct variable_t : public decl_ref_t, public variable_args_t {
+        variable_t(tree decl);
 
+        std::set<mv_value_t> stored; // Constants stored in the unit
+        bool stored_open;            // Other values may be stored
 
+        std::vector<tree> fields;    // Path of FIELD_DECLs to a member
+        const_tree member_name;      // Identifier of a member, or NULL
+
+        // The identifier of a variable or member reference
+        static const_tree key(tree decl);
+
+        const_tree identifier() const {
+            return member_name ? member_name : decl_ref_t::identifier();
+        }
+
+        const char *name() {
+            return IDENTIFIER_POINTER(identifier());
+        }
+
+        tree type();                 // Of the variable or member
+        tree ref();                  // A reference to the variable or member
     };
 
+    // For "bits" variables, lower_limit is the mask of the specialized
+    // bits and upper_limit their pattern. Undefined assignments of tracked
+    // variables have no variable.
     struct var_assign_t {
         variable_t * variable;
         const char * label;
@@ -70,8 +112,12 @@ struct multiverse_context {
         unsigned upper_limit;
 
         void dump(FILE *out) {
-            fprintf(out, "%s=[%d,%d],",
-                    variable->name(), lower_limit, upper_limit);
+            if (variable->bits)
+                fprintf(out, "%s&%#x=%#x,",
+                        variable->name(), lower_limit, upper_limit);
+            else
+                fprintf(out, "%s=[%d,%d],",
+                        variable->name(), lower_limit, upper_limit);
         }
     };
     typedef std::vector<var_assign_t> var_assign_vector_t;
@@ -91,10 +137,12 @@ struct multiverse_context {
     };
 
     struct func_t : public decl_ref_t {
-        func_t(tree decl) : decl_ref_t(decl), function_pointer(false) {}
+        func_t(tree decl) : decl_ref_t(decl), function_pointer(false),
+                            hit_counter(NULL_TREE) {}
 
         bool function_pointer;
         std::list<mvfn_t> mv_functions;
+        tree hit_counter;   // Entry counter of the generic body (hotness)
     };
 
     struct callsite_t {
@@ -104,6 +152,14 @@ struct multiverse_context {
 
 
 
+    /* \brief list of declaration references with a lookup by name
+
+       The elements keep the order in which they were added (it
+       determines the order of the descriptors). Beside the list, an
+       index maps the assembler-name identifiers to the elements, since
+       the passes look up declarations for every operand and call;
+       elements must therefore only be added with add().
+    */
     template<class T>
     struct decl_ref_container : public std::list<T> {
         T& add(tree decl) {
@@ -111,19 +167,22 @@ struct multiverse_context {
             if (x == nullptr) {
                 this->emplace_back(decl);
                 x = &this->back();
+                index[x->identifier()] = x;
             }
-            x->is_definition = x->is_definition || !DECL_EXTERNAL(decl);
+            x->is_definition = x->is_definition
+                || !DECL_EXTERNAL(get_base_address(decl));
             return *x;
         }
 
         T* get(tree decl) {
-            for (auto & x : *this) {
-                if (x.is_ref_to(decl)) {
-                    return &x;
-                }
-            }
-            return nullptr;
+            auto it = index.find(T::key(decl));
+            if (it == index.end())
+                return nullptr;
+            return it->second;
         }
+
+    private:
+        std::unordered_map<const_tree, T*> index;
     };
 
 
@@ -131,6 +190,9 @@ struct multiverse_context {
     std::list<callsite_t> callsites;
     decl_ref_container<func_t> functions;
     decl_ref_container<variable_t> variables;
+
+    // The variable and function descriptors are built (early with -flto)
+    bool descriptors_emitted;
 };
 
 
@@ -181,14 +243,78 @@ private:
 public:
     void add_variable(variable_t *);
     void add_variable_value(variable_t *, const char *label, mv_value_t value);
+    void add_variable_bits(variable_t *, mv_value_t mask, mv_value_t pattern);
 
     void start(int maximal_elements = -1);
     bool end_p();
     var_assign_vector_t next();
+
+    const std::vector<std::pair<variable_t*, var_assign_vector_t> > &dimensions() {
+        return variables;
+    }
+};
+
+/*
+ * The build report (-fplugin-arg-multiverse-report[=<file>]) records what the
+ * passes did with every multiverse function. It is written as JSON at the end
+ * of the translation unit.
+ */
+struct multiverse_report {
+    typedef multiverse_context::var_assign_vector_t var_assign_vector_t;
+
+    struct value_t {
+        mv_value_t value;
+        const char *label;
+    };
+
+    struct dimension_t {
+        std::string name;
+        const char *source;          // "attribute", "bits", "enum", "pointer", "stores", "hints", "default"
+        bool tracked;
+        mv_value_t mask;             // Tested bits of "bits" variables
+        std::vector<value_t> values;
+    };
+
+    struct clone_t {
+        std::string name;
+        var_assign_vector_t assignments;
+        int size_generated;          // estimate_num_insns when it was cloned
+        int size_optimized;          // ... before IPA-ICF, -1 if not measured
+    };
+
+    struct function_t {
+        std::string name;
+        long generation_us;
+        long elimination_us;
+        std::vector<dimension_t> dimensions;
+        std::vector<clone_t> clones;
+        std::vector<std::vector<std::string>> equivalence_classes;
+        std::vector<std::string> callers;
+    };
+
+    bool enabled;
+    std::string path;                // Empty: <main input file>.multiverse.json
+    std::list<function_t> functions;
+
+    function_t &function(const char *name);
+    clone_t *clone(const char *function, const char *name);
+    void write(multiverse_context *ctx);
+
+private:
+    std::unordered_map<std::string, function_t*> index;   // by name
 };
 
+extern multiverse_report mv_report;
+
 // In mv-info.cc
 void mv_info_init(void *event_data, void *data);
 void mv_info_finish(void *event_data, void *data);
+void mv_info_build_descriptors(multiverse_context *ctx);
+
+/* Adds the multiverse members of the global struct variables as variables */
+void mv_add_member_variables(multiverse_context *ctx);
+
+// In multiverse-report.cc
+void mv_report_finish(void *event_data, void *data);
 
 #endif
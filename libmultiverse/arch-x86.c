@@ -91,59 +91,94 @@ void multiverse_arch_decode_mvfn_body(struct mv_info_mvfn *info) {
     }
 }
 
-static void insert_offset_argument(unsigned char * callsite, void * callee) {
+static void insert_offset_argument(unsigned char * bytes, unsigned char * callsite,
+                                   void * callee) {
     uint32_t offset = (uintptr_t)callee - ((uintptr_t) callsite + 5);
-    *((uint32_t *)&callsite[1]) = offset;
+    *((uint32_t *)&bytes[1]) = offset;
 }
 
-void multiverse_arch_patchpoint_apply(struct mv_info_fn *fn,
-                                      struct mv_info_mvfn *mvfn,
-                                      struct mv_patchpoint *pp) {
+int multiverse_arch_patchpoint_bytes(struct mv_info_mvfn *mvfn,
+                                     struct mv_patchpoint *pp,
+                                     unsigned char *bytes) {
     unsigned char *location = pp->location;
-    // Select from original -> Swap out the current code
-    if (fn->active_mvfn == NULL) {
-        memcpy(&pp->swapspace[0], location, location_len(pp->type));
-    }
 
-    // patch the code segment according to the patchpoint definition
+    // Compute the code according to the patchpoint definition
     if (pp->type == PP_TYPE_X86_CALL || pp->type == PP_TYPE_X86_CALL_INDIRECT) {
         // Oh, look. It has a very simple body!
         if (mvfn->type == MVFN_TYPE_NOP) {
             if (pp->type == PP_TYPE_X86_CALL_INDIRECT) {
-                memcpy(location, "\x66\x0F\x1F\x44\x00\x00", 6); // 6 byte NOP
+                memcpy(bytes, "\x66\x0F\x1F\x44\x00\x00", 6); // 6 byte NOP
             } else {
-                memcpy(location, "\x0F\x1F\x44\x00\x00", 5);     // 5 byte NOP
+                memcpy(bytes, "\x0F\x1F\x44\x00\x00", 5);     // 5 byte NOP
             }
         } else if (mvfn->type == MVFN_TYPE_CONSTANT) {
-            location[0] = 0xb8; // mov $..., eax
-            *(uint32_t *)(location + 1) = mvfn->constant;
+            bytes[0] = 0xb8; // mov $..., eax
+            *(uint32_t *)(bytes + 1) = mvfn->constant;
             if (pp->type == PP_TYPE_X86_CALL_INDIRECT)
-                location[5] = '\x90'; // insert trailing NOP
+                bytes[5] = '\x90'; // insert trailing NOP
         } else if (mvfn->type == MVFN_TYPE_CLI ||
                    mvfn->type == MVFN_TYPE_STI) {
             if (mvfn->type == MVFN_TYPE_CLI) {
-                location[0] = '\xfa'; // CLI
+                bytes[0] = '\xfa'; // CLI
             } else {
-                location[0] = '\xfb'; // STI
+                bytes[0] = '\xfb'; // STI
             }
             if (pp->type == PP_TYPE_X86_CALL_INDIRECT) {
-                memcpy(&location[1], "\x0F\x1F\x44\x00\x00", 5); // 5 byte NOP
+                memcpy(&bytes[1], "\x0F\x1F\x44\x00\x00", 5); // 5 byte NOP
             } else {
-                memcpy(&location[1], "\x0F\x1F\x40\x00", 4);     // 4 byte NOP
+                memcpy(&bytes[1], "\x0F\x1F\x40\x00", 4);     // 4 byte NOP
             }
         } else {
-            location[0] = 0xe8;
-            insert_offset_argument(location, mvfn->function_body);
+            bytes[0] = 0xe8;
+            insert_offset_argument(bytes, location, multiverse_mvfn_body(mvfn));
             if (pp->type == PP_TYPE_X86_CALL_INDIRECT)
-                location[5] = '\x90'; // insert trailing NOP
+                bytes[5] = '\x90'; // insert trailing NOP
         }
     } else if (pp->type == PP_TYPE_X86_JUMP) {
-        location[0] = 0xe9;
-        insert_offset_argument(location, mvfn->function_body);
+        bytes[0] = 0xe9;
+        insert_offset_argument(bytes, location, multiverse_mvfn_body(mvfn));
+    }
+
+    return location_len(pp->type);
+}
+
+int multiverse_arch_patchpoint_atomic(struct mv_info_mvfn *mvfn,
+                                     struct mv_patchpoint *pp) {
+    unsigned char *location = pp->location;
+    unsigned char bytes[MV_PATCHPOINT_SIZE];
+
+    // A direct call that stays a direct call, with an aligned offset
+    if (pp->type != PP_TYPE_X86_CALL || ((uintptr_t)(location + 1) & 3) != 0)
+        return 0;
+    multiverse_arch_patchpoint_bytes(mvfn, pp, bytes);
+    return bytes[0] == location[0];
+}
+
+void multiverse_arch_patchpoint_apply(struct mv_info_fn *fn,
+                                      struct mv_info_mvfn *mvfn,
+                                      struct mv_patchpoint *pp) {
+    unsigned char *location = pp->location;
+    unsigned char bytes[MV_PATCHPOINT_SIZE];
+    int size = location_len(pp->type);
+    (void) fn;
+
+    // Select from original -> Swap out the current code
+    if (pp->applied == NULL) {
+        memcpy(&pp->swapspace[0], location, size);
+    }
+
+    size = multiverse_arch_patchpoint_bytes(mvfn, pp, bytes);
+    if (multiverse_arch_patchpoint_atomic(mvfn, pp)) {
+        // Only the call target changes. Threads that execute the
+        // callsite see either the old or the new offset.
+        __atomic_store_n((uint32_t *)(location + 1), *(uint32_t *)(bytes + 1),
+                         __ATOMIC_RELAXED);
+    } else {
+        memcpy(location, bytes, size);
     }
 
     // In all cases: Clear the cache afterwards.
-    multiverse_os_clear_cache(location, location_len(pp->type));
+    multiverse_os_clear_cache(location, size);
 }
 
 void multiverse_arch_patchpoint_revert(struct mv_patchpoint *pp) {
@@ -160,3 +195,296 @@ void multiverse_arch_patchpoint_size(struct mv_patchpoint *pp,
     *from = pp->location;
     *to = pp->location + location_len(pp->type);
 }
+
+
+/*
+ * A small instruction length decoder for relocating function bodies.
+ * It knows the instructions that GCC emits for ordinary 64-bit C code.
+ * For everything else (VEX prefixes, far jumps, absolute moffs, I/O),
+ * it gives up and the body is not relocated.
+ */
+struct x86_insn {
+    unsigned char length;
+    unsigned char rel_size;     // Size of a relative branch target (0, 1, 4)
+    unsigned char rel_offset;   // Offset of the branch target or RIP-relative disp32
+    unsigned char rip_relative; // 1, if the operand at rel_offset is a RIP-relative disp32
+};
+
+static int x86_decode(unsigned char *code, struct x86_insn *insn) {
+    unsigned char *p = code;
+    int opsize16 = 0, rex_w = 0, modrm = 0, imm = 0;
+    unsigned char op;
+
+    memset(insn, 0, sizeof(*insn));
+
+    // Legacy prefixes
+    while (*p == 0x66 || *p == 0x67 || *p == 0xf0 || *p == 0xf2 || *p == 0xf3
+           || *p == 0x2e || *p == 0x3e || *p == 0x26 || *p == 0x36
+           || *p == 0x64 || *p == 0x65) {
+        if (*p == 0x66) opsize16 = 1;
+        if (++p - code > 14) return -1;
+    }
+    // REX prefix
+    if ((*p & 0xf0) == 0x40) {
+        rex_w = (*p & 0x08) != 0;
+        p++;
+    }
+
+    op = *p++;
+    if (op == 0x0f) {
+        op = *p++;
+        if (op == 0x38) {
+            p++; modrm = 1;
+        } else if (op == 0x3a) {
+            p++; modrm = 1; imm = 1;
+        } else if (op >= 0x80 && op <= 0x8f) {
+            insn->rel_size = 4;                             // jcc rel32
+        } else if (op == 0x05 || op == 0x0b || op == 0x31 || op == 0xa2
+                   || (op >= 0xc8 && op <= 0xcf)) {
+            // syscall, ud2, rdtsc, cpuid, bswap
+        } else if ((op >= 0x70 && op <= 0x73) || op == 0xa4 || op == 0xac
+                   || op == 0xba || op == 0xc2 || (op >= 0xc4 && op <= 0xc6)) {
+            modrm = 1; imm = 1;
+        } else if (op <= 0x03 || op == 0x0d || (op >= 0x10 && op <= 0x1f)
+                   || (op >= 0x28 && op <= 0x2f) || (op >= 0x40 && op <= 0x6f)
+                   || (op >= 0x74 && op <= 0x7f) || (op >= 0x90 && op <= 0x9f)
+                   || op == 0xa3 || op == 0xa5 || (op >= 0xab && op <= 0xaf)
+                   || (op >= 0xb0 && op <= 0xbf) || op == 0xc0 || op == 0xc1
+                   || op == 0xc7 || op >= 0xd0) {
+            modrm = 1;
+        } else {
+            return -1;
+        }
+    } else if (op < 0x40) {
+        switch (op & 0x7) {
+        case 0: case 1: case 2: case 3: modrm = 1; break;
+        case 4: imm = 1; break;
+        case 5: imm = opsize16 ? 2 : 4; break;
+        default: return -1; // Invalid in 64-bit mode
+        }
+    } else if (op >= 0x50 && op <= 0x5f) {
+        // push, pop
+    } else if (op == 0x63 || (op >= 0x84 && op <= 0x8f) || (op >= 0xd0 && op <= 0xd3)
+               || (op >= 0xd8 && op <= 0xdf) || op == 0xfe || op == 0xff) {
+        modrm = 1;
+    } else if (op == 0x68) {
+        imm = opsize16 ? 2 : 4;
+    } else if (op == 0x69 || op == 0x81 || op == 0xc7) {
+        modrm = 1; imm = opsize16 ? 2 : 4;
+    } else if (op == 0x6b || op == 0x80 || op == 0x83 || op == 0xc0 || op == 0xc1
+               || op == 0xc6) {
+        modrm = 1; imm = 1;
+    } else if (op == 0x6a || op == 0xa8 || op == 0xcd || (op >= 0xb0 && op <= 0xb7)) {
+        imm = 1;
+    } else if (op == 0xa9) {
+        imm = opsize16 ? 2 : 4;
+    } else if (op >= 0xb8 && op <= 0xbf) {
+        imm = rex_w ? 8 : (opsize16 ? 2 : 4);
+    } else if (op == 0xc2) {
+        imm = 2;
+    } else if (op == 0xc8) {
+        imm = 3;
+    } else if ((op >= 0x70 && op <= 0x7f) || (op >= 0xe0 && op <= 0xe3) || op == 0xeb) {
+        insn->rel_size = 1;
+    } else if (op == 0xe8 || op == 0xe9) {
+        insn->rel_size = 4;
+    } else if ((op >= 0x90 && op <= 0x99) || (op >= 0x9b && op <= 0x9f)
+               || (op >= 0xa4 && op <= 0xa7) || (op >= 0xaa && op <= 0xaf)
+               || (op >= 0x6c && op <= 0x6f) || op == 0xc3 || op == 0xc9 || op == 0xcc
+               || op == 0xf4 || op == 0xf5 || (op >= 0xf8 && op <= 0xfd)) {
+        // No operands
+    } else if (op == 0xf6 || op == 0xf7) {
+        // Only test (/0 and /1) has an immediate
+        modrm = 1;
+        if (((*p >> 3) & 0x7) <= 1)
+            imm = (op == 0xf6) ? 1 : (opsize16 ? 2 : 4);
+    } else {
+        return -1;
+    }
+
+    if (modrm) {
+        unsigned char m = *p++;
+        unsigned mod = m >> 6, rm = m & 0x7;
+        if (mod != 3 && rm == 4) {
+            // SIB byte; base == 5 without displacement means disp32
+            unsigned char sib = *p++;
+            if (mod == 0 && (sib & 0x7) == 5)
+                p += 4;
+        }
+        if (mod == 0 && rm == 5) {
+            insn->rip_relative = 1;
+            insn->rel_offset = p - code;
+            p += 4;
+        } else if (mod == 1) {
+            p += 1;
+        } else if (mod == 2) {
+            p += 4;
+        }
+    }
+    if (insn->rel_size) {
+        insn->rel_offset = p - code;
+        p += insn->rel_size;
+    }
+    p += imm;
+
+    if (p - code > 15) return -1;
+    insn->length = p - code;
+    return 0;
+}
+
+int multiverse_arch_relocate(void *dst, void *src, unsigned int len) {
+    unsigned char *s = src, *d = dst;
+    unsigned int off = 0;
+
+    memcpy(d, s, len);
+    while (off < len) {
+        struct x86_insn insn;
+        if (x86_decode(s + off, &insn) < 0) return -1;
+        if (off + insn.length > len) return -1;
+
+        if (insn.rel_size || insn.rip_relative) {
+            unsigned char *next = s + off + insn.length;
+            unsigned char *target;
+            if (insn.rel_size == 1) {
+                target = next + (signed char) s[off + insn.rel_offset];
+            } else {
+                int32_t disp;
+                memcpy(&disp, s + off + insn.rel_offset, 4);
+                target = next + disp;
+            }
+            // References within the body move along with the body
+            if (target < s || target >= s + len) {
+                long long disp = (intptr_t) target - (intptr_t) (d + off + insn.length);
+                int32_t disp32 = (int32_t) disp;
+                // Short jumps cannot leave the body anymore
+                if (insn.rel_size == 1 || disp != disp32) return -1;
+                memcpy(d + off + insn.rel_offset, &disp32, 4);
+            }
+        }
+        off += insn.length;
+    }
+    return 0;
+}
+
+int multiverse_arch_patchpoint_copy(struct mv_patchpoint *pp,
+                                    struct mv_patchpoint *copy,
+                                    void *location) {
+    long long offset;
+    int len = location_len(pp->type);
+
+    *copy = *pp;
+    copy->next = NULL;
+    copy->location = location;
+
+    // The callee (or the function pointer) is referenced relative to the new
+    // callsite.
+    offset = (intptr_t) pp->function->function_body - ((intptr_t) location + len);
+    if (offset != (int32_t) offset) return -1;
+
+    if (pp->type == PP_TYPE_X86_CALL) {
+        copy->swapspace[0] = 0xe8;
+    } else if (pp->type == PP_TYPE_X86_CALL_INDIRECT) {
+        copy->swapspace[0] = 0xff;
+        copy->swapspace[1] = 0x15;
+    } else {
+        return -1;
+    }
+    *(int32_t *)&copy->swapspace[len - 4] = (int32_t) offset;
+    return 0;
+}
+
+
+#ifndef MULTIVERSE_KERNELSPACE
+/*
+ * The lazy stub of a function loads the function descriptor into %r11
+ * and jumps to the trampoline. The trampoline saves all argument
+ * registers, lets multiverse_lazy_fixup() patch the callsite (identified
+ * by the return address) and continues in the selected variant.
+ *
+ * Arguments that are passed in the upper halves of the AVX registers are
+ * not preserved.
+ */
+void multiverse_arch_lazy_trampoline(void);
+
+__asm__(".text\n"
+        ".globl multiverse_arch_lazy_trampoline\n"
+        ".type multiverse_arch_lazy_trampoline, @function\n"
+        "multiverse_arch_lazy_trampoline:\n"
+        "  endbr64\n"
+        "  push %rbp\n"
+        "  mov %rsp, %rbp\n"
+        "  push %rdi\n"
+        "  push %rsi\n"
+        "  push %rdx\n"
+        "  push %rcx\n"
+        "  push %r8\n"
+        "  push %r9\n"
+        "  push %rax\n"
+        "  push %r10\n"
+        "  sub $128, %rsp\n"
+        "  movdqu %xmm0, 0(%rsp)\n"
+        "  movdqu %xmm1, 16(%rsp)\n"
+        "  movdqu %xmm2, 32(%rsp)\n"
+        "  movdqu %xmm3, 48(%rsp)\n"
+        "  movdqu %xmm4, 64(%rsp)\n"
+        "  movdqu %xmm5, 80(%rsp)\n"
+        "  movdqu %xmm6, 96(%rsp)\n"
+        "  movdqu %xmm7, 112(%rsp)\n"
+        "  mov %r11, %rdi\n"
+        "  mov 8(%rbp), %rsi\n"
+        "  and $-16, %rsp\n"
+        "  call multiverse_lazy_fixup@PLT\n"
+        "  lea -192(%rbp), %rsp\n"
+        "  mov %rax, %r11\n"
+        "  movdqu 0(%rsp), %xmm0\n"
+        "  movdqu 16(%rsp), %xmm1\n"
+        "  movdqu 32(%rsp), %xmm2\n"
+        "  movdqu 48(%rsp), %xmm3\n"
+        "  movdqu 64(%rsp), %xmm4\n"
+        "  movdqu 80(%rsp), %xmm5\n"
+        "  movdqu 96(%rsp), %xmm6\n"
+        "  movdqu 112(%rsp), %xmm7\n"
+        "  add $128, %rsp\n"
+        "  pop %r10\n"
+        "  pop %rax\n"
+        "  pop %r9\n"
+        "  pop %r8\n"
+        "  pop %rcx\n"
+        "  pop %rdx\n"
+        "  pop %rsi\n"
+        "  pop %rdi\n"
+        "  pop %rbp\n"
+        "  jmp *%r11\n"
+        ".size multiverse_arch_lazy_trampoline, .-multiverse_arch_lazy_trampoline\n");
+
+int multiverse_arch_lazy_stub(void *stub, unsigned int size, struct mv_info_fn *fn) {
+    unsigned char *p = stub;
+    void *trampoline = (void *) multiverse_arch_lazy_trampoline;
+    long long offset = (intptr_t) stub - ((intptr_t) fn->function_body + 5);
+
+    // The generic entry has to reach the stub with a relative jump
+    if (size < 24 || offset != (int32_t) offset) return -1;
+
+    p[0] = 0x49; p[1] = 0xbb;                   // movabs $fn, %r11
+    memcpy(&p[2], &fn, 8);
+    memcpy(&p[10], "\xff\x25\x00\x00\x00\x00", 6); // jmp *0(%rip)
+    memcpy(&p[16], &trampoline, 8);
+    return 24;
+}
+#else
+int multiverse_arch_lazy_stub(void *stub, unsigned int size, struct mv_info_fn *fn) {
+    // Not supported in the kernel
+    (void) stub;
+    (void) size;
+    (void) fn;
+    return -1;
+}
+#endif
+
+
+unsigned long long multiverse_arch_timestamp(void) {
+    unsigned int lo, hi;
+    // The lfence keeps earlier instructions from being measured late
+    __asm__ volatile("lfence; rdtsc" : "=a"(lo), "=d"(hi) :: "memory");
+    return ((unsigned long long) hi << 32) | lo;
+}
@@ -42,6 +42,28 @@ void multiverse_arch_decode_callsite(struct mv_info_fn *fn, void *callsite,
 
 void multiverse_arch_decode_mvfn_body(struct mv_info_mvfn *info);
 
+/**
+  @brief computes the code that selects the mvfn at the patchpoint
+
+  Writes the bytes that multiverse_arch_patchpoint_apply() would
+  install at the patchpoint to bytes (at most MV_PATCHPOINT_SIZE) and
+  returns their number. The text segment is not touched.
+*/
+int multiverse_arch_patchpoint_bytes(struct mv_info_mvfn *mvfn,
+                                     struct mv_patchpoint *pp,
+                                     unsigned char *bytes);
+
+/**
+  @brief Can the mvfn be applied to the patchpoint with a single atomic store?
+
+  Returns 1, if multiverse_arch_patchpoint_apply() changes the
+  patchpoint with one atomic store, such that threads that execute it
+  concurrently never see a partially written instruction. For a dummy
+  architecture implementation, this operation can always return 0.
+*/
+int multiverse_arch_patchpoint_atomic(struct mv_info_mvfn *mvfn,
+                                      struct mv_patchpoint *pp);
+
 /**
   @brief applies the mvfn to the patchpoint
 */
@@ -61,4 +83,47 @@ void multiverse_arch_patchpoint_revert(struct mv_patchpoint *pp);
  */
 void multiverse_arch_patchpoint_size(struct mv_patchpoint *pp,
                                      void **from, void** to);
+
+/**
+  @brief Copy a function body to another location
+
+  Copies the len bytes at src to dst and adjusts all relative
+  references that point outside of [src, src+len). Returns -1 if the
+  body contains instructions that cannot be relocated. For a dummy
+  architecture implementation, this operation can always fail.
+*/
+int multiverse_arch_relocate(void *dst, void *src, unsigned int len);
+
+/**
+  @brief Duplicate a callsite patchpoint for a relocated copy of the callsite
+
+  Fills in the copy for a callsite at location that was relocated from
+  pp->location. The swapspace of the copy holds the original call
+  instruction, as seen from the new location. Returns -1 if this is
+  not possible.
+*/
+int multiverse_arch_patchpoint_copy(struct mv_patchpoint *pp,
+                                    struct mv_patchpoint *copy,
+                                    void *location);
+
+/**
+  @brief Write the lazy callsite fixup stub of a function
+
+  The stub is entered by a jump from the generic function entry. It
+  calls multiverse_lazy_fixup() with the function and the return
+  address, and continues at the address that is returned, with all
+  argument registers preserved. Returns the size of the stub, or -1 if
+  size is too small, the stub cannot be reached from the function, or
+  the architecture does not support lazy fixups.
+*/
+int multiverse_arch_lazy_stub(void *stub, unsigned int size, struct mv_info_fn *fn);
+
+/**
+  @brief Read a cycle-granular time stamp counter
+
+  Used to measure variants if the platform has no performance
+  counters. Returns 0 if the architecture has no such counter.
+*/
+unsigned long long multiverse_arch_timestamp(void);
+
 #endif
@@ -22,9 +22,14 @@ struct mv_info_mvfn;
 struct mv_info_fn;
 struct mv_info_callsite;
 struct mv_patchpoint;
+struct mv_var_policy;
+struct mv_fn_tune;
 
 typedef __UINT_LEAST32_TYPE__ mv_value_t;
 
+// The maximal number of bytes that are rewritten at a patchpoint
+#define MV_PATCHPOINT_SIZE 6
+
 
 struct mv_info_assignment {
     union {
@@ -34,6 +39,9 @@ struct mv_info_assignment {
         void *location;
         struct mv_info_var *info;
     } variable;
+    // The variable matches, if its value lies within the bounds. For
+    // variables with flag_bits, the lower bound is a mask and the upper
+    // bound a pattern: (value & lower_bound) == upper_bound
     mv_value_t lower_bound;
     mv_value_t upper_bound;
 };
@@ -58,6 +66,7 @@ struct mv_info_mvfn {
     int type;                        // This is be interpreted as mv_type_t
                                      // (declared as integer to ensure correct size)
     mv_value_t constant;
+    void *cached_body;               // Copy of the body in the code cache
 };
 
 
@@ -71,10 +80,14 @@ struct mv_info_fn {
     // (instead of a multiversed function) the field n_mv_functions is set to -1.
     // In this case mv_functions points to a single mvfn descriptor that is
     // temporarily used for each function that is assigned to the function pointer.
+    unsigned long *hits;    // Calls of the generic body, NULL if not counted
 
     // runtime
     struct mv_patchpoint *patchpoints_head;  // Patchpoints as linked list TODO: arch-specific
     struct mv_info_mvfn *active_mvfn; // The currently active mvfn
+    int decoded;                      // 1, if the patchpoints were decoded
+    struct mv_info_mvfn *lazy_mvfn;   // Directs the entry to the lazy fixup stub
+    struct mv_fn_tune *tune;          // Pin and tuning results, NULL if none
 };
 
 
@@ -100,7 +113,11 @@ struct mv_info_var {
         struct {
             unsigned int
                 variable_width : 4,  // Width of the variable in bytes
-                reserved       : 25, // Currently not used
+                reserved       : 22, // Currently not used
+                flag_pointer   : 1,  // A data pointer, read as 0 (NULL) or 1
+                flag_bits      : 1,  // The assignments match bit patterns
+                flag_frozen    : 1,  // Set by multiverse_seal(), the
+                                     // referencing functions stay as they are
                 flag_tracked   : 1,  // Determines if the variable is tracked
                 flag_signed    : 1,  // Determines if the variable is signed
                 flag_bound     : 1;  // 1 if the variable is bound, 0 if not
@@ -110,16 +127,199 @@ struct mv_info_var {
 
     // runtime
     struct mv_info_fn_ref *functions_head; // Functions referening this variable
+    struct mv_var_policy *policy;          // Commit policy, NULL for MV_POLICY_FULL
+};
+
+
+struct mv_plan_patch {
+    struct mv_patchpoint *patchpoint;
+    void *location;                  // Address of the rewritten code
+    unsigned int size;               // Number of rewritten bytes
+    unsigned char bytes[MV_PATCHPOINT_SIZE]; // The code to install
+};
+
+
+struct mv_plan_fn {
+    struct mv_info_fn *fn;
+    struct mv_info_mvfn *mvfn;       // The mvfn to select, NULL for the generic function
+    void *function_pointer;          // Target of a multiversed function pointer
+    int changed;                     // 1, if the plan changed the function when it was made
+    unsigned int n_patches;
+    struct mv_plan_patch *patches;   // Points into mv_plan.patches
+};
+
+
+struct mv_plan {
+    unsigned int n_functions;
+    struct mv_plan_fn *functions;
+    unsigned int n_patches;
+    struct mv_plan_patch *patches;
+};
+
+
+#define MV_STATS_VERSION   1
+#define MV_STATS_HISTOGRAM 16
+
+struct mv_stats {
+    unsigned int version;                   // MV_STATS_VERSION
+    unsigned int size;                      // sizeof(struct mv_stats)
+    unsigned long sequence;                 // Odd while a transaction is running
+
+    // Counters
+    unsigned long transactions;             // Commits, reverts, and applied plans
+    unsigned long functions_changed;
+    unsigned long patchpoints_written;
+    unsigned long pages_unprotected;
+    unsigned long mprotect_calls;           // Protect and unprotect operations
+
+    // Transaction latency
+    unsigned long long latency_ns_total;
+    unsigned long long latency_ns_max;
+    // Bucket 0 counts transactions below 1us, bucket i those below 2^i us
+    // The last bucket counts all slower ones
+    unsigned long latency_histogram[MV_STATS_HISTOGRAM];
+
+    // Footprint in bytes
+    unsigned long descriptor_bytes;         // Descriptors emitted by the compiler
+    unsigned long patchpoint_bytes;         // Decoded patchpoints
+    unsigned long ref_bytes;                // Variable -> function references
+    unsigned long variant_text_bytes;       // The __multiverse_text_ section
 };
 
 
 int multiverse_init(void);
+
+/**
+   @brief Initialize the run-time system without decoding the code
+
+   Like multiverse_init, but only the descriptors of variables and
+   functions are connected. The patchpoints and the mvfn bodies of a
+   function are decoded the first time the function is committed
+   (or planned). Thereby, the startup time depends on the functions
+   that are actually used, and not on the size of the binary.
+
+   Use either multiverse_init or multiverse_init_lazy, but not both.
+
+   @return 0 on success
+*/
+int multiverse_init_lazy(void);
+
 void multiverse_dump_info(void);
 
 
 struct mv_info_fn  *  multiverse_info_fn(void * function_body);
 struct mv_info_var *  multiverse_info_var(void * variable_location);
 
+/**
+   @brief Look up a function or variable by its symbol name
+
+   The names are the assembler names that the plugin recorded; members
+   of struct variables are named with their path (cfg.sub.verbose). If
+   several translation units define a static symbol of the same name,
+   the first one is returned.
+
+   @return the descriptor, or NULL if there is none
+*/
+struct mv_info_fn  *  multiverse_info_fn_by_name(const char *name);
+struct mv_info_var *  multiverse_info_var_by_name(const char *name);
+
+
+struct mv_patchpoint_info {
+    void *location;         // Address of the patched instruction
+    const char *type;       // "call", "call_indirect", or "jump"
+    int is_entry;           // 1 for the entry of the generic function
+    void *target;           // The body that is currently installed,
+                            // NULL for the original code
+};
+
+/**
+   @brief Iterate over all multiverse functions
+   @param fn the previous function, or NULL to start
+
+   @verbatim
+   struct mv_info_fn *fn = NULL;
+   while ((fn = multiverse_next_fn(fn)) != NULL) { ... }
+   @endverbatim
+
+   The variants of a function are fn->mv_functions[0 ..
+   fn->n_mv_functions-1], with their assignments and decoded type;
+   fn->active_mvfn is the selected one (NULL for the generic
+   function). For a multiversed function pointer, n_mv_functions is -1.
+
+   @return the next function, or NULL after the last one
+*/
+struct mv_info_fn *multiverse_next_fn(struct mv_info_fn *fn);
+
+/**
+   @brief Iterate over all multiverse variables
+   @param var the previous variable, or NULL to start
+
+   The functions that reference a variable are linked via
+   var->functions_head.
+
+   @return the next variable, or NULL after the last one
+*/
+struct mv_info_var *multiverse_next_var(struct mv_info_var *var);
+
+/**
+   @brief Iterate over the patchpoints of a function
+   @param fn the function
+   @param pp the previous patchpoint, or NULL to start
+
+   Patchpoints that could not be decoded are skipped. The patchpoints
+   of a function that was not decoded yet (see multiverse_init_lazy)
+   are not known, and the iteration is empty.
+
+   @return the next patchpoint, or NULL after the last one
+   @sa multiverse_patchpoint_info
+*/
+struct mv_patchpoint *multiverse_next_patchpoint(struct mv_info_fn *fn,
+                                                 struct mv_patchpoint *pp);
+
+/**
+   @brief Describe a patchpoint
+   @param pp the patchpoint
+   @param info is filled with the location, type, and current target
+
+   @return 0 on success, -1 on error
+*/
+int multiverse_patchpoint_info(struct mv_patchpoint *pp,
+                               struct mv_patchpoint_info *info);
+
+/**
+   @brief The name of a decoded mvfn type ("none", "nop", "constant", ...)
+*/
+const char *multiverse_mvfn_type_name(int type);
+
+/**
+   @brief Number of calls that ran the generic body of a function
+   @param function_body pointer to the multiverse function
+
+   With -fplugin-arg-multiverse-hotness, the plugin counts the calls of
+   the generic body of every multiverse function. A committed function
+   jumps to its variant before the counter is reached, so the count
+   covers only the time the function ran uncommitted (or was committed
+   to the generic function). The counter is not atomic.
+
+   @return the count, or -1 if the function is not counted
+*/
+long multiverse_fn_hits(void *function_body);
+
+/**
+   @brief Write the state of all functions and variables as JSON
+   @param buf the buffer, may be NULL if size is 0
+   @param size the size of the buffer
+
+   The dump contains every function with its variants, assignments,
+   patchpoints and the active variant, and every variable with its
+   current value, flags, and referencing functions. Like snprintf, the
+   output is truncated to the buffer and always terminated.
+
+   @return the length of the complete dump (without the terminating
+           zero); the dump was truncated if it is >= size
+*/
+unsigned long multiverse_dump_json(char *buf, unsigned long size);
+
 /**
   @brief Iterate over all multiverse functions and commit
 
@@ -209,6 +409,25 @@ int multiverse_commit_info_refs(struct mv_info_var *var);
 */
 int multiverse_commit_refs(void * var_location);
 
+/**
+   @brief commit all functions that reference one of several variables
+   @param var_locations array of pointers to multiverse variables
+   @param n number of variables
+
+   @return number of changed functions or -1 on error
+   @sa multiverse_commit_refs
+
+   Like multiverse_commit_refs for each of the variables, but all
+   functions are committed in a single transaction, and a function
+   that references several of the variables is committed only once.
+
+   @verbatim
+   void *flags[] = {&config_a, &config_b};
+   multiverse_commit_refs_many(flags, 2);
+   @endverbatim
+*/
+int multiverse_commit_refs_many(void **var_locations, unsigned int n);
+
 
 /**
    @brief commit a single multiverse function
@@ -263,6 +482,19 @@ int multiverse_revert_info_refs(struct mv_info_var *var);
 
 */
 int multiverse_revert_refs(void * var_location);
+/**
+   @brief revert all functions that reference one of several variables
+   @param var_locations array of pointers to multiverse variables
+   @param n number of variables
+
+   @return number of changed functions or -1 on error
+   @sa multiverse_revert_refs, multiverse_commit_refs_many
+
+   Like multiverse_revert_refs for each of the variables, but within
+   a single transaction and only once per function.
+*/
+int multiverse_revert_refs_many(void **var_locations, unsigned int n);
+
 
 /**
    @brief Revert all multiverse code modifications
@@ -305,10 +537,336 @@ int multiverse_is_committed(void* function_body);
    @return new binding state or error
       - 0   if variable is unbound
       - 1   if variable is bound
-      - -1  if variable was not marked as "tracked"
+      - -1  if variable was not marked as "tracked" or is frozen
 */
 int multiverse_bind(void* var_location, int state);
 
+/**
+   @brief Commit all functions for the last time and release unused variants
+
+   This function commits all multiverse functions (like
+   multiverse_commit) and marks all multiverse variables as frozen.
+   Afterwards, functions that reference a frozen variable cannot be
+   committed to a different variant or reverted anymore, and
+   multiverse_bind() refuses to change the binding state of frozen
+   variables.
+
+   Since no other variant can be selected anymore, the text pages that
+   contain only unselected variants are handed back to the operating
+   system. This requires that the compiler plugin placed the variants
+   in the __multiverse_text_ section; pages that contain a patchpoint
+   or a selected variant are always kept.
+
+   @return number of changed functions or -1 on error
+   @sa multiverse_commit
+*/
+int multiverse_seal(void);
+
+/**
+   @brief Enable the code cache for selected variants
+   @param size size of the code cache in bytes
+   @param huge_pages back the code cache with huge pages, if possible
+
+   After the code cache is enabled, every variant that gets selected
+   by a commit is copied into a contiguous executable region next to
+   the text segment, and its callsites are patched to the copy.
+   Thereby, a hot path that crosses several multiversed functions
+   touches fewer text pages.
+
+   Only variants that can be relocated are copied (see
+   multiverse_arch_relocate); all others, and all variants that do not
+   fit into the cache anymore, are called at their original location.
+   The cache is filled in the order of selection and never evicted.
+   Please note that the copies have no unwind or symbol information.
+
+   @return 0 on success, -1 if the platform provides no memory for the cache
+*/
+int multiverse_enable_code_cache(unsigned long size, int huge_pages);
+
+/**
+   @brief Compute the code changes of multiverse_commit without applying them
+
+   This function selects the best fitting mvfn for every multiverse
+   function, like multiverse_commit, but does not touch the text
+   segment. Instead, it records the selected mvfns and the exact bytes
+   for every patchpoint in a plan. The plan can be inspected and later
+   be installed with multiverse_plan_apply(). Since a plan describes
+   the complete target state, and not the difference to the current
+   state, it can be applied several times. For example, two plans can
+   be used to switch between two known configurations.
+
+   The field changed of each function tells whether the function
+   differed from the plan at the time the plan was made.
+
+   Plans do not copy variants into the code cache; callsites that are
+   added by the code cache after the plan was made keep calling the
+   generic function.
+
+   @return the plan, or NULL on error (e.g., a frozen function would change)
+   @sa multiverse_plan_apply, multiverse_plan_free
+*/
+struct mv_plan *multiverse_plan_commit(void);
+
+/**
+   @brief Compute the code changes of multiverse_revert without applying them
+
+   @return the plan, or NULL on error
+   @sa multiverse_plan_commit
+*/
+struct mv_plan *multiverse_plan_revert(void);
+
+/**
+   @brief Install a plan
+
+   All functions of the plan that are not yet in the planned state are
+   patched within a single transaction. The code bytes are copied as
+   recorded, nothing is selected or decoded anymore.
+
+   @return number of changed functions or -1 on error
+   @sa multiverse_plan_commit
+*/
+int multiverse_plan_apply(struct mv_plan *plan);
+
+/**
+   @brief Release a plan
+*/
+void multiverse_plan_free(struct mv_plan *plan);
+
+#define MV_POLICY_FULL     0  // Patch the function entry and all callsites
+#define MV_POLICY_ENTRY    1  // Patch only the function entry
+#define MV_POLICY_ADAPTIVE 2  // Patch only the entry while the variable changes
+#define MV_POLICY_LAZY     3  // Patch callsites on their first call
+
+/**
+   @brief Set the commit policy of a variable
+   @param var_location pointer to the variable
+   @param policy MV_POLICY_FULL, MV_POLICY_ENTRY or MV_POLICY_ADAPTIVE
+   @param hysteresis number of commits (only for MV_POLICY_ADAPTIVE)
+
+   By default, a commit patches the entry of the generic function to
+   jump to the selected mvfn, and all callsites to call it directly.
+   For a variable that changes often, rewriting all callsites on every
+   change is expensive. With MV_POLICY_ENTRY, only the entry of the
+   generic function is patched and the callsites keep calling the
+   generic function. MV_POLICY_ADAPTIVE starts like MV_POLICY_ENTRY,
+   and switches to patching the callsites once the variable kept its
+   value for hysteresis commits of its functions. If it changes
+   again, the callsites are restored with the next commit.
+
+   With MV_POLICY_LAZY, the generic entry jumps to a small fixup stub
+   of the function. On its first call after a commit, each callsite
+   is patched by the stub to call the selected mvfn. Thereby, a
+   commit does not depend on the number of callsites, and only the
+   callsites that are actually executed get patched. As other threads
+   may execute a callsite while it is patched, only callsites that can
+   be rewritten with a single atomic store are patched (on x86, direct
+   calls of non-trivial mvfns with an aligned call offset); the others
+   keep calling through the stub. Where no stub can be installed
+   (e.g., in the kernel), MV_POLICY_LAZY behaves like MV_POLICY_ENTRY.
+
+   A function that references several variables uses the most
+   restrictive policy of its variables (entry-only before lazy before
+   full). Plans always patch all
+   callsites (see multiverse_plan_commit).
+
+   Please note that only the next commit applies the new policy.
+
+   @return 0 on success, -1 on error
+*/
+int multiverse_set_policy(void *var_location, int policy, unsigned int hysteresis);
+
+#define MV_WARMUP_PREFAULT 0x1  // Prefault the text of newly selected variants
+#define MV_WARMUP_STUBS    0x2  // Call the registered warm-up stubs
+
+/**
+   @brief Warm up newly selected variants at the end of a commit
+   @param flags a combination of MV_WARMUP_PREFAULT and MV_WARMUP_STUBS, or 0
+
+   The first call into a variant that was never executed before can
+   take a page fault and cold instruction cache and TLB misses. With
+   MV_WARMUP_PREFAULT, every commit (and multiverse_plan_apply) makes
+   the text of each newly selected variant resident and touches it.
+   With MV_WARMUP_STUBS, the warm-up stubs of all changed functions
+   are called before the commit returns (see
+   multiverse_register_warmup).
+
+   Warm-up is disabled by default.
+
+   @return the previous flags
+*/
+int multiverse_set_warmup(int flags);
+
+/**
+   @brief Register a warm-up stub for a function
+   @param function_body pointer to the multiverse function
+   @param stub function that is called after function was changed by a commit
+
+   The stub should call the function with harmless arguments, so that
+   the newly selected variant is in the caches when the first real
+   call arrives. The stub is called after the transaction has ended,
+   and only if MV_WARMUP_STUBS is enabled.
+
+   @return 0 on success, -1 if function_body is no multiverse function
+*/
+int multiverse_register_warmup(void *function_body, void (*stub)(void));
+
+/**
+   @brief Pin a function to a variant
+   @param function_body pointer to the multiverse function
+   @param variant_body the body of one of its mvfns, or function_body
+                       for the generic function
+
+   A pinned function is committed to the given variant, regardless of
+   the values of its variables, until multiverse_unpin_fn() is called.
+   This is meant for manual A/B measurements: the caller is
+   responsible that the variant is correct for the current values.
+   The function is committed immediately.
+
+   @return number of changed functions or -1 on error
+*/
+int multiverse_pin_fn(void *function_body, void *variant_body);
+
+/**
+   @brief Remove the pin and the tuning results of a function
+
+   The function is committed immediately according to its variables.
+
+   @return number of changed functions or -1 on error
+   @sa multiverse_pin_fn, multiverse_tune_fn
+*/
+int multiverse_unpin_fn(void *function_body);
+
+#define MV_TUNE_PERF 1  // Measured with the performance counters
+#define MV_TUNE_TSC  2  // Measured with the time stamp counter, no instructions
+
+struct mv_tune_result {
+    void *variant;                          // The measured variant
+    void *winner;                           // The kept body (variant or generic)
+    int source;                             // MV_TUNE_PERF or MV_TUNE_TSC
+    // Fastest call of the workload
+    unsigned long long generic_cycles;
+    unsigned long long variant_cycles;
+    unsigned long long generic_instructions;
+    unsigned long long variant_instructions;
+};
+
+/**
+   @brief Measure the selected variant against the generic function
+   @param function_body pointer to the multiverse function
+   @param workload calls the function, NULL to use the warm-up stub
+   @param rounds number of measurements of each body
+   @param result the measurements, may be NULL
+
+   Specialization is not always faster; a variant can be slower than
+   the generic function, e.g., due to its alignment. This function
+   pins the function alternately to the generic body and to the
+   variant that matches the current variable values, and calls the
+   workload after a warm-up call for every round. The workload is
+   measured with the performance counters of the calling thread, or
+   with the time stamp counter if there are none. The fastest round of
+   each body is compared.
+
+   If the variant was slower, it is rejected: whenever it would be
+   selected, the function is committed to the generic function
+   instead. Otherwise, the variant stays selected. The function is
+   committed accordingly before this function returns, and a previous
+   pin is restored.
+
+   @return 1 if the variant was kept, 0 if it was rejected or there
+           is no variant for the current values, -1 on error
+   @sa multiverse_unpin_fn
+*/
+int multiverse_tune_fn(void *function_body, void (*workload)(void),
+                       unsigned int rounds, struct mv_tune_result *result);
+
+
+/**
+   @brief Read the statistics of the run-time system
+   @param stats is filled with the current counters and the footprint
+
+   The counters cover all transactions, i.e., every commit, revert,
+   and applied plan. On platforms without a clock, all latencies are 0.
+   The footprint is computed when this function is called.
+
+   @return 0 on success
+*/
+int multiverse_get_stats(struct mv_stats *stats);
+
+/**
+   @brief Size of the variant bodies of a function
+   @param function_body pointer to the multiverse function
+
+   Only bodies in the __multiverse_text_ section are counted.
+
+   @return the number of bytes, or -1 if function_body is no multiverse function
+*/
+long multiverse_fn_variant_bytes(void *function_body);
+
+/**
+   @brief Publish the statistics in a shared-memory segment
+   @param name name of the segment (e.g., "/multiverse.1234")
+
+   Afterwards, the counters are maintained directly in the segment, so
+   that monitoring agents can map it read-only and observe the process
+   without stopping it. A reader should retry while the sequence
+   number is odd or changes during the read. The footprint is
+   updated by multiverse_get_stats.
+
+   @return 0 on success, -1 if the platform has no shared memory
+*/
+int multiverse_stats_export(const char *name);
+
+
+/**
+   @brief Execute a control command
+   @param command a single command line, e.g., "commit var config"
+   @param reply the buffer for the reply, may be NULL if size is 0
+   @param size the size of the buffer
+
+   The commands are:
+     - functions: list functions and their active variants
+     - variables: list variables and their values
+     - set <var> <value>: write a variable (without commit)
+     - bind <var> 0|1: see multiverse_bind
+     - commit [fn|var <name>]: commit everything, a function, or the
+       functions that reference a variable
+     - revert [fn|var <name>]: likewise for revert
+     - stats: the statistics (see multiverse_get_stats)
+     - dump: the state as JSON (see multiverse_dump_json)
+     - help
+
+   Functions and variables are named by their symbol names. The last
+   line of the reply is "ok", or "error <message>" if the command
+   failed. Like snprintf, the reply is truncated to the buffer and
+   always terminated.
+
+   The command runs in the calling thread and must not race with
+   other commits of the application.
+
+   @return the length of the complete reply (without the terminating zero)
+*/
+unsigned long multiverse_control_exec(const char *command, char *reply,
+                                      unsigned long size);
+
+/**
+   @brief Serve control commands on a UNIX socket
+   @param path the path of the socket; an existing socket is replaced
+
+   A background thread accepts connections on the socket and executes
+   every received line with multiverse_control_exec. The tools/mvctl
+   program is a client for the socket. As the commands are executed in
+   the background thread, the application must not commit
+   concurrently while a client is connected.
+
+   @return 0 on success, -1 on error or if the platform has no sockets
+*/
+int multiverse_control_start(const char *path);
+
+/**
+   @brief Stop the control thread and remove the socket
+*/
+void multiverse_control_stop(void);
+
 
 #ifdef __cplusplus
 } // extern "C"
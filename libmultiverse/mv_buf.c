@@ -0,0 +1,48 @@
+#include "mv_string.h"
+#include "mv_buf.h"
+
+
+void mv_buf_put(struct mv_buf *b, const char *s, unsigned long n) {
+    unsigned long i;
+    for (i = 0; i < n; i++, b->len++) {
+        if (b->len + 1 < b->size) b->buf[b->len] = s[i];
+    }
+}
+
+void mv_buf_puts(struct mv_buf *b, const char *s) {
+    mv_buf_put(b, s, strlen(s));
+}
+
+void mv_buf_int(struct mv_buf *b, long long value) {
+    char digits[24];
+    unsigned long long v = value < 0 ? -(unsigned long long)value
+                                     : (unsigned long long)value;
+    int i = sizeof(digits);
+
+    do {
+        digits[--i] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    if (value < 0) digits[--i] = '-';
+    mv_buf_put(b, digits + i, sizeof(digits) - i);
+}
+
+void mv_buf_hex(struct mv_buf *b, unsigned long long value) {
+    static const char hex[] = "0123456789abcdef";
+    char digits[2 + 16];
+    int i = sizeof(digits);
+
+    do {
+        digits[--i] = hex[value & 0xf];
+        value >>= 4;
+    } while (value);
+    digits[--i] = 'x';
+    digits[--i] = '0';
+    mv_buf_put(b, digits + i, sizeof(digits) - i);
+}
+
+unsigned long mv_buf_finish(struct mv_buf *b) {
+    if (b->size > 0)
+        b->buf[b->len < b->size ? b->len : b->size - 1] = '\0';
+    return b->len;
+}
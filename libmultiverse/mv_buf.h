@@ -0,0 +1,21 @@
+#ifndef __MULTIVERSE_MV_BUF_H
+#define __MULTIVERSE_MV_BUF_H
+
+/* A text buffer with snprintf semantics: len counts all bytes that
+   were written, but only the ones that fit are stored. We format
+   ourselves, as the kernel and OctoPOS have no common printf. */
+struct mv_buf {
+    char *buf;
+    unsigned long size;
+    unsigned long len;
+};
+
+void mv_buf_put(struct mv_buf *b, const char *s, unsigned long n);
+void mv_buf_puts(struct mv_buf *b, const char *s);
+void mv_buf_int(struct mv_buf *b, long long value);
+void mv_buf_hex(struct mv_buf *b, unsigned long long value);
+
+/* Terminates the buffer and returns the length of the complete text */
+unsigned long mv_buf_finish(struct mv_buf *b);
+
+#endif
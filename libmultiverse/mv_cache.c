@@ -0,0 +1,142 @@
+#include "mv_assert.h"
+#include "mv_string.h"
+#include "multiverse.h"
+#include "mv_commit.h"
+#include "arch.h"
+#include "platform.h"
+
+
+extern struct mv_info_fn *__start___multiverse_fn_ptr;
+extern struct mv_info_fn *__stop___multiverse_fn_ptr;
+extern char *__start___multiverse_text_ptr;
+extern char *__stop___multiverse_text_ptr;
+
+/* The code cache is a simple bump allocator. */
+static char *code_cache_top;
+static char *code_cache_end;
+
+
+int multiverse_enable_code_cache(unsigned long size, int huge_pages) {
+    char *near = __start___multiverse_text_ptr;
+    char *cache;
+
+    if (code_cache_top != NULL) return -1;
+    if (near == __stop___multiverse_text_ptr) {
+        // No variant section. Let's stay close to the first function.
+        if (__start___multiverse_fn_ptr == __stop___multiverse_fn_ptr) return -1;
+        near = __start___multiverse_fn_ptr->function_body;
+    }
+
+    cache = multiverse_os_alloc_text(near, size, huge_pages);
+    if (cache == NULL) return -1;
+
+    code_cache_top = cache;
+    code_cache_end = cache + size;
+    return 0;
+}
+
+
+static int
+multiverse_code_cache_callsites(char *from, char *to, struct mv_patchpoint *copies,
+                                char *copy) {
+    struct mv_info_fn *fn;
+    int n = 0;
+
+    for (fn = __start___multiverse_fn_ptr; fn < __stop___multiverse_fn_ptr; fn++) {
+        struct mv_patchpoint *pp;
+        for (pp = fn->patchpoints_head; pp != NULL; pp = pp->next) {
+            char *location = pp->location;
+            if (pp->type == PP_TYPE_INVALID || location < from || location >= to)
+                continue;
+            if (copies != NULL) {
+                if (multiverse_arch_patchpoint_copy(pp, &copies[n],
+                                                    copy + (location - from)) < 0)
+                    return -1;
+            }
+            n++;
+        }
+    }
+    return n;
+}
+
+
+/* Is the page in the unprotected pages of the transaction? */
+static int
+multiverse_code_cache_unprotected(mv_transaction_ctx_t *ctx, void *page) {
+    unsigned i;
+    for (i = 0; i < ctx->cache_size; i++) {
+        if (ctx->unprotected[i] == page) return 1;
+    }
+    return 0;
+}
+
+
+void multiverse_code_cache_insert(mv_transaction_ctx_t *ctx,
+                                  struct mv_info_fn *fn,
+                                  struct mv_info_mvfn *mvfn) {
+    struct mv_patchpoint *copies = NULL;
+    char *from = mvfn->function_body;
+    char *to, *copy, *p, *first, *last;
+    uintptr_t step;
+    int n, i, f, relocated;
+
+    if (code_cache_top == NULL || mvfn->cached_body != NULL) return;
+    // Callsites of trivial mvfns never call the body
+    if (mvfn->type != MVFN_TYPE_NONE) return;
+
+    to = multiverse_info_body_end(from);
+    if (to == NULL) return;
+
+    copy = (char *)(((uintptr_t) code_cache_top + 15) & ~(uintptr_t)15);
+    if (copy + (to - from) > code_cache_end) return;
+
+    // The callsites within the body are patchpoints of other
+    // functions. Their copies have to become patchpoints as well.
+    n = multiverse_code_cache_callsites(from, to, NULL, copy);
+    if (n > 0) {
+        copies = multiverse_os_malloc(n * sizeof(struct mv_patchpoint));
+        if (copies == NULL) return;
+        if (multiverse_code_cache_callsites(from, to, copies, copy) != n) {
+            multiverse_os_free(copies);
+            return;
+        }
+    }
+
+    // The body may span more pages than the transaction keeps
+    // unprotected. Therefore, we unprotect the pages of the copy
+    // directly, and leave the transaction's pages alone.
+    first = multiverse_os_addr_to_page(copy);
+    last = multiverse_os_addr_to_page(copy + (to - from) - 1);
+    step = multiverse_os_pagesize();
+    for (p = first; p <= last; p += step) {
+        if (multiverse_code_cache_unprotected(ctx, p)) continue;
+        multiverse_os_unprotect(p);
+        multiverse_stats->pages_unprotected++;
+        multiverse_stats->mprotect_calls++;
+    }
+
+    relocated = multiverse_arch_relocate(copy, from, to - from);
+    multiverse_os_clear_cache(copy, to - from);
+
+    for (p = first; p <= last; p += step) {
+        if (multiverse_code_cache_unprotected(ctx, p)) continue;
+        multiverse_os_protect(p);
+        multiverse_stats->mprotect_calls++;
+    }
+    if (relocated < 0) {
+        multiverse_os_free(copies);
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        struct mv_info_fn *callee = copies[i].function;
+        copies[i].next = callee->patchpoints_head;
+        callee->patchpoints_head = &copies[i];
+    }
+
+    code_cache_top = copy + (to - from);
+    for (f = 0; f < fn->n_mv_functions; f++) {
+        if (fn->mv_functions[f].function_body == from)
+            fn->mv_functions[f].cached_body = copy;
+    }
+}
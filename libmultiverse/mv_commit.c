@@ -4,14 +4,23 @@
 #include "mv_commit.h"
 #include "arch.h"
 #include "platform.h"
+#include "mv_trace.h"
 
 
 /* TODO encapsulate all this stuff in mv_info */
 extern struct mv_info_fn *__start___multiverse_fn_ptr;
 extern struct mv_info_fn *__stop___multiverse_fn_ptr;
+extern struct mv_info_var *__start___multiverse_var_ptr;
+extern struct mv_info_var *__stop___multiverse_var_ptr;
+extern char *__start___multiverse_text_ptr;
+extern char *__stop___multiverse_text_ptr;
 
 
-static mv_value_t multiverse_var_read(struct mv_info_var *var) {
+mv_value_t multiverse_var_read(struct mv_info_var *var) {
+    // Pointer variables are specialized for NULL and non-NULL
+    if (var->flag_pointer) {
+        return *(void **)var->variable_location != NULL;
+    }
     if (var->variable_width == sizeof(unsigned char)) {
         return *(unsigned char *)var->variable_location;
     } else if (var->variable_width == sizeof(unsigned short)) {
@@ -23,29 +32,34 @@ static mv_value_t multiverse_var_read(struct mv_info_var *var) {
     return 0;
 }
 
-typedef struct {
-    unsigned int cache_size;
-    void        *unprotected[10];
-;
-} mv_transaction_ctx_t;
-
-static mv_transaction_ctx_t mv_transaction_start(void) {
-    return (mv_transaction_ctx_t){ .cache_size = 10 };
-}
-
-static void mv_transaction_end(mv_transaction_ctx_t *ctx) {
-    unsigned i = 0;
-    for (i = 0; i < ctx->cache_size; i++) {
-        if (ctx->unprotected[i] != NULL) {
-            multiverse_os_protect(ctx->unprotected[i]);
-        }
+void multiverse_var_write(struct mv_info_var *var, mv_value_t value) {
+    if (var->variable_width == sizeof(unsigned char)) {
+        *(unsigned char *)var->variable_location = value;
+    } else if (var->variable_width == sizeof(unsigned short)) {
+        *(unsigned short *)var->variable_location = value;
+    } else if (var->variable_width == sizeof(unsigned int)) {
+        *(unsigned int *)var->variable_location = value;
+    } else {
+        MV_ASSERT(0 && "Invalid width of multiverse variable. This should not happen");
     }
-    multiverse_os_clear_caches();
 }
 
+long long multiverse_var_extend(struct mv_info_var *var, mv_value_t value) {
+    unsigned bits = var->variable_width * 8;
+    if (var->flag_signed && bits > 0 && bits <= 32
+        && (value & ((mv_value_t)1 << (bits - 1))))
+        return (long long)value - (1LL << bits);
+    return value;
+}
 
+int multiverse_var_match(struct mv_info_var *var,
+                         struct mv_info_assignment *assign, mv_value_t value) {
+    if (var->flag_bits)
+        return (value & assign->lower_bound) == assign->upper_bound;
+    return value >= assign->lower_bound && value <= assign->upper_bound;
+}
 
-static void multiverse_transaction_unprotect(mv_transaction_ctx_t *ctx, void *addr) {
+void multiverse_transaction_unprotect(mv_transaction_ctx_t *ctx, void *addr) {
     void *page = multiverse_os_addr_to_page(addr);
     // The unprotected_pages implements a LRU cache, where element 0 is
     // the hottest one.
@@ -65,36 +79,164 @@ static void multiverse_transaction_unprotect(mv_transaction_ctx_t *ctx, void *ad
     }
 
     multiverse_os_unprotect(page);
+    multiverse_stats->pages_unprotected++;
+    multiverse_stats->mprotect_calls++;
 
     // Insert into the cache.
     if (ctx->unprotected[ctx->cache_size - 1] != NULL) {
         // If the cache is full, we push out the coldest element from the cache
         multiverse_os_protect(ctx->unprotected[ctx->cache_size - 1]);
+        multiverse_stats->mprotect_calls++;
     }
     // Push everything one elment back.
     memmove(&(ctx->unprotected[1]), &(ctx->unprotected[0]),
-            ctx->cache_size - 1);
+            (ctx->cache_size - 1) * sizeof(void *));
     ctx->unprotected[0] = page;
 
 }
 
 
+int multiverse_fn_frozen(struct mv_info_fn *fn) {
+    int f;
+    for (f = 0; f < fn->n_mv_functions; f++) {
+        struct mv_info_mvfn *mvfn = &fn->mv_functions[f];
+        unsigned a;
+        for (a = 0; a < mvfn->n_assignments; a++) {
+            if (mvfn->assignments[a].variable.info->flag_frozen)
+                return 1;
+        }
+    }
+    return 0;
+}
+
+unsigned int multiverse_transaction_count;
+
+struct mv_var_policy {
+    int policy;
+    unsigned int hysteresis;   // Number of stable commits before promotion
+    unsigned int stable;       // Commits since the last change of the value
+    mv_value_t last_value;
+    unsigned int transaction;  // Last transaction that updated stable
+};
+
+int multiverse_set_policy(void *var_location, int policy, unsigned int hysteresis) {
+    struct mv_info_var *var = multiverse_info_var(var_location);
+    if (!var) return -1;
+    if (policy != MV_POLICY_FULL && policy != MV_POLICY_ENTRY
+        && policy != MV_POLICY_ADAPTIVE && policy != MV_POLICY_LAZY)
+        return -1;
+
+    if (!var->policy) {
+        if (policy == MV_POLICY_FULL) return 0;
+        var->policy = multiverse_os_malloc(sizeof(struct mv_var_policy));
+        if (!var->policy) return -1;
+    }
+    var->policy->policy = policy;
+    var->policy->hysteresis = hysteresis;
+    var->policy->stable = 0;
+    var->policy->last_value = multiverse_var_read(var);
+    var->policy->transaction = multiverse_transaction_count;
+    return 0;
+}
+
+/* Returns the effective policy of a variable: MV_POLICY_FULL,
+   MV_POLICY_ENTRY, or MV_POLICY_LAZY */
+static int multiverse_var_policy(struct mv_info_var *var) {
+    struct mv_var_policy *p = var->policy;
+    mv_value_t value;
+
+    if (!p) return MV_POLICY_FULL;
+    if (p->policy != MV_POLICY_ADAPTIVE) return p->policy;
+
+    // Adaptive: A variable is stable, if it kept its value over the
+    // last commits. We count every transaction only once, even if it
+    // commits several functions of the variable.
+    if (p->transaction != multiverse_transaction_count) {
+        p->transaction = multiverse_transaction_count;
+        value = multiverse_var_read(var);
+        if (value == p->last_value) {
+            if (p->stable < p->hysteresis) p->stable++;
+        } else {
+            p->stable = 0;
+            p->last_value = value;
+        }
+    }
+    return (p->stable >= p->hysteresis) ? MV_POLICY_FULL : MV_POLICY_ENTRY;
+}
+
+/* The most restrictive policy of all variables wins: entry-only
+   before lazy before full */
+static int multiverse_fn_policy(struct mv_info_fn *fn) {
+    int f, ret = MV_POLICY_FULL;
+    for (f = 0; f < fn->n_mv_functions; f++) {
+        struct mv_info_mvfn *mvfn = &fn->mv_functions[f];
+        unsigned a;
+        for (a = 0; a < mvfn->n_assignments; a++) {
+            int policy = multiverse_var_policy(mvfn->assignments[a].variable.info);
+            if (policy == MV_POLICY_ENTRY)
+                ret = MV_POLICY_ENTRY;
+            else if (policy == MV_POLICY_LAZY && ret == MV_POLICY_FULL)
+                ret = MV_POLICY_LAZY;
+        }
+    }
+    return ret;
+}
+
 static int
 multiverse_select_mvfn(mv_transaction_ctx_t *ctx,
                        struct mv_info_fn *fn,
                        struct mv_info_mvfn *mvfn) {
     struct mv_patchpoint *pp;
+    struct mv_info_mvfn *entry = mvfn;
+    struct mv_info_mvfn *old = fn->active_mvfn;
+    int changed = (mvfn != fn->active_mvfn);
+    int patched = 0;
+    int policy = MV_POLICY_FULL;
+    unsigned long long start_ns = 0;
 
-    if (mvfn == fn->active_mvfn) return 0;
+    if (changed && multiverse_fn_frozen(fn)) return -1;
+
+    if (MV_TRACE_ENABLED(select)) start_ns = multiverse_os_now_ns();
+
+    if (mvfn != NULL) {
+        if (changed) {
+            multiverse_code_cache_insert(ctx, fn, mvfn);
+        }
+        policy = multiverse_fn_policy(fn);
+        if (policy == MV_POLICY_LAZY) {
+            // The generic entry jumps to the fixup stub
+            entry = multiverse_lazy_entry(ctx, fn);
+            if (entry == NULL) {
+                entry = mvfn;
+                policy = MV_POLICY_ENTRY;
+            }
+        }
+    }
 
     for (pp = fn->patchpoints_head; pp != NULL; pp = pp->next) {
         void *from, *to;
         unsigned char *location = pp->location;
+        struct mv_info_mvfn *target = mvfn;
 
         // TODO: arch function is_patchpoint_valid??
         if (pp->type == PP_TYPE_INVALID) continue;
         if (!location) continue; // TODO: when does this happen??
 
+        if (pp->location == fn->function_body) {
+            target = entry;
+        } else if (policy == MV_POLICY_ENTRY) {
+            // The callsites call the generic function, which jumps to
+            // the selected mvfn.
+            target = NULL;
+        } else if (policy == MV_POLICY_LAZY) {
+            // Callsites are patched by their first call. Keep those
+            // that already call the selected mvfn.
+            target = (!changed && pp->applied == mvfn) ? mvfn : NULL;
+        }
+        if (pp->applied == target
+            && (target == NULL || target == fn->lazy_mvfn || !changed))
+            continue;
+
         multiverse_arch_patchpoint_size(pp, &from, &to);
 
         multiverse_transaction_unprotect(ctx, from);
@@ -102,46 +244,79 @@ multiverse_select_mvfn(mv_transaction_ctx_t *ctx,
             multiverse_transaction_unprotect(ctx, to);
         }
 
-        if (mvfn == NULL) {
+        if (target == NULL) {
             multiverse_arch_patchpoint_revert(pp);
+            MV_TRACE2(patch_revert, fn->name, location);
         } else {
-            multiverse_arch_patchpoint_apply(fn, mvfn, pp);
+            multiverse_arch_patchpoint_apply(fn, target, pp);
+            MV_TRACE3(patch_apply, fn->name, location,
+                      multiverse_mvfn_body(target));
+        }
+        pp->applied = target;
+        multiverse_stats->patchpoints_written++;
+        patched = 1;
+    }
+
+    if (mvfn != fn->active_mvfn) {
+        fn->active_mvfn = mvfn;
+        multiverse_warmup_select(fn, mvfn);
+    }
+
+    if (changed || patched) {
+        multiverse_stats->functions_changed++;
+        if (MV_TRACE_ENABLED(select)) {
+            MV_TRACE5(select, fn->name, fn->function_body, MV_TRACE_BODY(old),
+                      MV_TRACE_BODY(mvfn), multiverse_os_now_ns() - start_ns);
         }
+        return 1; // We changed this function
     }
+    return 0;
+}
 
-    fn->active_mvfn = mvfn;
+struct mv_info_mvfn *multiverse_match_mvfn(struct mv_info_fn *fn) {
+    struct mv_info_mvfn *best_mvfn = NULL;
+    int f;
+    for (f = 0; f < fn->n_mv_functions; f++) {
+        struct mv_info_mvfn * mvfn = &fn->mv_functions[f];
+        unsigned good = 1;
+        unsigned a;
+        for (a = 0; a < mvfn->n_assignments; a++) {
+            struct mv_info_assignment * assign = &mvfn->assignments[a];
+            // If the assignment of this mvfn depends on an unbound
+            // variable. The mvfn is unsuitable currently.
+            if (!assign->variable.info->flag_bound) {
+                good = 0;
+            } else {
+                // Variable is bound
+                mv_value_t cur = multiverse_var_read(assign->variable.info);
+                if (!multiverse_var_match(assign->variable.info, assign, cur))
+                    good = 0;
+            }
+        }
+        if (good) {
+            // Here we possibly override an already valid mvfn
+            best_mvfn = mvfn;
+        }
+    }
+    return best_mvfn;
+}
 
-    return 1; // We changed this function
+struct mv_info_mvfn *multiverse_best_mvfn(struct mv_info_fn *fn) {
+    struct mv_info_mvfn *best_mvfn = multiverse_match_mvfn(fn);
+    if (fn->tune != NULL) {
+        // Pinned, or the variant lost against the generic function
+        return multiverse_tune_mvfn(fn, best_mvfn);
+    }
+    return best_mvfn;
 }
 
 static int __multiverse_commit_fn(mv_transaction_ctx_t *ctx, struct mv_info_fn *fn) {
     int ret;
+
+    multiverse_info_fn_decode(fn);
     if (fn->n_mv_functions != -1) {
         // A normal multiverse function
-        struct mv_info_mvfn *best_mvfn = NULL;
-        int f;
-        for (f = 0; f < fn->n_mv_functions; f++) {
-            struct mv_info_mvfn * mvfn = &fn->mv_functions[f];
-            unsigned good = 1;
-            unsigned a;
-            for (a = 0; a < mvfn->n_assignments; a++) {
-                struct mv_info_assignment * assign = &mvfn->assignments[a];
-                // If the assignment of this mvfn depends on an unbound
-                // variable. The mvfn is unsuitable currently.
-                if (!assign->variable.info->flag_bound) {
-                    good = 0;
-                } else {
-                    // Variable is bound
-                    mv_value_t cur = multiverse_var_read(assign->variable.info);
-                    if (cur > assign->upper_bound || cur < assign->lower_bound)
-                        good = 0;
-                }
-            }
-            if (good) {
-                // Here we possibly override an already valid mvfn
-                best_mvfn = mvfn;
-            }
-        }
+        struct mv_info_mvfn *best_mvfn = multiverse_best_mvfn(fn);
         ret = multiverse_select_mvfn(ctx, fn, best_mvfn);
     } else {
         // A multiversed function pointer
@@ -154,6 +329,7 @@ static int __multiverse_commit_fn(mv_transaction_ctx_t *ctx, struct mv_info_fn *
             fn->mv_functions = multiverse_os_malloc(sizeof(struct mv_info_mvfn));
             fn->mv_functions->n_assignments = 0;
             fn->mv_functions->assignments = NULL;
+            fn->mv_functions->cached_body = NULL;
         }
         fn->mv_functions->function_body = new_body;
 
@@ -234,6 +410,69 @@ int multiverse_commit() {
     return ret;
 }
 
+/* Collects the union of the functions that reference one of the
+   variables. Every function is marked only once. */
+static unsigned char *
+multiverse_refs_mark(void **var_locations, unsigned int n) {
+    unsigned n_fns = __stop___multiverse_fn_ptr - __start___multiverse_fn_ptr;
+    unsigned char *marked;
+    unsigned i;
+
+    marked = multiverse_os_malloc(n_fns / 8 + 1);
+    if (!marked) return NULL;
+    memset(marked, 0, n_fns / 8 + 1);
+
+    for (i = 0; i < n; i++) {
+        struct mv_info_var *var = multiverse_info_var(var_locations[i]);
+        struct mv_info_fn_ref *fref;
+        if (!var) {
+            multiverse_os_free(marked);
+            return NULL;
+        }
+        for (fref = var->functions_head; fref != NULL; fref = fref->next) {
+            unsigned idx = fref->fn - __start___multiverse_fn_ptr;
+            marked[idx / 8] |= 1 << (idx % 8);
+        }
+    }
+    return marked;
+}
+
+static int
+multiverse_refs_many(void **var_locations, unsigned int n, int revert) {
+    int ret = 0;
+    unsigned char *marked = multiverse_refs_mark(var_locations, n);
+    mv_transaction_ctx_t ctx;
+    struct mv_info_fn *fn;
+
+    if (!marked) return -1;
+
+    ctx = mv_transaction_start();
+    for (fn = __start___multiverse_fn_ptr; fn < __stop___multiverse_fn_ptr; fn++) {
+        unsigned idx = fn - __start___multiverse_fn_ptr;
+        int r;
+        if (!(marked[idx / 8] & (1 << (idx % 8)))) continue;
+
+        if (revert) {
+            r = multiverse_select_mvfn(&ctx, fn, NULL);
+        } else {
+            r = __multiverse_commit_fn(&ctx, fn);
+        }
+        if (r < 0) {
+            ret = -1;
+            break;
+        }
+        ret += r;
+    }
+    mv_transaction_end(&ctx);
+
+    multiverse_os_free(marked);
+    return ret;
+}
+
+int multiverse_commit_refs_many(void **var_locations, unsigned int n) {
+    return multiverse_refs_many(var_locations, n, 0);
+}
+
 int multiverse_revert_info_fn(struct mv_info_fn *fn) {
     mv_transaction_ctx_t ctx = mv_transaction_start();
     int ret;
@@ -278,6 +517,11 @@ int multiverse_revert_refs(void *variable_location) {
 }
 
 
+int multiverse_revert_refs_many(void **var_locations, unsigned int n) {
+    return multiverse_refs_many(var_locations, n, 1);
+}
+
+
 int multiverse_revert() {
     int ret = 0;
     mv_transaction_ctx_t ctx = mv_transaction_start();
@@ -286,7 +530,7 @@ int multiverse_revert() {
     for (fn = __start___multiverse_fn_ptr; fn < __stop___multiverse_fn_ptr; fn++) {
         int r = multiverse_select_mvfn(&ctx, fn, NULL);
         if (r < 0) {
-            r = -1;
+            ret = -1;
             break;
         }
         ret += r;
@@ -307,8 +551,139 @@ int multiverse_bind(void *var_location, int state) {
     if (!var) return -1;
 
     if (state >= 0) {
-        if (!var->flag_tracked) return -1;
+        if (!var->flag_tracked || var->flag_frozen) return -1;
         var->flag_bound = (state != 0);
     }
     return var->flag_bound;
 }
+
+
+struct mv_variant_body {
+    char *body;
+    int   selected;
+};
+
+static void multiverse_sort_bodies(struct mv_variant_body *bodies, unsigned n) {
+    // Shellsort: We neither want to depend on qsort() nor on the
+    // kernel's sort().
+    unsigned gap, i, j;
+    for (gap = n / 2; gap > 0; gap /= 2) {
+        for (i = gap; i < n; i++) {
+            struct mv_variant_body tmp = bodies[i];
+            for (j = i; j >= gap && bodies[j - gap].body > tmp.body; j -= gap) {
+                bodies[j] = bodies[j - gap];
+            }
+            bodies[j] = tmp;
+        }
+    }
+}
+
+static void multiverse_discard_range(char *from, char *to) {
+    while (from < to) {
+        // Pages with a patchpoint were modified and must stay in memory.
+        char *pp_from = to, *pp_to = to;
+        struct mv_info_fn *fn;
+        for (fn = __start___multiverse_fn_ptr; fn < __stop___multiverse_fn_ptr; fn++) {
+            struct mv_patchpoint *pp;
+            for (pp = fn->patchpoints_head; pp != NULL; pp = pp->next) {
+                void *a, *b;
+                if (pp->type == PP_TYPE_INVALID || !pp->location) continue;
+                multiverse_arch_patchpoint_size(pp, &a, &b);
+                if ((char *)b > from && (char *)a < pp_from) {
+                    pp_from = a;
+                    pp_to = b;
+                }
+            }
+        }
+        if (pp_from == to) {
+            multiverse_os_discard(from, to);
+            break;
+        }
+        multiverse_os_discard(from, multiverse_os_addr_to_page(pp_from));
+        from = pp_to;
+    }
+}
+
+static void multiverse_discard_variants(void) {
+    struct mv_variant_body *bodies;
+    struct mv_info_fn *fn;
+    unsigned n = 0, i;
+
+    // Step 1: Collect all variant bodies that live in the variant section
+    for (fn = __start___multiverse_fn_ptr; fn < __stop___multiverse_fn_ptr; fn++) {
+        int f;
+        for (f = 0; f < fn->n_mv_functions; f++) {
+            char *body = fn->mv_functions[f].function_body;
+            if (body >= __start___multiverse_text_ptr
+                && body < __stop___multiverse_text_ptr)
+                n++;
+        }
+    }
+    if (n == 0) return;
+
+    bodies = multiverse_os_malloc(n * sizeof(struct mv_variant_body));
+    if (!bodies) return;
+
+    n = 0;
+    for (fn = __start___multiverse_fn_ptr; fn < __stop___multiverse_fn_ptr; fn++) {
+        int f;
+        for (f = 0; f < fn->n_mv_functions; f++) {
+            char *body = fn->mv_functions[f].function_body;
+            if (body >= __start___multiverse_text_ptr
+                && body < __stop___multiverse_text_ptr) {
+                bodies[n].body = body;
+                bodies[n].selected = 0;
+                n++;
+            }
+        }
+    }
+    multiverse_sort_bodies(bodies, n);
+
+    // Step 2: Mark the selected bodies. Several descriptors can share
+    // a single body.
+    for (fn = __start___multiverse_fn_ptr; fn < __stop___multiverse_fn_ptr; fn++) {
+        unsigned lo = 0, hi = n;
+        char *body;
+        if (fn->n_mv_functions == -1 || !fn->active_mvfn) continue;
+        body = fn->active_mvfn->function_body;
+        while (lo < hi) {
+            unsigned mid = lo + (hi - lo) / 2;
+            if (bodies[mid].body < body) lo = mid + 1;
+            else hi = mid;
+        }
+        for (; lo < n && bodies[lo].body == body; lo++) {
+            bodies[lo].selected = 1;
+        }
+    }
+
+    // Step 3: A body reaches up to the next body in the section. Drop
+    // every run of unselected bodies.
+    i = 0;
+    while (i < n) {
+        char *from;
+        if (bodies[i].selected) {
+            i++;
+            continue;
+        }
+        from = bodies[i].body;
+        while (i < n && !bodies[i].selected) i++;
+        multiverse_discard_range(from, (i < n) ? bodies[i].body
+                                               : __stop___multiverse_text_ptr);
+    }
+
+    multiverse_os_free(bodies);
+}
+
+int multiverse_seal(void) {
+    struct mv_info_var *var;
+    int ret = multiverse_commit();
+    if (ret < 0) return ret;
+
+    for (var = __start___multiverse_var_ptr; var < __stop___multiverse_var_ptr; var++) {
+        var->flag_frozen = 1;
+    }
+
+    multiverse_discard_variants();
+
+    return ret;
+}
@@ -1,6 +1,9 @@
 #ifndef __MULTIVERSE_COMMIT_H
 #define __MULTIVERSE_COMMIT_H
 
+#include "multiverse.h"
+#include "platform.h"
+
 typedef enum  {
     PP_TYPE_INVALID,
     PP_TYPE_X86_CALL,
@@ -15,8 +18,135 @@ struct mv_patchpoint {
     mv_info_patchpoint_type type;
 
     // Here we swap in the code, we overwrite
-    unsigned char swapspace[6];
+    unsigned char swapspace[MV_PATCHPOINT_SIZE];
+
+    // The mvfn that is installed at the patchpoint, NULL for the
+    // original code
+    struct mv_info_mvfn *applied;
 };
 
 
+/* A transaction collects the unprotected text pages. At the end of
+   the transaction, they are protected again. */
+typedef struct {
+    unsigned int cache_size;
+    void        *unprotected[10];
+    unsigned long long start_ns;
+} mv_transaction_ctx_t;
+
+/* The statistics of the run-time system (see multiverse_get_stats) */
+extern struct mv_stats *multiverse_stats;
+
+/* The statistics also serialize the transactions with a private lock:
+   begin waits for the running transaction, try_begin returns -1
+   instead */
+void multiverse_stats_begin(mv_transaction_ctx_t *ctx);
+int multiverse_stats_try_begin(mv_transaction_ctx_t *ctx);
+void multiverse_stats_end(mv_transaction_ctx_t *ctx);
+
+/* Prefaults the new mvfn and marks the warm-up stub of the function,
+   if enabled (see multiverse_set_warmup) */
+void multiverse_warmup_select(struct mv_info_fn *fn, struct mv_info_mvfn *mvfn);
+
+/* Calls the marked warm-up stubs */
+void multiverse_warmup_run(void);
+
+/* The warm-up stub of a function, or NULL */
+void (*multiverse_warmup_stub(struct mv_info_fn *fn))(void);
+
+/* Counts the transactions, see multiverse_var_policy */
+extern unsigned int multiverse_transaction_count;
+
+static inline mv_transaction_ctx_t mv_transaction_start(void) {
+    mv_transaction_ctx_t ctx = { .cache_size = 10 };
+    multiverse_stats_begin(&ctx);
+    return ctx;
+}
+
+/* Starts a transaction, unless another one is running. Returns -1
+   in that case. */
+static inline int mv_transaction_try_start(mv_transaction_ctx_t *ctx) {
+    mv_transaction_ctx_t init = { .cache_size = 10 };
+    *ctx = init;
+    return multiverse_stats_try_begin(ctx);
+}
+
+static inline void mv_transaction_end(mv_transaction_ctx_t *ctx) {
+    unsigned i = 0;
+    for (i = 0; i < ctx->cache_size; i++) {
+        if (ctx->unprotected[i] != NULL) {
+            multiverse_os_protect(ctx->unprotected[i]);
+            multiverse_stats->mprotect_calls++;
+        }
+    }
+    multiverse_os_clear_caches();
+    multiverse_stats_end(ctx);
+    // The stubs may commit themselves
+    multiverse_warmup_run();
+}
+
+void multiverse_transaction_unprotect(mv_transaction_ctx_t *ctx, void *addr);
+
+
+/* The address that is called for a mvfn. This is the copy in the code
+   cache, if there is one. */
+static inline void *multiverse_mvfn_body(struct mv_info_mvfn *mvfn) {
+    return mvfn->cached_body ? mvfn->cached_body : mvfn->function_body;
+}
+
+/* Decodes the patchpoints and mvfn bodies of a function, if this
+   was not done before (see multiverse_init_lazy) */
+void multiverse_info_fn_decode(struct mv_info_fn *fn);
+
+/* Returns the end of a variant body in the variant section, or NULL if
+   the body does not reside within that section. */
+void *multiverse_info_body_end(void *body);
+
+/* Selects the best fitting mvfn of a (non function pointer) function
+   according to the current variable values, the pin, and the tuning
+   results of the function. */
+struct mv_info_mvfn *multiverse_best_mvfn(struct mv_info_fn *fn);
+
+/* Selects the mvfn only according to the current variable values */
+struct mv_info_mvfn *multiverse_match_mvfn(struct mv_info_fn *fn);
+
+/* Applies the pin and the tuning results to the matching mvfn (see
+   multiverse_tune_fn) */
+struct mv_info_mvfn *multiverse_tune_mvfn(struct mv_info_fn *fn,
+                                          struct mv_info_mvfn *mvfn);
+
+/* Reads the current value of a multiverse variable (0 or 1 for
+   pointer variables) */
+mv_value_t multiverse_var_read(struct mv_info_var *var);
+
+/* Writes a multiverse variable with its width */
+void multiverse_var_write(struct mv_info_var *var, mv_value_t value);
+
+/* Values of signed variables are sign extended from their width */
+long long multiverse_var_extend(struct mv_info_var *var, mv_value_t value);
+
+/* Returns 1, if the value of a variable lies within the bounds of an
+   assignment, or matches its bit pattern (flag_bits) */
+int multiverse_var_match(struct mv_info_var *var,
+                         struct mv_info_assignment *assign, mv_value_t value);
+
+/* A function is frozen, if one of its variables was frozen by
+   multiverse_seal() */
+int multiverse_fn_frozen(struct mv_info_fn *fn);
+
+/* Returns the pseudo mvfn that directs the generic entry of a
+   function to its lazy fixup stub, or NULL if there is no stub */
+struct mv_info_mvfn *
+multiverse_lazy_entry(mv_transaction_ctx_t *ctx, struct mv_info_fn *fn);
+
+/* Called by the lazy fixup stub: patches the callsite that returns
+   to return_address and returns the body of the selected mvfn */
+void *multiverse_lazy_fixup(struct mv_info_fn *fn, void *return_address);
+
+/* Copies the mvfn into the code cache (if enabled and possible) */
+void multiverse_code_cache_insert(mv_transaction_ctx_t *ctx,
+                                  struct mv_info_fn *fn,
+                                  struct mv_info_mvfn *mvfn);
+
+
 #endif
@@ -0,0 +1,255 @@
+#include "mv_assert.h"
+#include "mv_string.h"
+#include "multiverse.h"
+#include "mv_commit.h"
+#include "platform.h"
+#include "mv_buf.h"
+
+
+#define CONTROL_MAX_LINE 256
+#define CONTROL_MAX_ARGS 4
+
+static const char control_help[] =
+    "functions                  list functions and their active variants\n"
+    "variables                  list variables and their values\n"
+    "set <var> <value>          write a variable (without commit)\n"
+    "bind <var> 0|1             change the binding state of a tracked variable\n"
+    "commit [fn|var <name>]     commit everything, a function, or a variable\n"
+    "revert [fn|var <name>]     revert everything, a function, or a variable\n"
+    "stats                      print the statistics\n"
+    "dump                       print the state as JSON\n";
+
+
+/* Splits the line at blanks; returns the number of arguments, or -1
+   if there are too many */
+static int control_split(char *line, char **argv) {
+    int argc = 0;
+
+    while (*line) {
+        while (*line == ' ' || *line == '\t' || *line == '\r' || *line == '\n')
+            *line++ = 0;
+        if (!*line) break;
+        if (argc == CONTROL_MAX_ARGS) return -1;
+        argv[argc++] = line;
+        while (*line && *line != ' ' && *line != '\t'
+               && *line != '\r' && *line != '\n')
+            line++;
+    }
+    return argc;
+}
+
+/* Parses a decimal or 0x-prefixed hexadecimal number with optional sign */
+static int control_number(const char *s, long long *value) {
+    unsigned long long result = 0;
+    unsigned base = 10;
+    int negative = 0;
+
+    if (*s == '-') {
+        negative = 1;
+        s++;
+    }
+    if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+        base = 16;
+        s += 2;
+    }
+    if (!*s) return -1;
+    for (; *s; s++) {
+        unsigned digit;
+        if (*s >= '0' && *s <= '9') digit = *s - '0';
+        else if (base == 16 && *s >= 'a' && *s <= 'f') digit = *s - 'a' + 10;
+        else if (base == 16 && *s >= 'A' && *s <= 'F') digit = *s - 'A' + 10;
+        else return -1;
+        if (result > (~0ULL >> 5)) return -1;
+        result = result * base + digit;
+    }
+    *value = negative ? -(long long)result : (long long)result;
+    return 0;
+}
+
+static void control_flag(struct mv_buf *b, const char *key, int value) {
+    mv_buf_puts(b, " ");
+    mv_buf_puts(b, key);
+    mv_buf_puts(b, value ? "=1" : "=0");
+}
+
+static void control_functions(struct mv_buf *b) {
+    struct mv_info_fn *fn = NULL;
+
+    while ((fn = multiverse_next_fn(fn)) != NULL) {
+        mv_buf_puts(b, fn->name);
+        mv_buf_puts(b, " active=");
+        if (fn->active_mvfn)
+            mv_buf_hex(b, (uintptr_t) fn->active_mvfn->function_body);
+        else
+            mv_buf_puts(b, "generic");
+        if (fn->n_mv_functions == -1) {
+            mv_buf_puts(b, " variants=pointer");
+        } else {
+            mv_buf_puts(b, " variants=");
+            mv_buf_int(b, fn->n_mv_functions);
+        }
+        mv_buf_puts(b, " hits=");
+        if (fn->hits)
+            mv_buf_int(b, *fn->hits);
+        else
+            mv_buf_puts(b, "-");
+        control_flag(b, "frozen", multiverse_fn_frozen(fn));
+        mv_buf_puts(b, "\n");
+    }
+}
+
+static void control_variables(struct mv_buf *b) {
+    struct mv_info_var *var = NULL;
+
+    while ((var = multiverse_next_var(var)) != NULL) {
+        mv_buf_puts(b, var->name);
+        mv_buf_puts(b, " value=");
+        mv_buf_int(b, multiverse_var_extend(var, multiverse_var_read(var)));
+        mv_buf_puts(b, " width=");
+        mv_buf_int(b, var->variable_width);
+        control_flag(b, "tracked", var->flag_tracked);
+        control_flag(b, "pointer", var->flag_pointer);
+        control_flag(b, "bound", var->flag_bound);
+        control_flag(b, "frozen", var->flag_frozen);
+        mv_buf_puts(b, "\n");
+    }
+}
+
+static void control_stat(struct mv_buf *b, const char *key, unsigned long long value) {
+    mv_buf_puts(b, key);
+    mv_buf_puts(b, "=");
+    mv_buf_int(b, value);
+    mv_buf_puts(b, "\n");
+}
+
+static void control_stats(struct mv_buf *b) {
+    struct mv_stats stats;
+
+    multiverse_get_stats(&stats);
+    control_stat(b, "transactions", stats.transactions);
+    control_stat(b, "functions_changed", stats.functions_changed);
+    control_stat(b, "patchpoints_written", stats.patchpoints_written);
+    control_stat(b, "pages_unprotected", stats.pages_unprotected);
+    control_stat(b, "mprotect_calls", stats.mprotect_calls);
+    control_stat(b, "latency_ns_total", stats.latency_ns_total);
+    control_stat(b, "latency_ns_max", stats.latency_ns_max);
+    control_stat(b, "descriptor_bytes", stats.descriptor_bytes);
+    control_stat(b, "patchpoint_bytes", stats.patchpoint_bytes);
+    control_stat(b, "ref_bytes", stats.ref_bytes);
+    control_stat(b, "variant_text_bytes", stats.variant_text_bytes);
+}
+
+static const char *control_set(struct mv_info_var *var, const char *arg) {
+    unsigned bits = var->variable_width * 8;
+    long long value;
+
+    if (var->flag_pointer) return "pointer variables cannot be set";
+    if (control_number(arg, &value) < 0) return "invalid value";
+    // Accept the signed and the unsigned range of the width
+    if (bits < 64 && (value < -(1LL << (bits - 1)) || value > (long long)((1ULL << bits) - 1)))
+        return "value out of range";
+    multiverse_var_write(var, (mv_value_t) value);
+    return NULL;
+}
+
+/* Commit or revert everything, a function, or the references of a variable */
+static const char *control_transaction(struct mv_buf *b, int revert,
+                                       int argc, char **argv) {
+    int ret;
+
+    if (argc == 1) {
+        ret = revert ? multiverse_revert() : multiverse_commit();
+    } else if (argc == 3 && strcmp(argv[1], "fn") == 0) {
+        struct mv_info_fn *fn = multiverse_info_fn_by_name(argv[2]);
+        if (!fn) return "unknown function";
+        ret = revert ? multiverse_revert_info_fn(fn) : multiverse_commit_info_fn(fn);
+    } else if (argc == 3 && strcmp(argv[1], "var") == 0) {
+        struct mv_info_var *var = multiverse_info_var_by_name(argv[2]);
+        if (!var) return "unknown variable";
+        ret = revert ? multiverse_revert_info_refs(var) : multiverse_commit_info_refs(var);
+    } else {
+        return "usage: commit|revert [fn|var <name>]";
+    }
+    if (ret < 0) return "failed";
+
+    mv_buf_puts(b, "changed=");
+    mv_buf_int(b, ret);
+    mv_buf_puts(b, "\n");
+    return NULL;
+}
+
+static const char *control_command(struct mv_buf *b, int argc, char **argv) {
+    struct mv_info_var *var;
+
+    if (argc == 0) return "empty command";
+
+    if (strcmp(argv[0], "help") == 0 && argc == 1) {
+        mv_buf_puts(b, control_help);
+    } else if (strcmp(argv[0], "functions") == 0 && argc == 1) {
+        control_functions(b);
+    } else if (strcmp(argv[0], "variables") == 0 && argc == 1) {
+        control_variables(b);
+    } else if (strcmp(argv[0], "stats") == 0 && argc == 1) {
+        control_stats(b);
+    } else if (strcmp(argv[0], "dump") == 0 && argc == 1) {
+        struct mv_buf rest = { .buf = b->buf ? b->buf + b->len : NULL,
+                               .size = b->len < b->size ? b->size - b->len : 0 };
+        b->len += multiverse_dump_json(rest.buf, rest.size);
+    } else if (strcmp(argv[0], "set") == 0 && argc == 3) {
+        var = multiverse_info_var_by_name(argv[1]);
+        if (!var) return "unknown variable";
+        return control_set(var, argv[2]);
+    } else if (strcmp(argv[0], "bind") == 0 && argc == 3) {
+        long long state;
+        var = multiverse_info_var_by_name(argv[1]);
+        if (!var) return "unknown variable";
+        if (control_number(argv[2], &state) < 0 || (state != 0 && state != 1))
+            return "usage: bind <var> 0|1";
+        if (multiverse_bind(var->variable_location, state) < 0)
+            return "variable is not tracked or frozen";
+    } else if (strcmp(argv[0], "commit") == 0) {
+        return control_transaction(b, 0, argc, argv);
+    } else if (strcmp(argv[0], "revert") == 0) {
+        return control_transaction(b, 1, argc, argv);
+    } else {
+        return "unknown command, try help";
+    }
+    return NULL;
+}
+
+
+unsigned long multiverse_control_exec(const char *command, char *reply,
+                                      unsigned long size) {
+    struct mv_buf b = { .buf = reply, .size = size, .len = 0 };
+    char line[CONTROL_MAX_LINE];
+    char *argv[CONTROL_MAX_ARGS];
+    const char *error;
+    int argc;
+
+    if (strlen(command) >= sizeof(line)) {
+        error = "command too long";
+    } else {
+        strcpy(line, command);
+        argc = control_split(line, argv);
+        error = argc < 0 ? "too many arguments" : control_command(&b, argc, argv);
+    }
+
+    if (error) {
+        // Drop partial output of the failed command
+        b.len = 0;
+        mv_buf_puts(&b, "error ");
+        mv_buf_puts(&b, error);
+        mv_buf_puts(&b, "\n");
+    } else {
+        mv_buf_puts(&b, "ok\n");
+    }
+    return mv_buf_finish(&b);
+}
+
+int multiverse_control_start(const char *path) {
+    return multiverse_os_control_start(path, multiverse_control_exec);
+}
+
+void multiverse_control_stop(void) {
+    multiverse_os_control_stop();
+}
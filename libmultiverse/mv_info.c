@@ -1,4 +1,5 @@
 #include "mv_assert.h"
+#include "mv_string.h"
 #include "platform.h"
 #include "multiverse.h"
 #include "mv_commit.h"
@@ -14,6 +15,9 @@ extern struct mv_info_fn __attribute__((weak)) __stop___multiverse_fn_;
 extern struct mv_info_callsite __attribute__((weak)) __start___multiverse_callsite_;
 extern struct mv_info_callsite __attribute__((weak)) __stop___multiverse_callsite_;
 
+extern char __attribute__((weak)) __start___multiverse_text_;
+extern char __attribute__((weak)) __stop___multiverse_text_;
+
 
 struct mv_info_var *__start___multiverse_var_ptr = &__start___multiverse_var_;
 struct mv_info_var *__stop___multiverse_var_ptr = &__stop___multiverse_var_;
@@ -24,6 +28,10 @@ struct mv_info_fn *__stop___multiverse_fn_ptr = &__stop___multiverse_fn_;
 struct mv_info_callsite *__start___multiverse_callsite_ptr = &__start___multiverse_callsite_;
 struct mv_info_callsite *__stop___multiverse_callsite_ptr = &__stop___multiverse_callsite_;
 
+// The variant function bodies (see multiverse_seal)
+char *__start___multiverse_text_ptr = &__start___multiverse_text_;
+char *__stop___multiverse_text_ptr = &__stop___multiverse_text_;
+
 
 struct mv_info_var *
 multiverse_info_var(void  *variable_location) {
@@ -43,6 +51,41 @@ multiverse_info_fn(void  *function_body) {
     return NULL;
 }
 
+struct mv_info_var *multiverse_info_var_by_name(const char *name) {
+    struct mv_info_var *var;
+    for (var = __start___multiverse_var_ptr; var < __stop___multiverse_var_ptr; var++) {
+        if (var->name && strcmp(var->name, name) == 0) return var;
+    }
+    return NULL;
+}
+
+struct mv_info_fn *multiverse_info_fn_by_name(const char *name) {
+    struct mv_info_fn *fn;
+    for (fn = __start___multiverse_fn_ptr; fn < __stop___multiverse_fn_ptr; fn++) {
+        if (fn->name && strcmp(fn->name, name) == 0) return fn;
+    }
+    return NULL;
+}
+
+void *multiverse_info_body_end(void *body) {
+    struct mv_info_fn *fn;
+    char *end = __stop___multiverse_text_ptr;
+
+    if ((char *)body < __start___multiverse_text_ptr || (char *)body >= end)
+        return NULL;
+
+    // The body reaches up to the next variant body in the section
+    for (fn = __start___multiverse_fn_ptr; fn < __stop___multiverse_fn_ptr; fn++) {
+        int f;
+        for (f = 0; f < fn->n_mv_functions; f++) {
+            char *other = fn->mv_functions[f].function_body;
+            if (other > (char *)body && other < end)
+                end = other;
+        }
+    }
+    return end;
+}
+
 static
 int mv_info_fn_patchpoint_append(struct mv_info_fn *fn, struct mv_patchpoint pp){
     struct mv_patchpoint **p = &fn->patchpoints_head;
@@ -56,6 +99,7 @@ int mv_info_fn_patchpoint_append(struct mv_info_fn *fn, struct mv_patchpoint pp)
 
     **p = pp;
     (*p)->next = NULL;
+    (*p)->applied = NULL;
 
     return 0;
 }
@@ -77,113 +121,231 @@ int mv_info_var_fn_append(struct mv_info_var *var, struct mv_info_fn *fn) {
     return 0;
 }
 
-int multiverse_init() {
-    struct mv_info_fn *fn;
-    struct mv_info_callsite *callsite;
+/* Connects the assignments of all mvfns to their variables, and the
+   variables to the function. */
+static int mv_info_fn_link(struct mv_info_fn *fn) {
+    int k;
 
-    // Step 2: Connect all the moving parts from all compilation units
-    //         and fill the runtime data.
-    for (fn = __start___multiverse_fn_ptr; fn < __stop___multiverse_fn_ptr; fn++) {
-        int k;
+    for (k = 0; k < fn->n_mv_functions; k++) {
+        unsigned x;
+        struct mv_info_mvfn * mvfn = &fn->mv_functions[k];
 
-        // First we install a patchpoint for the beginning of our function body
-        struct mv_patchpoint pp;
-        multiverse_arch_decode_function(fn, &pp);
-        if (pp.type == PP_TYPE_INVALID) continue;
+        for (x = 0; x < mvfn->n_assignments; x++) {
+            int found;
+            struct mv_info_fn_ref *fref;
 
-        if (fn->n_mv_functions != -1) {
-            // Only append "self" patchpoint if fn describes a function and
-            // not a function pointer
-            mv_info_fn_patchpoint_append(fn, pp);
-        }
+            // IMPORTANT: Setup variable pointer
+            struct mv_info_assignment *assign = &mvfn->assignments[x];
+            struct mv_info_var* fvar = multiverse_info_var(assign->variable.location);
 
-        for (k = 0; k < fn->n_mv_functions; k++) {
-            unsigned x;
+            MV_ASSERT(fvar != NULL);
+            assign->variable.info = fvar;
 
-            struct mv_info_mvfn * mvfn = &fn->mv_functions[k];
-            // Let's see if we can extract further information
-            // for our multiverse function, like: constant return value.
-            multiverse_arch_decode_mvfn_body(mvfn);
+            MV_ASSERT(fvar->flag_bits
+                      || assign->lower_bound <= assign->upper_bound);
 
-            for (x = 0; x < mvfn->n_assignments; x++) {
-                int found;
-                struct mv_info_fn_ref *fref;
+            // Add function to list of associated functions of variable
+            // if not yet present.
+            found = 0;
+            for (fref = fvar->functions_head; fref != NULL; fref = fref->next) {
+                if (fref->fn == fn) {
+                    found = 1;
+                    break;
+                }
+            }
+            if (!found) {
+                int ret = mv_info_var_fn_append(fvar, fn);
+                if (ret != 0) return ret;
+            }
+        }
+    }
+    return 0;
+}
 
-                // IMPORTANT: Setup variable pointer
-                struct mv_info_assignment *assign = &mvfn->assignments[x];
-                struct mv_info_var* fvar = multiverse_info_var(assign->variable.location);
+static void mv_info_sort_callsites(void) {
+    // Shellsort by the called function, see multiverse_sort_bodies()
+    struct mv_info_callsite *cs = __start___multiverse_callsite_ptr;
+    unsigned n = __stop___multiverse_callsite_ptr - __start___multiverse_callsite_ptr;
+    unsigned gap, i, j;
+    for (gap = n / 2; gap > 0; gap /= 2) {
+        for (i = gap; i < n; i++) {
+            struct mv_info_callsite tmp = cs[i];
+            for (j = i; j >= gap
+                     && (char *)cs[j - gap].function_body > (char *)tmp.function_body;
+                 j -= gap) {
+                cs[j] = cs[j - gap];
+            }
+            cs[j] = tmp;
+        }
+    }
+}
+
+void multiverse_info_fn_decode(struct mv_info_fn *fn) {
+    struct mv_info_callsite *callsite;
+    struct mv_patchpoint pp;
+    unsigned lo, hi;
+    int k;
 
-                MV_ASSERT(fvar != NULL);
-                assign->variable.info = fvar;
+    if (fn->decoded) return;
+    fn->decoded = 1;
 
-                MV_ASSERT(assign->lower_bound <= assign->upper_bound);
+    // First we install a patchpoint for the beginning of our function body
+    multiverse_arch_decode_function(fn, &pp);
+    if (pp.type == PP_TYPE_INVALID) return;
 
-                // Add function to list of associated functions of variable
-                // if not yet present.
-                found = 0;
-                for (fref = fvar->functions_head; fref != NULL; fref = fref->next) {
-                    if (fref->fn == fn) {
-                        found = 1;
-                        break;
-                    }
-                }
-                if (!found) {
-                    int ret = mv_info_var_fn_append(fvar, fn);
-                    if (ret != 0) return ret;
-                }
-            }
-        }
+    if (fn->n_mv_functions != -1) {
+        // Only append "self" patchpoint if fn describes a function and
+        // not a function pointer
+        mv_info_fn_patchpoint_append(fn, pp);
     }
 
-    for (callsite = __start___multiverse_callsite_ptr;
-         callsite < __stop___multiverse_callsite_ptr; callsite++) {
-        struct mv_patchpoint pp;
-        struct mv_info_fn *cfn = multiverse_info_fn(callsite->function_body);
+    for (k = 0; k < fn->n_mv_functions; k++) {
+        // Let's see if we can extract further information
+        // for our multiverse function, like: constant return value.
+        multiverse_arch_decode_mvfn_body(&fn->mv_functions[k]);
+    }
 
-        /* Function was not found. Perhaps there are no multiverses? */
-        if (cfn == NULL) continue;
+    // The callsites are sorted by the called function
+    lo = 0;
+    hi = __stop___multiverse_callsite_ptr - __start___multiverse_callsite_ptr;
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        if ((char *)__start___multiverse_callsite_ptr[mid].function_body
+            < (char *)fn->function_body)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
 
+    for (callsite = __start___multiverse_callsite_ptr + lo;
+         callsite < __stop___multiverse_callsite_ptr
+             && callsite->function_body == fn->function_body;
+         callsite++) {
         // Try to find a patchpoint at the callsite offset
-        multiverse_arch_decode_callsite(cfn, callsite->call_label, &pp);
+        multiverse_arch_decode_callsite(fn, callsite->call_label, &pp);
         if (pp.type != PP_TYPE_INVALID) {
-            pp.function = cfn;
-            mv_info_fn_patchpoint_append(cfn, pp);
+            pp.function = fn;
+            mv_info_fn_patchpoint_append(fn, pp);
         } else {
             char *p = callsite->call_label;
             multiverse_os_print("Could not decode callsite at %p for %s [%x, %x, %x, %x, %x]\n",
-                                p, cfn->name, p[0], p[1], p[2], p[3], p[4]);
+                                p, fn->name, p[0], p[1], p[2], p[3], p[4]);
         }
     }
-    return 0;
 }
 
-void multiverse_dump_info(void) {
-    /* struct mv_info_var *var; */
+int multiverse_init_lazy() {
     struct mv_info_fn *fn;
 
-    /* TODO */
-    /* multiverse_os_print("mv_info %p, version: %d", info, info->version); */
-    /* multiverse_os_print(", %d functions multiversed\n", info->n_functions); */
+    // Step 2: Connect all the moving parts from all compilation units
+    //         and fill the runtime data. Callsites that call no
+    //         multiverse function are never looked at.
+    mv_info_sort_callsites();
+    for (fn = __start___multiverse_fn_ptr; fn < __stop___multiverse_fn_ptr; fn++) {
+        int ret = mv_info_fn_link(fn);
+        if (ret != 0) return ret;
+    }
+    return 0;
+}
+
+int multiverse_init() {
+    struct mv_info_fn *fn;
+    int ret = multiverse_init_lazy();
+    if (ret != 0) return ret;
 
     for (fn = __start___multiverse_fn_ptr; fn < __stop___multiverse_fn_ptr; fn++) {
+        multiverse_info_fn_decode(fn);
+    }
+    return 0;
+}
+
+struct mv_info_fn *multiverse_next_fn(struct mv_info_fn *fn) {
+    fn = fn ? fn + 1 : __start___multiverse_fn_ptr;
+    return fn < __stop___multiverse_fn_ptr ? fn : NULL;
+}
+
+struct mv_info_var *multiverse_next_var(struct mv_info_var *var) {
+    var = var ? var + 1 : __start___multiverse_var_ptr;
+    return var < __stop___multiverse_var_ptr ? var : NULL;
+}
+
+struct mv_patchpoint *multiverse_next_patchpoint(struct mv_info_fn *fn,
+                                                 struct mv_patchpoint *pp) {
+    pp = pp ? pp->next : fn->patchpoints_head;
+    while (pp != NULL && (pp->type == PP_TYPE_INVALID || !pp->location))
+        pp = pp->next;
+    return pp;
+}
+
+int multiverse_patchpoint_info(struct mv_patchpoint *pp,
+                               struct mv_patchpoint_info *info) {
+    if (!pp || pp->type == PP_TYPE_INVALID) return -1;
+
+    info->location = pp->location;
+    switch (pp->type) {
+    case PP_TYPE_X86_CALL:          info->type = "call"; break;
+    case PP_TYPE_X86_CALL_INDIRECT: info->type = "call_indirect"; break;
+    case PP_TYPE_X86_JUMP:          info->type = "jump"; break;
+    default:                        info->type = "unknown"; break;
+    }
+    info->is_entry = pp->location == pp->function->function_body;
+    info->target = pp->applied ? multiverse_mvfn_body(pp->applied) : NULL;
+    return 0;
+}
+
+long multiverse_fn_hits(void *function_body) {
+    struct mv_info_fn *fn = multiverse_info_fn(function_body);
+    if (!fn || !fn->hits) return -1;
+    return *fn->hits;
+}
+
+const char *multiverse_mvfn_type_name(int type) {
+    switch (type) {
+    case MVFN_TYPE_NONE:     return "none";
+    case MVFN_TYPE_NOP:      return "nop";
+    case MVFN_TYPE_CONSTANT: return "constant";
+    case MVFN_TYPE_CLI:      return "cli";
+    case MVFN_TYPE_STI:      return "sti";
+    }
+    return "unknown";
+}
+
+
+void multiverse_dump_info(void) {
+    struct mv_info_var *var = NULL;
+    struct mv_info_fn *fn = NULL;
+
+    while ((fn = multiverse_next_fn(fn)) != NULL) {
+        struct mv_patchpoint *pp = NULL;
         int k;
-        multiverse_os_print("  fn: %s %p, %d variants\n", /*", %d patchpoints(s)\n",*/
+        multiverse_os_print("  fn: %s %p, %d variants",
                             fn->name,
                             fn->function_body,
-                            fn->n_mv_functions
-                            /*fn->extra->n_patchpoints*/);
+                            fn->n_mv_functions);
+        if (fn->hits) {
+            multiverse_os_print(", %lu generic calls", *fn->hits);
+        }
+        multiverse_os_print("\n");
         for (k = 0; k < fn->n_mv_functions; k++) {
             unsigned x;
             struct mv_info_mvfn * mvfn = &fn->mv_functions[k];
             // Execute function mv_func();
-            multiverse_os_print("    mvfn: %p (vars %d)",
-                                mvfn->function_body, mvfn->n_assignments);
+            multiverse_os_print("    mvfn: %p (vars %d, %s)",
+                                mvfn->function_body, mvfn->n_assignments,
+                                multiverse_mvfn_type_name(mvfn->type));
             if (fn->active_mvfn == mvfn) {
                 multiverse_os_print("<-- active");
             }
             multiverse_os_print("\n");
             for (x = 0; x < mvfn->n_assignments; x++) {
                 struct mv_info_assignment *assign = &mvfn->assignments[x];
+                if (assign->variable.info->flag_bits) {
+                    multiverse_os_print("      assign: %s & %#x == %#x\n",
+                                        assign->variable.info->name,
+                                        assign->lower_bound,
+                                        assign->upper_bound);
+                    continue;
+                }
                 multiverse_os_print("      assign: %s in [%d, %d]\n",
                                     assign->variable.info->name,
                                     assign->lower_bound,
@@ -191,24 +353,26 @@ void multiverse_dump_info(void) {
             }
 
         }
-        /* for (j = 0; j < fn->extra->n_patchpoints; ++j) { */
-        /*     struct mv_patchpoint *fvar = &fn->extra->patchpoints[j]; */
-        /*     multiverse_os_print("    patchpoint: [%d:%p] -> %s\n", */
-        /*                         fvar->type, */
-        /*                         fvar->location, */
-        /*                         fvar->function->name); */
-        /* } */
-    }
-
-    /* TDOD */
-    /* multiverse_os_print("%d variables were multiversed\n", info->n_variables); */
-    /* for (var = __start___multiverse_var_ptr; var < __stop___multiverse_var_ptr; var++) { */
-    /*     multiverse_os_print("  var: %s %p (width %d, tracked:%d, signed:%d), %d functions\n", */
-    /*                         var->name, */
-    /*                         var->variable_location, */
-    /*                         var->variable_width, */
-    /*                         var->flag_tracked, */
-    /*                         var->flag_signed, */
-    /*                         var->n_functions); */
-    /* } */
+        while ((pp = multiverse_next_patchpoint(fn, pp)) != NULL) {
+            struct mv_patchpoint_info info;
+            multiverse_patchpoint_info(pp, &info);
+            multiverse_os_print("    patchpoint: [%s:%p] -> %p\n",
+                                info.type, info.location, info.target);
+        }
+    }
+
+    while ((var = multiverse_next_var(var)) != NULL) {
+        struct mv_info_fn_ref *fref;
+        int n_functions = 0;
+        for (fref = var->functions_head; fref != NULL; fref = fref->next)
+            n_functions++;
+        multiverse_os_print("  var: %s %p (width %d, tracked:%d, signed:%d, pointer:%d), %d functions\n",
+                            var->name,
+                            var->variable_location,
+                            var->variable_width,
+                            var->flag_tracked,
+                            var->flag_signed,
+                            var->flag_pointer,
+                            n_functions);
+    }
 }
@@ -0,0 +1,226 @@
+#include "mv_assert.h"
+#include "mv_string.h"
+#include "multiverse.h"
+#include "mv_commit.h"
+#include "platform.h"
+#include "mv_buf.h"
+
+
+static void json_string(struct mv_buf *j, const char *s) {
+    static const char hex[] = "0123456789abcdef";
+
+    if (!s) {
+        mv_buf_puts(j, "null");
+        return;
+    }
+    mv_buf_puts(j, "\"");
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            char esc[2] = {'\\', c};
+            mv_buf_put(j, esc, 2);
+        } else if (c < 0x20) {
+            char esc[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+            mv_buf_put(j, esc, 6);
+        } else {
+            mv_buf_put(j, (const char *)&c, 1);
+        }
+    }
+    mv_buf_puts(j, "\"");
+}
+
+/* Addresses are strings, as JSON numbers cannot hold 64 bits */
+static void json_pointer(struct mv_buf *j, void *p) {
+    if (!p) {
+        mv_buf_puts(j, "null");
+        return;
+    }
+    mv_buf_puts(j, "\"");
+    mv_buf_hex(j, (uintptr_t) p);
+    mv_buf_puts(j, "\"");
+}
+
+static void json_bool(struct mv_buf *j, int value) {
+    mv_buf_puts(j, value ? "true" : "false");
+}
+
+static void json_key(struct mv_buf *j, const char *key) {
+    json_string(j, key);
+    mv_buf_puts(j, ":");
+}
+
+static void json_mvfn(struct mv_buf *j, struct mv_info_fn *fn,
+                      struct mv_info_mvfn *mvfn) {
+    unsigned a;
+
+    mv_buf_puts(j, "{");
+    json_key(j, "body");
+    json_pointer(j, mvfn->function_body);
+    mv_buf_puts(j, ",");
+    json_key(j, "type");
+    json_string(j, multiverse_mvfn_type_name(mvfn->type));
+    if (mvfn->type == MVFN_TYPE_CONSTANT) {
+        mv_buf_puts(j, ",");
+        json_key(j, "constant");
+        mv_buf_int(j, mvfn->constant);
+    }
+    mv_buf_puts(j, ",");
+    json_key(j, "cached_body");
+    json_pointer(j, mvfn->cached_body);
+    mv_buf_puts(j, ",");
+    json_key(j, "active");
+    json_bool(j, fn->active_mvfn == mvfn);
+    mv_buf_puts(j, ",");
+    json_key(j, "assignments");
+    mv_buf_puts(j, "[");
+    for (a = 0; a < mvfn->n_assignments; a++) {
+        struct mv_info_assignment *assign = &mvfn->assignments[a];
+        struct mv_info_var *var = assign->variable.info;
+        if (a > 0) mv_buf_puts(j, ",");
+        mv_buf_puts(j, "{");
+        json_key(j, "variable");
+        json_string(j, var->name);
+        mv_buf_puts(j, ",");
+        if (var->flag_bits) {
+            json_key(j, "mask");
+            mv_buf_int(j, assign->lower_bound);
+            mv_buf_puts(j, ",");
+            json_key(j, "pattern");
+            mv_buf_int(j, assign->upper_bound);
+            mv_buf_puts(j, "}");
+            continue;
+        }
+        json_key(j, "lower");
+        mv_buf_int(j, multiverse_var_extend(var, assign->lower_bound));
+        mv_buf_puts(j, ",");
+        json_key(j, "upper");
+        mv_buf_int(j, multiverse_var_extend(var, assign->upper_bound));
+        mv_buf_puts(j, "}");
+    }
+    mv_buf_puts(j, "]}");
+}
+
+static void json_fn(struct mv_buf *j, struct mv_info_fn *fn) {
+    struct mv_patchpoint *pp = NULL;
+    int f, first = 1;
+
+    mv_buf_puts(j, "{");
+    json_key(j, "name");
+    json_string(j, fn->name);
+    mv_buf_puts(j, ",");
+    json_key(j, "body");
+    json_pointer(j, fn->function_body);
+    mv_buf_puts(j, ",");
+    json_key(j, "function_pointer");
+    json_bool(j, fn->n_mv_functions == -1);
+    mv_buf_puts(j, ",");
+    json_key(j, "decoded");
+    json_bool(j, fn->decoded);
+    mv_buf_puts(j, ",");
+    json_key(j, "frozen");
+    json_bool(j, multiverse_fn_frozen(fn));
+    mv_buf_puts(j, ",");
+    json_key(j, "active_body");
+    json_pointer(j, fn->active_mvfn ? fn->active_mvfn->function_body : NULL);
+    mv_buf_puts(j, ",");
+    json_key(j, "hits");
+    if (fn->hits)
+        mv_buf_int(j, *fn->hits);
+    else
+        mv_buf_puts(j, "null");
+    mv_buf_puts(j, ",");
+    json_key(j, "variants");
+    mv_buf_puts(j, "[");
+    for (f = 0; f < fn->n_mv_functions; f++) {
+        if (f > 0) mv_buf_puts(j, ",");
+        json_mvfn(j, fn, &fn->mv_functions[f]);
+    }
+    mv_buf_puts(j, "],");
+    json_key(j, "patchpoints");
+    mv_buf_puts(j, "[");
+    while ((pp = multiverse_next_patchpoint(fn, pp)) != NULL) {
+        struct mv_patchpoint_info info;
+        if (multiverse_patchpoint_info(pp, &info) < 0) continue;
+        if (!first) mv_buf_puts(j, ",");
+        first = 0;
+        mv_buf_puts(j, "{");
+        json_key(j, "location");
+        json_pointer(j, info.location);
+        mv_buf_puts(j, ",");
+        json_key(j, "type");
+        json_string(j, info.type);
+        mv_buf_puts(j, ",");
+        json_key(j, "entry");
+        json_bool(j, info.is_entry);
+        mv_buf_puts(j, ",");
+        json_key(j, "target");
+        json_pointer(j, info.target);
+        mv_buf_puts(j, "}");
+    }
+    mv_buf_puts(j, "]}");
+}
+
+static void json_var(struct mv_buf *j, struct mv_info_var *var) {
+    struct mv_info_fn_ref *fref;
+
+    mv_buf_puts(j, "{");
+    json_key(j, "name");
+    json_string(j, var->name);
+    mv_buf_puts(j, ",");
+    json_key(j, "location");
+    json_pointer(j, var->variable_location);
+    mv_buf_puts(j, ",");
+    json_key(j, "width");
+    mv_buf_int(j, var->variable_width);
+    mv_buf_puts(j, ",");
+    json_key(j, "value");
+    mv_buf_int(j, multiverse_var_extend(var, multiverse_var_read(var)));
+    mv_buf_puts(j, ",");
+    json_key(j, "tracked");
+    json_bool(j, var->flag_tracked);
+    mv_buf_puts(j, ",");
+    json_key(j, "signed");
+    json_bool(j, var->flag_signed);
+    mv_buf_puts(j, ",");
+    json_key(j, "pointer");
+    json_bool(j, var->flag_pointer);
+    mv_buf_puts(j, ",");
+    json_key(j, "bound");
+    json_bool(j, var->flag_bound);
+    mv_buf_puts(j, ",");
+    json_key(j, "frozen");
+    json_bool(j, var->flag_frozen);
+    mv_buf_puts(j, ",");
+    json_key(j, "functions");
+    mv_buf_puts(j, "[");
+    for (fref = var->functions_head; fref != NULL; fref = fref->next) {
+        if (fref != var->functions_head) mv_buf_puts(j, ",");
+        json_string(j, fref->fn->name);
+    }
+    mv_buf_puts(j, "]}");
+}
+
+
+unsigned long multiverse_dump_json(char *buf, unsigned long size) {
+    struct mv_buf j = { .buf = buf, .size = size, .len = 0 };
+    struct mv_info_fn *fn = NULL;
+    struct mv_info_var *var = NULL;
+
+    mv_buf_puts(&j, "{");
+    json_key(&j, "functions");
+    mv_buf_puts(&j, "[");
+    while ((fn = multiverse_next_fn(fn)) != NULL) {
+        if (fn != multiverse_next_fn(NULL)) mv_buf_puts(&j, ",");
+        json_fn(&j, fn);
+    }
+    mv_buf_puts(&j, "],");
+    json_key(&j, "variables");
+    mv_buf_puts(&j, "[");
+    while ((var = multiverse_next_var(var)) != NULL) {
+        if (var != multiverse_next_var(NULL)) mv_buf_puts(&j, ",");
+        json_var(&j, var);
+    }
+    mv_buf_puts(&j, "]}\n");
+
+    return mv_buf_finish(&j);
+}
@@ -0,0 +1,107 @@
+#include "mv_assert.h"
+#include "mv_string.h"
+#include "multiverse.h"
+#include "mv_commit.h"
+#include "arch.h"
+#include "platform.h"
+#include "mv_trace.h"
+
+
+#define LAZY_POOL_SIZE 4096
+#define LAZY_STUB_SIZE 32
+
+/* The stubs are allocated from pools of executable memory */
+static char *lazy_pool_top;
+static char *lazy_pool_end;
+
+/* Only one thread fixes up callsites at a time */
+static int lazy_lock;
+
+
+struct mv_info_mvfn *
+multiverse_lazy_entry(mv_transaction_ctx_t *ctx, struct mv_info_fn *fn) {
+    struct mv_info_mvfn *entry;
+    int tries;
+
+    if (fn->lazy_mvfn != NULL) return fn->lazy_mvfn;
+
+    entry = multiverse_os_malloc(sizeof(struct mv_info_mvfn));
+    if (!entry) return NULL;
+    memset(entry, 0, sizeof(struct mv_info_mvfn));
+
+    // The stub has to be reachable from the function. If it is not,
+    // we start a new pool in the vicinity of the function.
+    for (tries = 0; tries < 2; tries++) {
+        if (lazy_pool_top == NULL || lazy_pool_top + LAZY_STUB_SIZE > lazy_pool_end
+            || tries > 0) {
+            char *pool = multiverse_os_alloc_text(fn->function_body, LAZY_POOL_SIZE, 0);
+            if (!pool) break;
+            lazy_pool_top = pool;
+            lazy_pool_end = pool + LAZY_POOL_SIZE;
+            tries = 1;
+        }
+
+        multiverse_transaction_unprotect(ctx, lazy_pool_top);
+        multiverse_transaction_unprotect(ctx, lazy_pool_top + LAZY_STUB_SIZE - 1);
+        if (multiverse_arch_lazy_stub(lazy_pool_top, LAZY_STUB_SIZE, fn) < 0)
+            continue;
+        multiverse_os_clear_cache(lazy_pool_top, LAZY_STUB_SIZE);
+
+        entry->function_body = lazy_pool_top;
+        entry->type = MVFN_TYPE_NONE;
+        lazy_pool_top += LAZY_STUB_SIZE;
+        fn->lazy_mvfn = entry;
+        return entry;
+    }
+
+    multiverse_os_free(entry);
+    return NULL;
+}
+
+
+void *multiverse_lazy_fixup(struct mv_info_fn *fn, void *return_address) {
+    struct mv_info_mvfn *mvfn = fn->active_mvfn;
+    struct mv_patchpoint *pp;
+
+    // The function was reverted in the meantime
+    if (mvfn == NULL) return fn->function_body;
+
+    if (__atomic_test_and_set(&lazy_lock, __ATOMIC_ACQUIRE))
+        return multiverse_mvfn_body(mvfn);
+
+    for (pp = fn->patchpoints_head; pp != NULL; pp = pp->next) {
+        mv_transaction_ctx_t ctx;
+        void *from, *to;
+
+        if (pp->type == PP_TYPE_INVALID || !pp->location) continue;
+        if (pp->location == fn->function_body || pp->applied != NULL) continue;
+
+        // The caller returns right behind the callsite
+        multiverse_arch_patchpoint_size(pp, &from, &to);
+        if (to != return_address) continue;
+
+        // Other threads may execute the callsite right now. If it
+        // cannot be patched atomically, it keeps calling the stub.
+        if (!multiverse_arch_patchpoint_atomic(mvfn, pp)) break;
+
+        // A commit is running. The callsite is fixed up by a later call.
+        if (mv_transaction_try_start(&ctx) < 0) break;
+        if (fn->active_mvfn != mvfn || pp->applied != NULL) {
+            // A commit before us selected another mvfn
+            mv_transaction_end(&ctx);
+            break;
+        }
+        multiverse_transaction_unprotect(&ctx, from);
+        multiverse_transaction_unprotect(&ctx, (char *)to - 1);
+        multiverse_arch_patchpoint_apply(fn, mvfn, pp);
+        pp->applied = mvfn;
+        multiverse_stats->patchpoints_written++;
+        MV_TRACE3(patch_apply, fn->name, pp->location, multiverse_mvfn_body(mvfn));
+        mv_transaction_end(&ctx);
+        break;
+    }
+
+    __atomic_clear(&lazy_lock, __ATOMIC_RELEASE);
+
+    return multiverse_mvfn_body(mvfn);
+}
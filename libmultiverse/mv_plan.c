@@ -0,0 +1,207 @@
+#include "mv_assert.h"
+#include "mv_string.h"
+#include "multiverse.h"
+#include "mv_commit.h"
+#include "arch.h"
+#include "platform.h"
+#include "mv_trace.h"
+
+
+extern struct mv_info_fn *__start___multiverse_fn_ptr;
+extern struct mv_info_fn *__stop___multiverse_fn_ptr;
+
+
+static int multiverse_plan_valid_pp(struct mv_patchpoint *pp) {
+    return pp->type != PP_TYPE_INVALID && pp->location != NULL;
+}
+
+/* Is the function already in the state that is described by the plan? */
+static int multiverse_plan_reached(struct mv_plan_fn *pf) {
+    struct mv_info_fn *fn = pf->fn;
+    if (fn->n_mv_functions == -1 && pf->mvfn != NULL) {
+        return fn->active_mvfn != NULL
+            && fn->active_mvfn->function_body == pf->function_pointer;
+    }
+    return fn->active_mvfn == pf->mvfn;
+}
+
+static int multiverse_plan_fn(struct mv_plan_fn *pf, struct mv_plan_patch *patches,
+                              int revert) {
+    struct mv_info_fn *fn = pf->fn;
+    struct mv_info_mvfn *mvfn = NULL;
+    struct mv_info_mvfn target;
+    struct mv_patchpoint *pp;
+
+    pf->function_pointer = NULL;
+    if (!revert && fn->n_mv_functions != -1) {
+        mvfn = multiverse_best_mvfn(fn);
+    } else if (!revert) {
+        // A multiversed function pointer uses a single mvfn for the
+        // currently assigned function. We decode the assigned function
+        // into a private mvfn, the shared one is updated on apply.
+        if (fn->mv_functions == NULL) {
+            fn->mv_functions = multiverse_os_malloc(sizeof(struct mv_info_mvfn));
+            if (fn->mv_functions == NULL) return -1;
+            fn->mv_functions->n_assignments = 0;
+            fn->mv_functions->assignments = NULL;
+            fn->mv_functions->function_body = NULL;
+            fn->mv_functions->cached_body = NULL;
+        }
+        memset(&target, 0, sizeof(target));
+        target.function_body = *((void**)fn->function_body);
+        multiverse_arch_decode_mvfn_body(&target);
+        pf->function_pointer = target.function_body;
+        mvfn = fn->mv_functions;
+    }
+    pf->mvfn = mvfn;
+    pf->changed = !multiverse_plan_reached(pf);
+    if (pf->changed && multiverse_fn_frozen(fn)) return -1;
+
+    pf->n_patches = 0;
+    pf->patches = patches;
+    for (pp = fn->patchpoints_head; pp != NULL; pp = pp->next) {
+        struct mv_plan_patch *patch = &patches[pf->n_patches];
+        void *from, *to;
+
+        if (!multiverse_plan_valid_pp(pp)) continue;
+
+        multiverse_arch_patchpoint_size(pp, &from, &to);
+        patch->patchpoint = pp;
+        patch->location = from;
+        patch->size = (char *)to - (char *)from;
+        MV_ASSERT(patch->size <= MV_PATCHPOINT_SIZE);
+
+        if (mvfn == NULL) {
+            // The original code is still in place, or was swapped out
+            memcpy(patch->bytes, pp->applied ? pp->swapspace : pp->location,
+                   patch->size);
+        } else {
+            patch->size = multiverse_arch_patchpoint_bytes(
+                pf->function_pointer ? &target : mvfn, pp, patch->bytes);
+        }
+        pf->n_patches++;
+    }
+    return 0;
+}
+
+static struct mv_plan *multiverse_plan(int revert) {
+    struct mv_plan *plan;
+    struct mv_info_fn *fn;
+    unsigned n_patches = 0, i = 0;
+
+    for (fn = __start___multiverse_fn_ptr; fn < __stop___multiverse_fn_ptr; fn++) {
+        struct mv_patchpoint *pp;
+        multiverse_info_fn_decode(fn);
+        for (pp = fn->patchpoints_head; pp != NULL; pp = pp->next) {
+            if (multiverse_plan_valid_pp(pp)) n_patches++;
+        }
+    }
+
+    plan = multiverse_os_malloc(sizeof(struct mv_plan));
+    if (!plan) return NULL;
+    plan->n_functions = __stop___multiverse_fn_ptr - __start___multiverse_fn_ptr;
+    plan->n_patches = n_patches;
+    // One extra byte, as we do not want to see NULL for empty arrays
+    plan->functions = multiverse_os_malloc(plan->n_functions * sizeof(struct mv_plan_fn) + 1);
+    plan->patches = multiverse_os_malloc(n_patches * sizeof(struct mv_plan_patch) + 1);
+    if (!plan->functions || !plan->patches) {
+        multiverse_plan_free(plan);
+        return NULL;
+    }
+
+    n_patches = 0;
+    for (fn = __start___multiverse_fn_ptr; fn < __stop___multiverse_fn_ptr; fn++, i++) {
+        struct mv_plan_fn *pf = &plan->functions[i];
+        pf->fn = fn;
+        if (multiverse_plan_fn(pf, &plan->patches[n_patches], revert) < 0) {
+            multiverse_plan_free(plan);
+            return NULL;
+        }
+        n_patches += pf->n_patches;
+    }
+    MV_ASSERT(n_patches == plan->n_patches);
+
+    return plan;
+}
+
+struct mv_plan *multiverse_plan_commit(void) {
+    return multiverse_plan(0);
+}
+
+struct mv_plan *multiverse_plan_revert(void) {
+    return multiverse_plan(1);
+}
+
+int multiverse_plan_apply(struct mv_plan *plan) {
+    mv_transaction_ctx_t ctx;
+    unsigned i;
+    int ret = 0;
+
+    if (!plan) return -1;
+
+    // Check everything, before we touch the first byte
+    for (i = 0; i < plan->n_functions; i++) {
+        struct mv_plan_fn *pf = &plan->functions[i];
+        if (!multiverse_plan_reached(pf) && multiverse_fn_frozen(pf->fn))
+            return -1;
+    }
+
+    ctx = mv_transaction_start();
+    for (i = 0; i < plan->n_functions; i++) {
+        struct mv_plan_fn *pf = &plan->functions[i];
+        struct mv_info_fn *fn = pf->fn;
+        struct mv_info_mvfn *old = fn->active_mvfn;
+        unsigned long long start_ns = 0;
+        unsigned p;
+
+        if (multiverse_plan_reached(pf)) continue;
+        if (MV_TRACE_ENABLED(select)) start_ns = multiverse_os_now_ns();
+
+        for (p = 0; p < pf->n_patches; p++) {
+            struct mv_plan_patch *patch = &pf->patches[p];
+            char *location = patch->location;
+
+            multiverse_transaction_unprotect(&ctx, location);
+            multiverse_transaction_unprotect(&ctx, location + patch->size - 1);
+
+            // Select from original -> Swap out the current code
+            if (patch->patchpoint->applied == NULL && pf->mvfn != NULL) {
+                memcpy(patch->patchpoint->swapspace, location, patch->size);
+            }
+            memcpy(location, patch->bytes, patch->size);
+            patch->patchpoint->applied = pf->mvfn;
+            multiverse_stats->patchpoints_written++;
+            multiverse_os_clear_cache(location, patch->size);
+            if (pf->mvfn == NULL) {
+                MV_TRACE2(patch_revert, fn->name, location);
+            } else {
+                MV_TRACE3(patch_apply, fn->name, location,
+                          pf->function_pointer ? pf->function_pointer
+                          : multiverse_mvfn_body(pf->mvfn));
+            }
+        }
+
+        if (pf->function_pointer) {
+            fn->mv_functions->function_body = pf->function_pointer;
+            multiverse_arch_decode_mvfn_body(fn->mv_functions);
+        }
+        fn->active_mvfn = pf->mvfn;
+        multiverse_warmup_select(fn, pf->mvfn);
+        multiverse_stats->functions_changed++;
+        if (MV_TRACE_ENABLED(select)) {
+            MV_TRACE5(select, fn->name, fn->function_body, MV_TRACE_BODY(old),
+                      MV_TRACE_BODY(pf->mvfn), multiverse_os_now_ns() - start_ns);
+        }
+        ret++;
+    }
+    mv_transaction_end(&ctx);
+
+    return ret;
+}
+
+void multiverse_plan_free(struct mv_plan *plan) {
+    if (!plan) return;
+    multiverse_os_free(plan->functions);
+    multiverse_os_free(plan->patches);
+    multiverse_os_free(plan);
+}
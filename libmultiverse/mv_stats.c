@@ -0,0 +1,202 @@
+#include "mv_assert.h"
+#include "mv_string.h"
+#include "multiverse.h"
+#include "mv_commit.h"
+#include "platform.h"
+#include "mv_trace.h"
+
+
+extern struct mv_info_fn *__start___multiverse_fn_ptr;
+extern struct mv_info_fn *__stop___multiverse_fn_ptr;
+extern struct mv_info_var *__start___multiverse_var_ptr;
+extern struct mv_info_var *__stop___multiverse_var_ptr;
+extern struct mv_info_callsite *__start___multiverse_callsite_ptr;
+extern struct mv_info_callsite *__stop___multiverse_callsite_ptr;
+extern char *__start___multiverse_text_ptr;
+extern char *__stop___multiverse_text_ptr;
+
+static struct mv_stats multiverse_stats_local = {
+    .version = MV_STATS_VERSION,
+    .size = sizeof(struct mv_stats),
+};
+
+/* Points to the shared-memory segment after multiverse_stats_export() */
+struct mv_stats *multiverse_stats = &multiverse_stats_local;
+
+/* The semaphores of the tracepoints, see mv_trace.h */
+MV_TRACE_DEFINE(transaction_start);
+MV_TRACE_DEFINE(transaction_end);
+MV_TRACE_DEFINE(select);
+MV_TRACE_DEFINE(patch_apply);
+MV_TRACE_DEFINE(patch_revert);
+
+
+/* Lazy fixups run transactions on application threads. A private
+   lock keeps them from interleaving with commits; the statistics may
+   be shared with other processes and must not block us. */
+static char multiverse_transaction_lock;
+
+static int multiverse_stats_lock(int wait) {
+    while (__atomic_test_and_set(&multiverse_transaction_lock, __ATOMIC_ACQUIRE)) {
+        if (!wait) return -1;
+    }
+    return 0;
+}
+
+static void multiverse_stats_unlock(void) {
+    __atomic_clear(&multiverse_transaction_lock, __ATOMIC_RELEASE);
+}
+
+/* The published sequence number is odd while the statistics are
+   written. Readers of the shared segment retry, if it is odd or
+   changes. */
+static void multiverse_stats_write_begin(void) {
+    __atomic_fetch_add(&multiverse_stats->sequence, 1, __ATOMIC_RELAXED);
+    // The counters are updated after the odd sequence number
+    __atomic_thread_fence(__ATOMIC_ACQ_REL);
+}
+
+static void multiverse_stats_write_end(void) {
+    // The counters are updated before the even sequence number
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_fetch_add(&multiverse_stats->sequence, 1, __ATOMIC_RELAXED);
+}
+
+static void multiverse_stats_start(mv_transaction_ctx_t *ctx) {
+    multiverse_transaction_count++;
+    ctx->start_ns = multiverse_os_now_ns();
+    MV_TRACE1(transaction_start, multiverse_transaction_count);
+}
+
+void multiverse_stats_begin(mv_transaction_ctx_t *ctx) {
+    multiverse_stats_lock(1);
+    multiverse_stats_write_begin();
+    multiverse_stats_start(ctx);
+}
+
+int multiverse_stats_try_begin(mv_transaction_ctx_t *ctx) {
+    if (multiverse_stats_lock(0) < 0) return -1;
+    multiverse_stats_write_begin();
+    multiverse_stats_start(ctx);
+    return 0;
+}
+
+void multiverse_stats_end(mv_transaction_ctx_t *ctx) {
+    unsigned long long ns = multiverse_os_now_ns() - ctx->start_ns;
+    unsigned long long us = ns / 1000;
+    unsigned bucket = 0;
+
+    while (us > 0 && bucket < MV_STATS_HISTOGRAM - 1) {
+        us >>= 1;
+        bucket++;
+    }
+
+    multiverse_stats->transactions++;
+    multiverse_stats->latency_ns_total += ns;
+    if (ns > multiverse_stats->latency_ns_max)
+        multiverse_stats->latency_ns_max = ns;
+    multiverse_stats->latency_histogram[bucket]++;
+    multiverse_stats_write_end();
+    multiverse_stats_unlock();
+    MV_TRACE2(transaction_end, multiverse_transaction_count, ns);
+}
+
+
+static void multiverse_stats_footprint(struct mv_stats *stats) {
+    struct mv_info_var *var;
+    struct mv_info_fn *fn;
+    unsigned long descriptors, patchpoints = 0, refs = 0;
+
+    descriptors = (__stop___multiverse_var_ptr - __start___multiverse_var_ptr)
+        * sizeof(struct mv_info_var)
+        + (__stop___multiverse_fn_ptr - __start___multiverse_fn_ptr)
+        * sizeof(struct mv_info_fn)
+        + (__stop___multiverse_callsite_ptr - __start___multiverse_callsite_ptr)
+        * sizeof(struct mv_info_callsite);
+
+    for (fn = __start___multiverse_fn_ptr; fn < __stop___multiverse_fn_ptr; fn++) {
+        struct mv_patchpoint *pp;
+        int f;
+        for (f = 0; f < fn->n_mv_functions; f++) {
+            descriptors += sizeof(struct mv_info_mvfn)
+                + fn->mv_functions[f].n_assignments * sizeof(struct mv_info_assignment);
+        }
+        for (pp = fn->patchpoints_head; pp != NULL; pp = pp->next) {
+            patchpoints++;
+        }
+    }
+
+    for (var = __start___multiverse_var_ptr; var < __stop___multiverse_var_ptr; var++) {
+        struct mv_info_fn_ref *fref;
+        for (fref = var->functions_head; fref != NULL; fref = fref->next) {
+            refs++;
+        }
+    }
+
+    stats->descriptor_bytes = descriptors;
+    stats->patchpoint_bytes = patchpoints * sizeof(struct mv_patchpoint);
+    stats->ref_bytes = refs * sizeof(struct mv_info_fn_ref);
+    stats->variant_text_bytes = __stop___multiverse_text_ptr - __start___multiverse_text_ptr;
+}
+
+
+int multiverse_get_stats(struct mv_stats *stats) {
+    // No transaction changes the counters or the patchpoints meanwhile
+    multiverse_stats_lock(1);
+    memcpy(stats, multiverse_stats, sizeof(struct mv_stats));
+    multiverse_stats_footprint(stats);
+
+    // Publish the footprint, if it changed
+    if (stats->descriptor_bytes != multiverse_stats->descriptor_bytes
+        || stats->patchpoint_bytes != multiverse_stats->patchpoint_bytes
+        || stats->ref_bytes != multiverse_stats->ref_bytes
+        || stats->variant_text_bytes != multiverse_stats->variant_text_bytes) {
+        multiverse_stats_write_begin();
+        multiverse_stats->descriptor_bytes = stats->descriptor_bytes;
+        multiverse_stats->patchpoint_bytes = stats->patchpoint_bytes;
+        multiverse_stats->ref_bytes = stats->ref_bytes;
+        multiverse_stats->variant_text_bytes = stats->variant_text_bytes;
+        multiverse_stats_write_end();
+        stats->sequence = multiverse_stats->sequence;
+    }
+    multiverse_stats_unlock();
+    return 0;
+}
+
+
+long multiverse_fn_variant_bytes(void *function_body) {
+    struct mv_info_fn *fn = multiverse_info_fn(function_body);
+    long bytes = 0;
+    int f, g;
+
+    if (!fn) return -1;
+
+    for (f = 0; f < fn->n_mv_functions; f++) {
+        char *body = fn->mv_functions[f].function_body;
+        char *end = multiverse_info_body_end(body);
+        if (!end) continue;
+        // Several mvfns can share a body
+        for (g = 0; g < f; g++) {
+            if (fn->mv_functions[g].function_body == body) break;
+        }
+        if (g == f) bytes += end - body;
+    }
+    return bytes;
+}
+
+
+int multiverse_stats_export(const char *name) {
+    struct mv_stats *shared;
+
+    if (multiverse_stats != &multiverse_stats_local) return -1;
+
+    shared = multiverse_os_shared_alloc(name, sizeof(struct mv_stats));
+    if (!shared) return -1;
+
+    multiverse_stats_lock(1);
+    multiverse_stats_footprint(&multiverse_stats_local);
+    memcpy(shared, &multiverse_stats_local, sizeof(struct mv_stats));
+    multiverse_stats = shared;
+    multiverse_stats_unlock();
+    return 0;
+}
@@ -0,0 +1,103 @@
+/**
+   @file Statically defined tracepoints (USDT) of the run-time library.
+
+   The probes follow the SystemTap SDT note format, which is understood
+   by bpftrace, perf, and SystemTap (provider "multiverse"). A probe
+   site is a single nop, and arguments that are costly to compute are
+   guarded by the semaphore of the probe, which the tracer increments
+   while it is attached. We do not depend on <sys/sdt.h>, but emit the
+   same notes. Define MULTIVERSE_NO_TRACE to remove all probes.
+*/
+#ifndef __MULTIVERSE_TRACE_H
+#define __MULTIVERSE_TRACE_H
+
+#if defined(__x86_64__) && defined(__ELF__) \
+    && !defined(MULTIVERSE_KERNELSPACE) && !defined(MULTIVERSE_NO_TRACE)
+
+#define MV_TRACE_SEMAPHORE(name) multiverse_##name##_semaphore
+
+#define MV_TRACE_DEFINE(name)                                           \
+    volatile unsigned short MV_TRACE_SEMAPHORE(name)                    \
+        __attribute__((section(".probes"), used))
+
+/* Is a tracer attached to the probe? */
+#define MV_TRACE_ENABLED(name)                                          \
+    __builtin_expect(MV_TRACE_SEMAPHORE(name) != 0, 0)
+
+#define MV_TRACE_ARG(x) "nor"((unsigned long)(x))
+
+#define MV_TRACE_PROBE(name, args, ...)                                 \
+    __asm__ __volatile__(                                               \
+        "990: nop\n"                                                    \
+        ".pushsection .note.stapsdt,\"?\",\"note\"\n"                   \
+        ".balign 4\n"                                                   \
+        ".4byte 992f-991f, 994f-993f, 3\n"                              \
+        "991: .asciz \"stapsdt\"\n"                                     \
+        "992: .balign 4\n"                                              \
+        "993: .8byte 990b\n"                                            \
+        ".8byte _.stapsdt.base\n"                                       \
+        ".8byte multiverse_" #name "_semaphore\n"                       \
+        ".asciz \"multiverse\"\n"                                       \
+        ".asciz \"" #name "\"\n"                                        \
+        ".asciz \"" args "\"\n"                                         \
+        "994: .balign 4\n"                                              \
+        ".popsection\n"                                                 \
+        ".ifndef _.stapsdt.base\n"                                      \
+        ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+        ".weak _.stapsdt.base\n"                                        \
+        ".hidden _.stapsdt.base\n"                                      \
+        "_.stapsdt.base: .space 1\n"                                    \
+        ".size _.stapsdt.base, 1\n"                                     \
+        ".popsection\n"                                                 \
+        ".endif\n"                                                      \
+        :: __VA_ARGS__)
+
+#define MV_TRACE1(name, a)                                              \
+    MV_TRACE_PROBE(name, "8@%0", MV_TRACE_ARG(a))
+#define MV_TRACE2(name, a, b)                                           \
+    MV_TRACE_PROBE(name, "8@%0 8@%1", MV_TRACE_ARG(a), MV_TRACE_ARG(b))
+#define MV_TRACE3(name, a, b, c)                                        \
+    MV_TRACE_PROBE(name, "8@%0 8@%1 8@%2", MV_TRACE_ARG(a),            \
+                   MV_TRACE_ARG(b), MV_TRACE_ARG(c))
+#define MV_TRACE5(name, a, b, c, d, e)                                  \
+    MV_TRACE_PROBE(name, "8@%0 8@%1 8@%2 8@%3 8@%4", MV_TRACE_ARG(a),  \
+                   MV_TRACE_ARG(b), MV_TRACE_ARG(c), MV_TRACE_ARG(d),   \
+                   MV_TRACE_ARG(e))
+
+#else
+
+#define MV_TRACE_DEFINE(name) struct mv_trace_unused_##name
+#define MV_TRACE_ENABLED(name) 0
+#define MV_TRACE1(name, a) do { } while (0)
+#define MV_TRACE2(name, a, b) do { } while (0)
+#define MV_TRACE3(name, a, b, c) do { } while (0)
+#define MV_TRACE5(name, a, b, c, d, e) do { } while (0)
+
+#endif
+
+#if defined(MV_TRACE_SEMAPHORE)
+#define MV_TRACE_DECLARE(name) \
+    extern volatile unsigned short MV_TRACE_SEMAPHORE(name)
+#else
+#define MV_TRACE_DECLARE(name) struct mv_trace_unused_##name
+#endif
+
+/* The probes of the run-time library:
+
+   transaction_start(number)
+   transaction_end(number, duration_ns)
+   select(fn_name, fn_body, old_body, new_body, duration_ns)
+       A function changed its variant. The bodies are NULL for the
+       generic code.
+   patch_apply(fn_name, location, body)
+   patch_revert(fn_name, location)
+       A single patchpoint was rewritten. */
+MV_TRACE_DECLARE(transaction_start);
+MV_TRACE_DECLARE(transaction_end);
+MV_TRACE_DECLARE(select);
+MV_TRACE_DECLARE(patch_apply);
+MV_TRACE_DECLARE(patch_revert);
+
+#define MV_TRACE_BODY(mvfn) ((mvfn) ? (mvfn)->function_body : NULL)
+
+#endif
@@ -0,0 +1,198 @@
+#include "mv_assert.h"
+#include "mv_string.h"
+#include "multiverse.h"
+#include "mv_commit.h"
+#include "arch.h"
+#include "platform.h"
+
+
+struct mv_fn_tune {
+    int pinned;
+    struct mv_info_mvfn *pin;        // NULL pins the generic function
+    char *rejected;                  // Per mvfn: slower than the generic function
+};
+
+
+static struct mv_fn_tune *multiverse_fn_tune(struct mv_info_fn *fn) {
+    struct mv_fn_tune *tune = fn->tune;
+    if (tune != NULL) return tune;
+
+    tune = multiverse_os_malloc(sizeof(struct mv_fn_tune));
+    if (!tune) return NULL;
+    // One extra byte, as we do not want to see NULL for empty arrays
+    tune->rejected = multiverse_os_malloc(fn->n_mv_functions + 1);
+    if (!tune->rejected) {
+        multiverse_os_free(tune);
+        return NULL;
+    }
+    memset(tune->rejected, 0, fn->n_mv_functions + 1);
+    tune->pinned = 0;
+    tune->pin = NULL;
+    fn->tune = tune;
+    return tune;
+}
+
+
+struct mv_info_mvfn *multiverse_tune_mvfn(struct mv_info_fn *fn,
+                                          struct mv_info_mvfn *mvfn) {
+    struct mv_fn_tune *tune = fn->tune;
+
+    if (tune->pinned) return tune->pin;
+    if (mvfn != NULL && tune->rejected[mvfn - fn->mv_functions]) return NULL;
+    return mvfn;
+}
+
+
+/* Resolves a variant body to its mvfn. The generic body is NULL. */
+static int multiverse_tune_lookup(struct mv_info_fn *fn, void *variant_body,
+                                  struct mv_info_mvfn **mvfn) {
+    int f;
+
+    *mvfn = NULL;
+    if (variant_body == fn->function_body) return 0;
+    for (f = 0; f < fn->n_mv_functions; f++) {
+        if (fn->mv_functions[f].function_body == variant_body) {
+            *mvfn = &fn->mv_functions[f];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+
+int multiverse_pin_fn(void *function_body, void *variant_body) {
+    struct mv_info_fn *fn = multiverse_info_fn(function_body);
+    struct mv_info_mvfn *mvfn;
+    struct mv_fn_tune *tune;
+
+    // Function pointers follow their value
+    if (!fn || fn->n_mv_functions == -1) return -1;
+    if (multiverse_tune_lookup(fn, variant_body, &mvfn) < 0) return -1;
+
+    tune = multiverse_fn_tune(fn);
+    if (!tune) return -1;
+    tune->pinned = 1;
+    tune->pin = mvfn;
+    return multiverse_commit_info_fn(fn);
+}
+
+
+int multiverse_unpin_fn(void *function_body) {
+    struct mv_info_fn *fn = multiverse_info_fn(function_body);
+    struct mv_fn_tune *tune;
+
+    if (!fn) return -1;
+
+    tune = fn->tune;
+    if (tune != NULL) {
+        fn->tune = NULL;
+        multiverse_os_free(tune->rejected);
+        multiverse_os_free(tune);
+    }
+    return multiverse_commit_info_fn(fn);
+}
+
+
+struct mv_tune_sample {
+    unsigned long long cycles;
+    unsigned long long instructions;
+};
+
+/* Measures with the performance counters, if source is MV_TUNE_PERF
+   and they work. Returns the source of the sample. */
+static int multiverse_tune_measure(void (*workload)(void), int source,
+                                   struct mv_tune_sample *sample) {
+    unsigned long long cycles, instructions, cycles_end, instructions_end;
+
+    if (source == MV_TUNE_PERF
+        && multiverse_os_perf_read(&cycles, &instructions) == 0) {
+        workload();
+        if (multiverse_os_perf_read(&cycles_end, &instructions_end) == 0) {
+            sample->cycles = cycles_end - cycles;
+            sample->instructions = instructions_end - instructions;
+            return MV_TUNE_PERF;
+        }
+    }
+
+    cycles = multiverse_arch_timestamp();
+    workload();
+    sample->cycles = multiverse_arch_timestamp() - cycles;
+    sample->instructions = 0;
+    return MV_TUNE_TSC;
+}
+
+
+int multiverse_tune_fn(void *function_body, void (*workload)(void),
+                       unsigned int rounds, struct mv_tune_result *result) {
+    struct mv_info_fn *fn = multiverse_info_fn(function_body);
+    struct mv_tune_sample best[2], sample;
+    struct mv_info_mvfn *variant, *old_pin;
+    struct mv_fn_tune *tune;
+    int old_pinned, source = MV_TUNE_PERF, keep;
+    unsigned int r, i;
+
+    if (!fn || fn->n_mv_functions == -1 || rounds == 0) return -1;
+    if (!workload) workload = multiverse_warmup_stub(fn);
+    if (!workload) return -1;
+
+    multiverse_info_fn_decode(fn);
+    tune = multiverse_fn_tune(fn);
+    if (!tune) return -1;
+
+    variant = multiverse_match_mvfn(fn);
+    old_pinned = tune->pinned;
+    old_pin = tune->pin;
+
+    if (result) {
+        memset(result, 0, sizeof(*result));
+        result->variant = variant ? variant->function_body : NULL;
+        result->winner = fn->function_body;
+    }
+    // Nothing to compare
+    if (variant == NULL) return 0;
+
+    // Alternate the order of generic and variant in every round, so
+    // that drift hits both alike. The fastest round counts.
+    tune->pinned = 1;
+ restart:
+    best[0].cycles = best[1].cycles = ~0ULL;
+    best[0].instructions = best[1].instructions = 0;
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < 2; i++) {
+            unsigned int which = (r + i) % 2;  // 0: generic, 1: variant
+            tune->pin = which ? variant : NULL;
+            if (multiverse_commit_info_fn(fn) < 0) {
+                // Do not leave the measured body installed
+                tune->pinned = old_pinned;
+                tune->pin = old_pin;
+                multiverse_commit_info_fn(fn);
+                return -1;
+            }
+            workload(); // Warm up caches and TLB after patching
+            if (multiverse_tune_measure(workload, source, &sample) != source) {
+                // The performance counters failed. Cycles and time
+                // stamps are not comparable, so we start over.
+                source = MV_TUNE_TSC;
+                goto restart;
+            }
+            if (sample.cycles < best[which].cycles)
+                best[which] = sample;
+        }
+    }
+
+    keep = best[1].cycles <= best[0].cycles;
+    tune->rejected[variant - fn->mv_functions] = !keep;
+    tune->pinned = old_pinned;
+    tune->pin = old_pin;
+    if (multiverse_commit_info_fn(fn) < 0) return -1;
+
+    if (result) {
+        result->winner = keep ? variant->function_body : fn->function_body;
+        result->source = source;
+        result->generic_cycles = best[0].cycles;
+        result->variant_cycles = best[1].cycles;
+        result->generic_instructions = best[0].instructions;
+        result->variant_instructions = best[1].instructions;
+    }
+    return keep;
+}
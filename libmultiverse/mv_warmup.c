@@ -0,0 +1,104 @@
+#include "mv_assert.h"
+#include "mv_string.h"
+#include "multiverse.h"
+#include "mv_commit.h"
+#include "platform.h"
+
+
+struct mv_warmup {
+    struct mv_warmup *next;
+    struct mv_info_fn *fn;
+    void (*stub)(void);
+    int pending;            // The function changed in the current transaction
+};
+
+static int warmup_flags;
+static struct mv_warmup *warmup_head;
+
+
+int multiverse_set_warmup(int flags) {
+    int old = warmup_flags;
+    warmup_flags = flags;
+    return old;
+}
+
+
+int multiverse_register_warmup(void *function_body, void (*stub)(void)) {
+    struct mv_info_fn *fn = multiverse_info_fn(function_body);
+    struct mv_warmup *w;
+
+    if (!fn) return -1;
+
+    for (w = warmup_head; w != NULL; w = w->next) {
+        if (w->fn == fn) {
+            w->stub = stub;
+            return 0;
+        }
+    }
+
+    w = multiverse_os_malloc(sizeof(struct mv_warmup));
+    if (!w) return -1;
+    w->fn = fn;
+    w->stub = stub;
+    w->pending = 0;
+    w->next = warmup_head;
+    warmup_head = w;
+    return 0;
+}
+
+
+void (*multiverse_warmup_stub(struct mv_info_fn *fn))(void) {
+    struct mv_warmup *w;
+    for (w = warmup_head; w != NULL; w = w->next) {
+        if (w->fn == fn) return w->stub;
+    }
+    return NULL;
+}
+
+
+static void multiverse_warmup_prefault(struct mv_info_mvfn *mvfn) {
+    char *body = multiverse_mvfn_body(mvfn);
+    char *end = multiverse_info_body_end(mvfn->function_body);
+    unsigned long len, i;
+
+    // Outside of the variant section, we do not know where a body ends.
+    len = end ? (unsigned long)(end - (char *)mvfn->function_body) : 1;
+
+    multiverse_os_prefault(body, body + len);
+    // Touch every cache line, which also fills the second-level TLB
+    for (i = 0; i < len; i += 64) {
+        (void) *(volatile char *)(body + i);
+    }
+}
+
+
+void multiverse_warmup_select(struct mv_info_fn *fn, struct mv_info_mvfn *mvfn) {
+    struct mv_warmup *w;
+
+    if (!warmup_flags) return;
+
+    // Trivial variants are inlined into the callsites
+    if ((warmup_flags & MV_WARMUP_PREFAULT)
+        && mvfn != NULL && mvfn->type == MVFN_TYPE_NONE) {
+        multiverse_warmup_prefault(mvfn);
+    }
+
+    if (warmup_flags & MV_WARMUP_STUBS) {
+        for (w = warmup_head; w != NULL; w = w->next) {
+            if (w->fn == fn) w->pending = 1;
+        }
+    }
+}
+
+
+void multiverse_warmup_run(void) {
+    struct mv_warmup *w;
+
+    if (!(warmup_flags & MV_WARMUP_STUBS)) return;
+
+    for (w = warmup_head; w != NULL; w = w->next) {
+        if (!w->pending) continue;
+        w->pending = 0;
+        w->stub();
+    }
+}
@@ -4,24 +4,55 @@
 #include <linux/kallsyms.h>
 #include <linux/slab.h>
 #include <linux/bootmem.h>
+#include <linux/timekeeping.h>
 #include "multiverse.h"
 #include "mv_assert.h"
 #include "platform.h"
 
 EXPORT_SYMBOL(multiverse_init);
+EXPORT_SYMBOL(multiverse_init_lazy);
 EXPORT_SYMBOL(multiverse_dump_info);
 EXPORT_SYMBOL(multiverse_commit_info_fn);
 EXPORT_SYMBOL(multiverse_commit_fn);
 EXPORT_SYMBOL(multiverse_commit_info_refs);
 EXPORT_SYMBOL(multiverse_commit_refs);
+EXPORT_SYMBOL(multiverse_commit_refs_many);
 EXPORT_SYMBOL(multiverse_commit);
 EXPORT_SYMBOL(multiverse_revert_info_fn);
 EXPORT_SYMBOL(multiverse_revert_fn);
 EXPORT_SYMBOL(multiverse_revert_info_refs);
 EXPORT_SYMBOL(multiverse_revert_refs);
+EXPORT_SYMBOL(multiverse_revert_refs_many);
 EXPORT_SYMBOL(multiverse_revert);
 EXPORT_SYMBOL(multiverse_is_committed);
 EXPORT_SYMBOL(multiverse_bind);
+EXPORT_SYMBOL(multiverse_set_policy);
+EXPORT_SYMBOL(multiverse_seal);
+EXPORT_SYMBOL(multiverse_enable_code_cache);
+EXPORT_SYMBOL(multiverse_plan_commit);
+EXPORT_SYMBOL(multiverse_plan_revert);
+EXPORT_SYMBOL(multiverse_plan_apply);
+EXPORT_SYMBOL(multiverse_plan_free);
+EXPORT_SYMBOL(multiverse_set_warmup);
+EXPORT_SYMBOL(multiverse_register_warmup);
+EXPORT_SYMBOL(multiverse_get_stats);
+EXPORT_SYMBOL(multiverse_fn_variant_bytes);
+EXPORT_SYMBOL(multiverse_stats_export);
+EXPORT_SYMBOL(multiverse_next_fn);
+EXPORT_SYMBOL(multiverse_next_var);
+EXPORT_SYMBOL(multiverse_next_patchpoint);
+EXPORT_SYMBOL(multiverse_patchpoint_info);
+EXPORT_SYMBOL(multiverse_mvfn_type_name);
+EXPORT_SYMBOL(multiverse_dump_json);
+EXPORT_SYMBOL(multiverse_fn_hits);
+EXPORT_SYMBOL(multiverse_pin_fn);
+EXPORT_SYMBOL(multiverse_unpin_fn);
+EXPORT_SYMBOL(multiverse_tune_fn);
+EXPORT_SYMBOL(multiverse_info_fn_by_name);
+EXPORT_SYMBOL(multiverse_info_var_by_name);
+EXPORT_SYMBOL(multiverse_control_exec);
+EXPORT_SYMBOL(multiverse_control_start);
+EXPORT_SYMBOL(multiverse_control_stop);
 
 
 void *multiverse_os_addr_to_page(void *addr) {
@@ -29,6 +60,10 @@ void *multiverse_os_addr_to_page(void *addr) {
     return page;
 }
 
+unsigned long multiverse_os_pagesize(void) {
+    return PAGE_SIZE;
+}
+
 /**
    @brief Enable the memory protection of a page
 */
@@ -77,6 +112,70 @@ void* multiverse_os_malloc(size_t size) {
     }
 }
 
+void multiverse_os_free(void *ptr) {
+    // Memory from the bootmem allocator is never given back (see above)
+    if (slab_is_available()) {
+        kfree(ptr);
+    }
+}
+
+
+void multiverse_os_discard(void *from, void *to) {
+    // Kernel text is not pageable. Nothing to do here.
+    (void) from;
+    (void) to;
+}
+
+
+void multiverse_os_prefault(void *from, void *to) {
+    // Kernel text is always resident
+    (void) from;
+    (void) to;
+}
+
+
+void *multiverse_os_alloc_text(void *near, size_t size, int huge_pages) {
+    // Not supported: the kernel text is not extended at run time
+    (void) near;
+    (void) size;
+    (void) huge_pages;
+    return NULL;
+}
+
+
+unsigned long long multiverse_os_now_ns(void) {
+    return ktime_get_ns();
+}
+
+
+void *multiverse_os_shared_alloc(const char *name, size_t size) {
+    // Use multiverse_get_stats() from a debugfs or proc handler instead
+    (void) name;
+    (void) size;
+    return NULL;
+}
+
+
+int multiverse_os_perf_read(unsigned long long *cycles,
+                            unsigned long long *instructions) {
+    // The tuning falls back to the time stamp counter
+    (void) cycles;
+    (void) instructions;
+    return -1;
+}
+
+int multiverse_os_control_start(const char *path,
+                                unsigned long (*handler)(const char *, char *,
+                                                         unsigned long)) {
+    // Kernel users call multiverse_control_exec from their own interface
+    (void) path;
+    (void) handler;
+    return -1;
+}
+
+void multiverse_os_control_stop(void) {
+}
+
 
 void multiverse_os_print(const char* fmt, ...) {
     va_list args;
@@ -15,6 +15,10 @@ void *multiverse_os_addr_to_page(void *addr) {
     return page;
 }
 
+unsigned long multiverse_os_pagesize(void) {
+    return PAGE_SIZE;
+}
+
 /**
    @brief Enable the memory protection of a page
 */
@@ -54,6 +58,25 @@ void* multiverse_os_malloc(size_t size) {
 }
 
 
+void multiverse_os_free(void *ptr) {
+    kfree_raw(ptr);
+}
+
+
+void multiverse_os_discard(void *from, void *to) {
+    // The kernel text stays mapped
+    (void) from;
+    (void) to;
+}
+
+
+void multiverse_os_prefault(void *from, void *to) {
+    // The kernel text stays mapped
+    (void) from;
+    (void) to;
+}
+
+
 void* multiverse_os_calloc(size_t num, size_t size) {
     void *ret = kmalloc_raw(size);
     if (ret)
@@ -62,6 +85,50 @@ void* multiverse_os_calloc(size_t num, size_t size) {
 }
 
 
+void *multiverse_os_alloc_text(void *near, size_t size, int huge_pages) {
+    // Not supported
+    (void) near;
+    (void) size;
+    (void) huge_pages;
+    return nullptr;
+}
+
+
+unsigned long long multiverse_os_now_ns(void) {
+    // No clock available
+    return 0;
+}
+
+
+void *multiverse_os_shared_alloc(const char *name, size_t size) {
+    // Not supported
+    (void) name;
+    (void) size;
+    return nullptr;
+}
+
+
+int multiverse_os_perf_read(unsigned long long *cycles,
+                            unsigned long long *instructions) {
+    // Not supported
+    (void) cycles;
+    (void) instructions;
+    return -1;
+}
+
+int multiverse_os_control_start(const char *path,
+                                unsigned long (*handler)(const char *, char *,
+                                                         unsigned long)) {
+    // Not supported
+    (void) path;
+    (void) handler;
+    return -1;
+}
+
+void multiverse_os_control_stop(void) {
+}
+
+
 void multiverse_os_print(const char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
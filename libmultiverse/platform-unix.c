@@ -1,9 +1,23 @@
+#define _DEFAULT_SOURCE
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <time.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
 #include "mv_assert.h"
 #include "platform.h"
 
@@ -17,6 +31,13 @@ void *multiverse_os_addr_to_page(void *addr) {
     return page;
 }
 
+unsigned long multiverse_os_pagesize(void) {
+    if (pagesize == 0) {
+        pagesize = sysconf(_SC_PAGESIZE);
+    }
+    return pagesize;
+}
+
 /**
    @brief Enable the memory protection of a page
 */
@@ -49,6 +70,320 @@ void* multiverse_os_malloc(size_t size) {
     return malloc(size);
 }
 
+void multiverse_os_free(void *ptr) {
+    free(ptr);
+}
+
+
+void multiverse_os_discard(void *from, void *to) {
+    uintptr_t start, end;
+    if (pagesize == 0) {
+        pagesize = sysconf(_SC_PAGESIZE);
+    }
+    // Only pages that are completely covered can be dropped
+    start = ((uintptr_t) from + pagesize - 1) & ~(pagesize - 1);
+    end   = (uintptr_t) to & ~(pagesize - 1);
+    if (start >= end) return;
+
+    // The text segment is a private file mapping. Therefore, the
+    // dropped pages are read again from the binary if someone still
+    // executes them.
+    madvise((void *) start, end - start, MADV_DONTNEED);
+}
+
+
+void multiverse_os_prefault(void *from, void *to) {
+    uintptr_t start, end;
+    if (pagesize == 0) {
+        pagesize = sysconf(_SC_PAGESIZE);
+    }
+    start = (uintptr_t) from & ~(pagesize - 1);
+    end   = ((uintptr_t) to + pagesize - 1) & ~(pagesize - 1);
+    if (start >= end) return;
+
+    // Start the read-ahead for all pages at once, instead of taking
+    // one fault after the other.
+    madvise((void *) start, end - start, MADV_WILLNEED);
+}
+
+
+void *multiverse_os_alloc_text(void *near, size_t size, int huge_pages) {
+    // Relative calls and jumps reach +-2 GiB. Therefore, we look for
+    // free address space in the vicinity of the text segment.
+    uintptr_t align, base;
+    int i;
+
+    if (pagesize == 0) {
+        pagesize = sysconf(_SC_PAGESIZE);
+    }
+    align = huge_pages ? (2UL << 20) : pagesize;
+    base = (uintptr_t) near & ~(align - 1);
+    size = (size + align - 1) & ~(align - 1);
+
+    for (i = 1; i <= 32; i++) {
+        // Alternate between below and above the text
+        uintptr_t distance = (uintptr_t)((i + 1) / 2) * (32UL << 20);
+        uintptr_t hint = (i % 2) ? base - distance - size : base + distance;
+        intptr_t lo, hi;
+        void *mem = mmap((void *) hint, size, PROT_READ | PROT_EXEC,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) continue;
+
+        lo = (intptr_t) mem - (intptr_t) near;
+        hi = (intptr_t) mem + (intptr_t) size - (intptr_t) near;
+        if (lo > -(1L << 30) && hi < (1L << 30)) {
+#ifdef MADV_HUGEPAGE
+            if (huge_pages) {
+                madvise(mem, size, MADV_HUGEPAGE);
+            }
+#endif
+            return mem;
+        }
+        munmap(mem, size);
+    }
+    return NULL;
+}
+
+
+unsigned long long multiverse_os_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+void *multiverse_os_shared_alloc(const char *name, size_t size) {
+    void *mem;
+    int fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) return NULL;
+    if (ftruncate(fd, size) < 0) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return (mem == MAP_FAILED) ? NULL : mem;
+}
+
+
+#ifdef __linux__
+static int perf_open(uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* The counters only count the thread that opened them. Therefore,
+   every thread opens its own, and closes them when it exits. */
+static __thread int cycles_fd = -2, instructions_fd = -2;
+static pthread_key_t perf_key;
+static pthread_once_t perf_once = PTHREAD_ONCE_INIT;
+
+static void perf_close(void *unused) {
+    (void) unused;
+    if (cycles_fd >= 0) close(cycles_fd);
+    if (instructions_fd >= 0) close(instructions_fd);
+    cycles_fd = instructions_fd = -2;
+}
+
+static void perf_key_create(void) {
+    pthread_key_create(&perf_key, perf_close);
+}
+#endif
+
+int multiverse_os_perf_read(unsigned long long *cycles,
+                            unsigned long long *instructions) {
+#ifdef __linux__
+    uint64_t value;
+
+    if (cycles_fd == -2) {
+        cycles_fd = perf_open(PERF_COUNT_HW_CPU_CYCLES);
+        instructions_fd = perf_open(PERF_COUNT_HW_INSTRUCTIONS);
+        pthread_once(&perf_once, perf_key_create);
+        pthread_setspecific(perf_key, &cycles_fd);
+    }
+    if (cycles_fd < 0 || instructions_fd < 0) return -1;
+
+    if (read(cycles_fd, &value, sizeof(value)) != sizeof(value)) return -1;
+    *cycles = value;
+    if (read(instructions_fd, &value, sizeof(value)) != sizeof(value)) return -1;
+    *instructions = value;
+    return 0;
+#else
+    (void) cycles;
+    (void) instructions;
+    return -1;
+#endif
+}
+
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define CONTROL_LINE 256
+
+static struct {
+    int running;
+    int listen_fd;
+    int wakeup[2];          // Written to stop the server thread
+    pthread_t thread;
+    struct sockaddr_un addr;
+    unsigned long (*handler)(const char *, char *, unsigned long);
+} control;
+
+/* Waits until fd is readable; returns 0 if the server is stopped */
+static int control_wait(int fd) {
+    struct pollfd fds[2] = {
+        { .fd = fd, .events = POLLIN },
+        { .fd = control.wakeup[0], .events = POLLIN },
+    };
+    while (poll(fds, 2, -1) < 0) {
+        if (errno != EINTR) return 0;
+    }
+    return !fds[1].revents;
+}
+
+static int control_reply(int fd, const char *line) {
+    static char small[4096];
+    char *reply = small;
+    unsigned long size = sizeof(small);
+    unsigned long len = control.handler(line, small, size);
+    unsigned long sent = 0;
+    int ret = 0;
+
+    // Large replies come from read-only commands, run it again. The
+    // reply may grow in the meantime (e.g., the digits of counters).
+    while (len >= size) {
+        char *larger = malloc(len + 1);
+        if (!larger) {
+            ret = -1;
+            len = 0;
+            break;
+        }
+        if (reply != small) free(reply);
+        reply = larger;
+        size = len + 1;
+        len = control.handler(line, reply, size);
+    }
+    while (sent < len) {
+        ssize_t n = send(fd, reply + sent, len - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            ret = -1;
+            break;
+        }
+        sent += n;
+    }
+    if (reply != small) free(reply);
+    return ret;
+}
+
+/* Executes the lines of one client until it disconnects */
+static void control_serve(int fd) {
+    char line[CONTROL_LINE];
+    size_t fill = 0;
+
+    while (control_wait(fd)) {
+        ssize_t n = read(fd, line + fill, sizeof(line) - 1 - fill);
+        char *start = line, *end;
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        fill += n;
+        line[fill] = '\0';
+
+        while ((end = memchr(start, '\n', line + fill - start)) != NULL) {
+            *end = '\0';
+            if (control_reply(fd, start) < 0) return;
+            start = end + 1;
+        }
+        fill -= start - line;
+        memmove(line, start, fill);
+        if (fill == sizeof(line) - 1) {
+            // The handler rejects the overlong line
+            if (control_reply(fd, line) < 0) return;
+            fill = 0;
+        }
+    }
+}
+
+static void *control_thread(void *arg) {
+    (void) arg;
+    while (control_wait(control.listen_fd)) {
+        int fd = accept(control.listen_fd, NULL, NULL);
+        if (fd < 0) continue;
+        control_serve(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+int multiverse_os_control_start(const char *path,
+                                unsigned long (*handler)(const char *, char *,
+                                                         unsigned long)) {
+    struct stat st;
+
+    if (control.running) return -1;
+    if (strlen(path) >= sizeof(control.addr.sun_path)) return -1;
+
+    memset(&control.addr, 0, sizeof(control.addr));
+    control.addr.sun_family = AF_UNIX;
+    strcpy(control.addr.sun_path, path);
+    control.handler = handler;
+
+    if (pipe(control.wakeup) < 0) return -1;
+    control.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (control.listen_fd < 0) goto err_pipe;
+
+    // A socket of an earlier run is replaced, but no other file
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) goto err_socket;
+        unlink(path);
+    }
+    if (bind(control.listen_fd, (struct sockaddr *) &control.addr,
+             sizeof(control.addr)) < 0)
+        goto err_socket;
+    // The commands rewrite our code: only our user may connect. Until
+    // listen(), connecting is refused anyway.
+    if (chmod(path, S_IRUSR | S_IWUSR) < 0
+        || listen(control.listen_fd, 4) < 0)
+        goto err_bound;
+    if (pthread_create(&control.thread, NULL, control_thread, NULL) != 0)
+        goto err_bound;
+
+    control.running = 1;
+    return 0;
+
+err_bound:
+    unlink(path);
+err_socket:
+    close(control.listen_fd);
+err_pipe:
+    close(control.wakeup[0]);
+    close(control.wakeup[1]);
+    return -1;
+}
+
+void multiverse_os_control_stop(void) {
+    if (!control.running) return;
+    if (write(control.wakeup[1], "", 1) < 0) {
+        MV_ASSERT(0 && "cannot wake up the control thread");
+    }
+    pthread_join(control.thread, NULL);
+    close(control.listen_fd);
+    close(control.wakeup[0]);
+    close(control.wakeup[1]);
+    unlink(control.addr.sun_path);
+    control.running = 0;
+}
+
 
 void multiverse_os_print(const char* fmt, ...) {
     va_list args;
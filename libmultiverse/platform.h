@@ -18,6 +18,11 @@ extern "C" {
 */
 void *multiverse_os_addr_to_page(void *);
 
+/**
+ @brief The size of a page of the desired OS configuration
+*/
+unsigned long multiverse_os_pagesize(void);
+
 /**
  @brief Enable the memory protection of a page
 */
@@ -41,6 +46,73 @@ void multiverse_os_clear_caches(void);
 
 void* multiverse_os_malloc(size_t size);
 
+void multiverse_os_free(void *ptr);
+
+/**
+   @brief Release the memory of all pages that lie completely within [from, to)
+
+   The pages contain only code that will never be executed again. The
+   platform may drop them from memory or ignore the hint.
+*/
+void multiverse_os_discard(void *from, void *to);
+
+/**
+   @brief Allocate executable memory that is reachable with relative jumps from near
+
+   The memory is mapped read-only and executable; it is unprotected
+   like the text segment. Returns NULL, if the platform cannot provide
+   such memory.
+*/
+void *multiverse_os_alloc_text(void *near, size_t size, int huge_pages);
+
+/**
+   @brief Ask the platform to make the text pages of [from, to) resident
+
+   This is only a hint. The caller touches the pages afterwards anyway.
+*/
+void multiverse_os_prefault(void *from, void *to);
+
+/**
+   @brief A monotonic clock in nanoseconds, or 0 if there is none
+*/
+unsigned long long multiverse_os_now_ns(void);
+
+/**
+   @brief Create a named memory segment that other processes can map
+
+   Returns NULL, if the platform does not support shared memory.
+*/
+void *multiverse_os_shared_alloc(const char *name, size_t size);
+
+/**
+   @brief Read the cycle and instruction counters of the calling thread
+
+   The counters only count user-space execution. Returns -1, if the
+   platform provides no performance counters.
+*/
+int multiverse_os_perf_read(unsigned long long *cycles,
+                            unsigned long long *instructions);
+
+/**
+   @brief Serve control commands on a local socket in the background
+
+   The platform listens on the socket path and passes every received
+   line to the handler, which writes the reply like snprintf. Only
+   read-only commands produce replies that may be truncated; the
+   platform may repeat such a command with a larger buffer.
+
+   Returns -1, if the platform has no sockets or threads.
+*/
+int multiverse_os_control_start(const char *path,
+                                unsigned long (*handler)(const char *command,
+                                                         char *reply,
+                                                         unsigned long size));
+
+/**
+   @brief Stop the control server and remove its socket
+*/
+void multiverse_os_control_stop(void);
+
 
 void multiverse_os_print(const char* fmt, ...);
 
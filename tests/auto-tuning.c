@@ -0,0 +1,88 @@
+/*
+ * multiverse_pin_fn() commits a function to a given variant, regardless of
+ * its variables, which allows manual A/B measurements. multiverse_tune_fn()
+ * measures the selected variant against the generic function with a
+ * workload, and keeps the faster one.
+ */
+
+#include <stdio.h>
+#include "multiverse.h"
+#include "testsuite.h"
+
+typedef enum {false, true} bool;
+
+__attribute__((multiverse)) bool conf_a;
+
+
+int __attribute__((multiverse)) func(int x)
+{
+    if (conf_a) {
+        return x * 3;
+    }
+    return x + 1;
+}
+
+static volatile int sink;
+
+static void workload(void)
+{
+    int i;
+    for (i = 0; i < 1000; i++) {
+        sink += func(i);
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    struct mv_info_fn *fn;
+    struct mv_tune_result result;
+    void *variant;
+    int kept;
+
+    multiverse_init();
+    fn = multiverse_info_fn(&func);
+
+    conf_a = true;
+    assert(multiverse_commit() == 1);
+    variant = fn->active_mvfn->function_body;
+
+    // Pinned to the generic function, which still reads the variable
+    assert(multiverse_pin_fn(&func, &func) == 1);
+    assert(fn->active_mvfn == NULL);
+    assert(func(2) == 6);
+    assert(multiverse_commit() == 0);
+    assert(fn->active_mvfn == NULL);
+
+    // Pinned to the variant
+    assert(multiverse_pin_fn(&func, variant) == 1);
+    assert(fn->active_mvfn->function_body == variant);
+    assert(multiverse_pin_fn(&func, &main) == -1);
+
+    assert(multiverse_unpin_fn(&func) == 0);
+    assert(fn->active_mvfn->function_body == variant);
+
+    kept = multiverse_tune_fn(&func, workload, 10, &result);
+    assert(kept == 0 || kept == 1);
+    assert(result.variant == variant);
+    assert(result.source == MV_TUNE_PERF || result.source == MV_TUNE_TSC);
+    printf("generic: %llu cycles, variant: %llu cycles\n",
+           result.generic_cycles, result.variant_cycles);
+    if (kept) {
+        assert(result.winner == variant);
+        assert(fn->active_mvfn->function_body == variant);
+    } else {
+        // The rejected variant is not selected again
+        assert(result.winner == (void *) &func);
+        assert(fn->active_mvfn == NULL);
+        assert(multiverse_commit() == 0);
+        assert(fn->active_mvfn == NULL);
+    }
+    assert(func(2) == 6);
+
+    // Unpinning forgets the tuning results
+    assert(multiverse_unpin_fn(&func) == !kept);
+    assert(fn->active_mvfn->function_body == variant);
+
+    return 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * With the code cache, every variant that is selected by a commit is copied
+ * into a contiguous executable region and all callsites are patched to the
+ * copy. Semantically, nothing changes.
+ */
+
+#include "multiverse.h"
+#include "testsuite.h"
+
+__attribute__((multiverse)) int config;
+
+int counter;
+
+
+int __attribute__((multiverse)) step(int x)
+{
+    if (config) {
+        counter += x;
+        return counter;
+    }
+    return -x;
+}
+
+
+int main(int argc, char **argv)
+{
+    multiverse_init();
+
+    assert(multiverse_enable_code_cache(1 << 16, 0) == 0);
+    // Only one code cache is possible
+    assert(multiverse_enable_code_cache(1 << 16, 0) == -1);
+
+    config = 1;
+    assert(multiverse_commit_refs(&config) == 1);
+
+    struct mv_info_fn *fn = multiverse_info_fn(&step);
+    assert(fn->active_mvfn->cached_body != NULL);
+    assert(fn->active_mvfn->cached_body != fn->active_mvfn->function_body);
+
+    config = 0;
+    assert(step(2) == 2);
+    assert(step(3) == 5);
+
+    // Switching back and forth reuses the copy
+    void *cached = fn->active_mvfn->cached_body;
+    multiverse_commit_refs(&config);
+    assert(step(2) == -2);
+    config = 1;
+    multiverse_commit_refs(&config);
+    assert(fn->active_mvfn->cached_body == cached);
+    assert(step(1) == 6);
+
+    multiverse_revert();
+    config = 0;
+    assert(step(2) == -2);
+
+    return 0;
+}
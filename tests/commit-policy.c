@@ -0,0 +1,65 @@
+/*
+ * multiverse_set_policy() decides whether a commit patches only the entry of a
+ * generic function (MV_POLICY_ENTRY), or also all of its callsites
+ * (MV_POLICY_FULL). MV_POLICY_ADAPTIVE starts patching the callsites, once
+ * the variable kept its value for a number of commits.
+ */
+
+#include <stdio.h>
+#include "multiverse.h"
+#include "testsuite.h"
+
+typedef enum {false, true} bool;
+
+__attribute__((multiverse)) bool conf_a;
+
+
+int __attribute__((multiverse)) func(int x)
+{
+    if (conf_a) {
+        return x + 23;
+    }
+    return x + 42;
+}
+
+
+int main(int argc, char **argv)
+{
+    multiverse_init();
+
+    assert(multiverse_set_policy(&conf_a, 42, 0) == -1);
+    assert(multiverse_set_policy(&main, MV_POLICY_ENTRY, 0) == -1);
+
+    // Entry-only: every commit patches only the function entry
+    assert(multiverse_set_policy(&conf_a, MV_POLICY_ENTRY, 0) == 0);
+    conf_a = true;
+    assert(multiverse_commit() == 1);
+    assert(func(0) == 23);
+    conf_a = false;
+    assert(func(0) == 23);
+    assert(multiverse_commit() == 1);
+    assert(func(0) == 42);
+    assert(multiverse_commit() == 0);
+
+    // Adaptive: after two stable commits, the callsites are patched
+    assert(multiverse_set_policy(&conf_a, MV_POLICY_ADAPTIVE, 2) == 0);
+    assert(multiverse_commit() == 0);
+    assert(multiverse_commit() == 1);  // promotion to full patching
+    assert(multiverse_commit() == 0);
+    assert(func(0) == 42);
+
+    // A change falls back to entry-only patching
+    conf_a = true;
+    assert(multiverse_commit() == 1);
+    assert(func(0) == 23);
+
+    assert(multiverse_set_policy(&conf_a, MV_POLICY_FULL, 0) == 0);
+    assert(multiverse_commit() == 1);  // The callsites are patched
+    conf_a = false;
+    assert(func(0) == 23);
+
+    assert(multiverse_revert() == 1);
+    assert(func(0) == 42);
+
+    return 0;
+}
@@ -0,0 +1,67 @@
+/*
+ * Use multiverse_commit_refs_many(vars, n) to commit several multiverse
+ * variables at once. A function that references more than one of the
+ * variables is patched only once, and all functions are patched within a
+ * single transaction.
+ */
+
+#include <stdio.h>
+#include "multiverse.h"
+#include "testsuite.h"
+
+typedef enum {false, true} bool;
+
+__attribute__((multiverse)) bool conf_a;
+__attribute__((multiverse)) bool conf_b;
+__attribute__((multiverse)) bool conf_c;
+
+
+int __attribute((multiverse)) func_a()
+{
+    return conf_a;
+}
+
+
+int __attribute((multiverse)) func_ab()
+{
+    return conf_a + conf_b;
+}
+
+
+int __attribute((multiverse)) func_c()
+{
+    return conf_c;
+}
+
+
+int main(int argc, char **argv)
+{
+    void *vars[] = {&conf_a, &conf_b};
+
+    multiverse_init();
+
+    conf_a = true; conf_b = true; conf_c = true;
+    // func_a and func_ab are changed, func_ab only once
+    assert(multiverse_commit_refs_many(vars, 2) == 2);
+    assert(func_a() == 1 && func_ab() == 2 && func_c() == 1);
+
+    conf_a = false; conf_b = false; conf_c = false;
+    assert(func_a() == 1 && func_ab() == 2);
+    assert(func_c() == 0);  // func_c references neither variable
+
+    assert(multiverse_commit_refs_many(vars, 2) == 2);
+    assert(func_a() == 0 && func_ab() == 0);
+    assert(multiverse_commit_refs_many(vars, 2) == 0);
+
+    assert(multiverse_revert_refs_many(vars, 2) == 2);
+    conf_a = true;
+    assert(func_a() == 1 && func_ab() == 1);
+
+    // Test return value in case of error
+    bool dummy = 0;
+    void *invalid[] = {&conf_a, &dummy};
+    assert(multiverse_commit_refs_many(invalid, 2) == -1);
+    assert(!multiverse_is_committed(&func_a));
+
+    return 0;
+}
@@ -0,0 +1,105 @@
+/*
+ * The control commands inspect and change the multiverse state by name.
+ * multiverse_control_start() serves them on a UNIX socket for tools/mvctl;
+ * here, we execute them directly and over the socket.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "multiverse.h"
+#include "testsuite.h"
+
+#define SOCKET "/tmp/multiverse-control-plane.sock"
+
+typedef enum {false, true} bool;
+
+__attribute__((multiverse)) bool conf_a;
+
+
+int __attribute__((multiverse)) func()
+{
+    if (conf_a) {
+        return 23;
+    }
+    return 42;
+}
+
+int call_func()
+{
+    return func() + 1;
+}
+
+static char reply[4096];
+
+static const char *exec(const char *command)
+{
+    multiverse_control_exec(command, reply, sizeof(reply));
+    return reply;
+}
+
+static const char *exec_socket(const char *command)
+{
+    struct sockaddr_un addr;
+    ssize_t len = 0, n;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, SOCKET);
+    assert(connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+    assert(write(fd, command, strlen(command)) == (ssize_t) strlen(command));
+    assert(write(fd, "\n", 1) == 1);
+    while (len == 0 || reply[len - 1] != '\n'
+           || !(strstr(reply, "ok\n") || strstr(reply, "error "))) {
+        n = read(fd, reply + len, sizeof(reply) - 1 - len);
+        assert(n > 0);
+        len += n;
+        reply[len] = 0;
+    }
+    close(fd);
+    return reply;
+}
+
+
+int main(int argc, char **argv)
+{
+    char small[8];
+
+    multiverse_init();
+
+    assert(strstr(exec("functions"), "func active=generic variants=2"));
+    assert(strstr(exec("variables"), "conf_a value=0 width=1"));
+
+    assert(strcmp(exec("set conf_a 1"), "ok\n") == 0);
+    assert(conf_a == true);
+    assert(strcmp(exec("commit var conf_a"), "changed=1\nok\n") == 0);
+    assert(call_func() == 24);
+    assert(!strstr(exec("functions"), "active=generic"));
+
+    assert(strcmp(exec("revert fn func"), "changed=1\nok\n") == 0);
+    assert(call_func() == 24);
+    assert(strstr(exec("functions"), "active=generic"));
+
+    assert(strncmp(exec("set conf_a 256"), "error", 5) == 0);
+    assert(strncmp(exec("commit fn unknown"), "error", 5) == 0);
+    assert(strncmp(exec("bind conf_a 1"), "error", 5) == 0);
+    assert(strncmp(exec("frobnicate"), "error", 5) == 0);
+    assert(strstr(exec("stats"), "transactions=2\n"));
+
+    // The reply is truncated like snprintf
+    assert(multiverse_control_exec("dump", small, sizeof(small)) > sizeof(small));
+    assert(strlen(small) == sizeof(small) - 1);
+
+    assert(multiverse_control_start(SOCKET) == 0);
+    assert(strcmp(exec_socket("set conf_a 0"), "ok\n") == 0);
+    assert(strcmp(exec_socket("commit"), "changed=1\nok\n") == 0);
+    assert(call_func() == 43);
+    assert(strncmp(exec_socket("dump"), "{\"functions\":", 13) == 0);
+    multiverse_control_stop();
+    assert(access(SOCKET, F_OK) != 0);
+
+    return 0;
+}
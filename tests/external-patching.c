@@ -0,0 +1,105 @@
+/*
+ * mvpatch commits a running process from outside. The parent lists a waiting
+ * child and prints the changes with mvpatch -l and -n. After
+ * multiverse_init_lazy(), the child's descriptors are linked, and mvpatch
+ * refuses to patch it without -f.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include "multiverse.h"
+#include "testsuite.h"
+
+#define MVPATCH "../tools/mvpatch"
+
+typedef enum {false, true} bool;
+
+__attribute__((multiverse)) bool conf_a;
+
+
+int __attribute__((multiverse)) func()
+{
+    if (conf_a) {
+        return 23;
+    }
+    return 42;
+}
+
+
+static pid_t child;
+
+static void start_child(int init)
+{
+    int ready[2];
+    char c;
+
+    assert(pipe(ready) == 0);
+    child = fork();
+    assert(child >= 0);
+    if (child == 0) {
+        // mvpatch is no ancestor of the child
+        prctl(PR_SET_PTRACER, PR_SET_PTRACER_ANY);
+        if (init)
+            multiverse_init_lazy();
+        conf_a = true;
+        assert(write(ready[1], "x", 1) == 1);
+        for (;;)
+            pause();
+    }
+    assert(read(ready[0], &c, 1) == 1);
+    close(ready[0]);
+    close(ready[1]);
+}
+
+
+static void stop_child()
+{
+    kill(child, SIGKILL);
+    waitpid(child, NULL, 0);
+}
+
+
+/* Runs mvpatch on the child and returns its exit status */
+static int mvpatch(const char *args, char *out, size_t size)
+{
+    char command[128];
+    FILE *output;
+    size_t len;
+
+    snprintf(command, sizeof(command), MVPATCH " %s %d 2>&1", args, child);
+    output = popen(command, "r");
+    assert(output);
+    len = fread(out, 1, size - 1, output);
+    out[len] = '\0';
+    printf("$ mvpatch %s\n%s", args, out);
+    return WEXITSTATUS(pclose(output));
+}
+
+
+int main(int argc, char **argv)
+{
+    char out[4096];
+
+    start_child(0);
+    assert(mvpatch("-l", out, sizeof(out)) == 0);
+    assert(strstr(out, "func active=generic variants=2"));
+    assert(strstr(out, "conf_a value=1"));
+    assert(mvpatch("-n", out, sizeof(out)) == 0);
+    assert(strstr(out, "1 functions would change"));
+    stop_child();
+
+    // The run-time library linked the descriptors
+    start_child(1);
+    assert(mvpatch("-n", out, sizeof(out)) == 1);
+    assert(strstr(out, "initialized the run-time library"));
+    assert(mvpatch("-n -f", out, sizeof(out)) == 0);
+    assert(strstr(out, "1 functions would change"));
+    stop_child();
+
+    return 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * A bitmask variable with ("bits", MASK) is specialized only for the bits of
+ * MASK that a function tests (opts & BIT). The variants are selected with
+ * (value & mask) == pattern; the other bits stay dynamic.
+ */
+
+#include <stdio.h>
+#include "multiverse.h"
+#include "testsuite.h"
+
+#define OPT_FAST  0x1
+#define OPT_LOG   0x2
+#define OPT_OTHER 0x4
+#define OPT_TRACE 0x8
+
+__attribute__((multiverse(("bits", OPT_FAST | OPT_LOG | OPT_TRACE)))) unsigned opts;
+
+
+int __attribute__((multiverse)) work(int x)
+{
+    if (opts & OPT_FAST)
+        x *= 2;
+    if (opts & OPT_LOG)
+        x += 1;
+    if (opts & OPT_OTHER)      // Not in the mask
+        x += 100;
+    return x;
+}
+
+
+int __attribute__((multiverse)) logging()
+{
+    return (opts & (OPT_LOG | OPT_TRACE)) != 0;
+}
+
+
+int main(int argc, char **argv)
+{
+    multiverse_init();
+
+    multiverse_dump_info();
+
+    // work(): OPT_FAST and OPT_LOG are tested, 4 patterns
+    assert(desc_count(&work) == 4);
+    assert(body_count(&work) == 4);
+
+    opts = OPT_FAST | OPT_OTHER;
+    multiverse_commit_fn(&work);
+    assert(multiverse_is_committed(&work));
+    assert(work(1) == 102);
+
+    opts = OPT_TRACE;
+    multiverse_commit_fn(&work);
+    assert(multiverse_is_committed(&work));
+    assert(work(1) == 1);
+
+    // logging(): 4 patterns of OPT_LOG and OPT_TRACE, 2 bodies. The three
+    // patterns that log are covered by OPT_LOG set, and OPT_TRACE set.
+    printf("desc count = %d\n", desc_count(&logging));
+    assert(desc_count(&logging) == 3);
+    assert(body_count(&logging) == 2);
+    for (opts = 0; opts < 16; opts++) {
+        multiverse_commit_fn(&logging);
+        assert(multiverse_is_committed(&logging));
+        assert(logging() == ((opts & (OPT_LOG | OPT_TRACE)) != 0));
+    }
+
+    return 0;
+}
@@ -18,6 +18,10 @@ int __attribute((multiverse)) func()
 
 int main(int argc, char **argv)
 {
+    // A value the plugin cannot infer: the values of a are guessed from
+    // the comparisons in func() (see stored-values.c)
+    a = argc - 1;
+
     multiverse_init();
 
     multiverse_dump_info();
@@ -0,0 +1,56 @@
+/*
+ * With -fplugin-arg-multiverse-hotness, the generic body of every multiverse
+ * function counts its calls. A committed function jumps to its variant at the
+ * entry, so the counter stops once the function is committed, and runs again
+ * after a revert. The Makefile passes the plugin argument for this test.
+ */
+
+#include <stdio.h>
+#include "multiverse.h"
+#include "testsuite.h"
+
+typedef enum {false, true} bool;
+
+__attribute__((multiverse)) bool conf_a;
+
+
+int __attribute__((multiverse)) func()
+{
+    if (conf_a) {
+        return 23;
+    }
+    return 42;
+}
+
+
+int main(int argc, char **argv)
+{
+    struct mv_info_fn *fn;
+    long hits;
+    int i;
+
+    multiverse_init();
+    fn = multiverse_info_fn(&func);
+    assert(fn->hits != NULL);
+
+    hits = multiverse_fn_hits(&func);
+    for (i = 0; i < 10; i++) {
+        assert(func() == 42);
+    }
+    assert(multiverse_fn_hits(&func) == hits + 10);
+
+    // Committed: the generic body is not executed anymore
+    conf_a = true;
+    assert(multiverse_commit() == 1);
+    for (i = 0; i < 10; i++) {
+        assert(func() == 23);
+    }
+    assert(multiverse_fn_hits(&func) == hits + 10);
+
+    // Reverted: counting again
+    assert(multiverse_revert() == 1);
+    assert(func() == 23);
+    assert(multiverse_fn_hits(&func) == hits + 11);
+
+    return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * The iterator API walks over all functions, variables, and patchpoints, and
+ * shows which variant is active. multiverse_dump_json() writes the same state
+ * as JSON, so that a deployment can be checked by a script.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "multiverse.h"
+#include "testsuite.h"
+
+typedef enum {false, true} bool;
+
+__attribute__((multiverse)) bool conf_a;
+
+
+int __attribute__((multiverse)) func()
+{
+    if (conf_a) {
+        return 23;
+    }
+    return 42;
+}
+
+int call_func()
+{
+    return func() + 1;
+}
+
+
+int main(int argc, char **argv)
+{
+    struct mv_info_fn *fn = NULL;
+    struct mv_info_var *var = NULL;
+    struct mv_patchpoint *pp = NULL;
+    int n_functions = 0, n_variables = 0, n_entries = 0, n_callsites = 0;
+    char small[8], *buf;
+    unsigned long len;
+
+    multiverse_init();
+    conf_a = true;
+    assert(multiverse_commit() == 1);
+    assert(call_func() == 24);
+
+    while ((fn = multiverse_next_fn(fn)) != NULL) {
+        assert(fn == multiverse_info_fn(&func));
+        assert(fn->active_mvfn != NULL);
+        assert(strcmp(multiverse_mvfn_type_name(fn->active_mvfn->type), "constant") == 0);
+        n_functions++;
+    }
+    assert(n_functions == 1);
+
+    while ((var = multiverse_next_var(var)) != NULL) {
+        assert(var == multiverse_info_var(&conf_a));
+        assert(var->functions_head->fn == multiverse_info_fn(&func));
+        n_variables++;
+    }
+    assert(n_variables == 1);
+
+    fn = multiverse_info_fn(&func);
+    while ((pp = multiverse_next_patchpoint(fn, pp)) != NULL) {
+        struct mv_patchpoint_info info;
+        assert(multiverse_patchpoint_info(pp, &info) == 0);
+        assert(info.target == fn->active_mvfn->function_body);
+        if (info.is_entry) {
+            assert(info.location == (void *) &func);
+            n_entries++;
+        } else {
+            n_callsites++;
+        }
+    }
+    assert(n_entries == 1);
+    assert(n_callsites >= 1);
+
+    // The dump is truncated like snprintf
+    len = multiverse_dump_json(small, sizeof(small));
+    assert(len >= sizeof(small));
+    assert(strlen(small) == sizeof(small) - 1);
+
+    buf = malloc(len + 1);
+    assert(multiverse_dump_json(buf, len + 1) == len);
+    assert(strstr(buf, "\"name\":\"func\"") != NULL);
+    assert(strstr(buf, "\"type\":\"constant\",\"constant\":23") != NULL);
+    assert(strstr(buf, "\"name\":\"conf_a\"") != NULL);
+    printf("%s", buf);
+    free(buf);
+
+    // After revert, the original code is in place
+    assert(multiverse_revert() == 1);
+    while ((pp = multiverse_next_patchpoint(fn, pp)) != NULL) {
+        struct mv_patchpoint_info info;
+        multiverse_patchpoint_info(pp, &info);
+        assert(info.target == NULL);
+    }
+
+    return 0;
+}
@@ -5,6 +5,9 @@
  *
  * In case a variable's value exceeds the [0,1] range while committing, the
  * run-time system falls back to the generic function.
+ *
+ * Here, config is assigned a value the plugin cannot infer, otherwise the
+ * constants stored to it would be its values (see stored-values.c).
  */
 
 #include <stdio.h>
@@ -22,6 +25,8 @@ int __attribute((multiverse, noinline)) foo()
 
 int main(int argc, char **argv)
 {
+    config = argc - 1;
+
     multiverse_init();
 
     // Check the static property of multiverse variants
@@ -0,0 +1,49 @@
+/*
+ * With MV_POLICY_LAZY, a commit only redirects the generic function entry to a
+ * fixup stub. Each callsite is patched by its first call after the commit.
+ */
+
+#include <stdio.h>
+#include "multiverse.h"
+#include "testsuite.h"
+
+typedef enum {false, true} bool;
+
+__attribute__((multiverse)) bool conf_a;
+
+
+double __attribute__((multiverse)) func(int a, double b, long c)
+{
+    if (conf_a) {
+        return a + b + c;
+    }
+    return a * b * c;
+}
+
+
+int main(int argc, char **argv)
+{
+    int i;
+
+    multiverse_init();
+    assert(multiverse_set_policy(&conf_a, MV_POLICY_LAZY, 0) == 0);
+
+    conf_a = true;
+    assert(multiverse_commit() == 1);
+    conf_a = false;
+    // The first call goes through the fixup stub, the arguments survive
+    for (i = 0; i < 3; i++) {
+        assert(func(2, 3.0, 4) == 9.0);
+    }
+    assert(multiverse_commit() == 1);
+    for (i = 0; i < 3; i++) {
+        assert(func(2, 3.0, 4) == 24.0);
+    }
+    assert(multiverse_commit() == 0);
+
+    conf_a = true;
+    assert(multiverse_revert() == 1);
+    assert(func(2, 3.0, 4) == 9.0);
+
+    return 0;
+}
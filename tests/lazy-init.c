@@ -0,0 +1,59 @@
+/*
+ * multiverse_init_lazy() only connects the descriptors. A function is decoded
+ * the first time it is committed; functions that are never committed are never
+ * decoded.
+ */
+
+#include <stdio.h>
+#include "multiverse.h"
+#include "testsuite.h"
+
+typedef enum {false, true} bool;
+
+__attribute__((multiverse)) bool conf_a;
+__attribute__((multiverse)) bool conf_b;
+
+
+int __attribute__((multiverse)) func_a()
+{
+    if (conf_a) {
+        return 23;
+    }
+    return 42;
+}
+
+
+int __attribute__((multiverse)) func_b()
+{
+    if (conf_b) {
+        return 5;
+    }
+    return 7;
+}
+
+
+int main(int argc, char **argv)
+{
+    multiverse_init_lazy();
+
+    assert(!multiverse_info_fn(&func_a)->decoded);
+    assert(!multiverse_info_fn(&func_b)->decoded);
+
+    conf_a = true;
+    assert(multiverse_commit_refs(&conf_a) == 1);
+    assert(multiverse_info_fn(&func_a)->decoded);
+    assert(!multiverse_info_fn(&func_b)->decoded);
+    conf_a = false;
+    assert(func_a() == 23);
+
+    // The callsites were decoded as well
+    assert(multiverse_commit() == 2);
+    assert(func_a() == 42 && func_b() == 7);
+    conf_b = true;
+    assert(func_b() == 7);
+
+    assert(multiverse_revert() == 2);
+    assert(func_a() == 42 && func_b() == 5);
+
+    return 0;
+}
@@ -0,0 +1,59 @@
+/*
+ * Multi-object build with -flto. The variants and descriptors of module.c
+ * survive the link, and the callsites in main.c, which are labeled at link
+ * time, get patched.
+ */
+
+#include <stdio.h>
+#include "multiverse.h"
+#include "testsuite.h"
+
+#include "module.h"
+
+
+/* The patched callsites of a function that call its active variant */
+static int patched_callsites(void *function)
+{
+    struct mv_info_fn *fn = multiverse_info_fn(function);
+    struct mv_patchpoint *pp = NULL;
+    int n = 0;
+
+    assert(fn && fn->active_mvfn);
+    while ((pp = multiverse_next_patchpoint(fn, pp)) != NULL) {
+        struct mv_patchpoint_info info;
+        assert(multiverse_patchpoint_info(pp, &info) == 0);
+        assert(info.target == fn->active_mvfn->function_body);
+        if (!info.is_entry)
+            n++;
+    }
+    return n;
+}
+
+
+int main(int argc, char **argv)
+{
+    multiverse_init();
+
+    assert(desc_count(&func_a) == 2);
+    assert(func_a() == 42);
+
+    conf_a = true;
+    assert(multiverse_commit_refs(&conf_a) == 1);
+    assert(multiverse_is_committed(&func_a));
+    assert(patched_callsites(&func_a) >= 1);
+    conf_a = false;
+    assert(func_a() == 23);
+
+    assert(func_b() == 8);
+    conf_b = true;
+    assert(multiverse_commit_refs(&conf_b) == 1);
+    assert(multiverse_is_committed(&func_b));
+    assert(patched_callsites(&func_b) >= 1);
+    conf_b = false;
+    assert(func_b() == 7);
+
+    assert(multiverse_revert() == 2);
+    assert(func_a() == 42 && func_b() == 8);
+
+    return 0;
+}
@@ -0,0 +1,20 @@
+#include "module.h"
+
+__attribute__((multiverse)) bool conf_a;
+__attribute__((multiverse)) bool conf_b;
+
+
+int __attribute__((multiverse)) func_a()
+{
+    if (conf_a)
+        return 23;
+    return 42;
+}
+
+
+int __attribute__((multiverse)) func_b()
+{
+    if (conf_b)
+        return 7;
+    return 8;
+}
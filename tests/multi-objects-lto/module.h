@@ -0,0 +1,9 @@
+#include "multiverse.h"
+
+typedef enum {false, true} bool;
+
+extern __attribute__((multiverse)) bool conf_a;
+extern __attribute__((multiverse)) bool conf_b;
+
+int __attribute__((multiverse)) func_a();
+int __attribute__((multiverse)) func_b();
@@ -0,0 +1,80 @@
+/*
+ * multiverse_plan_commit() computes the code changes of a commit without
+ * touching the text segment. A plan describes the complete target state, so
+ * it can be applied several times to switch between known configurations.
+ */
+
+#include <stdio.h>
+#include "multiverse.h"
+#include "testsuite.h"
+
+typedef enum {false, true} bool;
+
+__attribute__((multiverse)) bool conf_a;
+
+
+int __attribute__((multiverse)) func()
+{
+    if (conf_a) {
+        return 23;
+    }
+    return 42;
+}
+
+
+int main(int argc, char **argv)
+{
+    struct mv_plan *plan_a, *plan_b, *plan_revert;
+    unsigned i;
+
+    multiverse_init();
+
+    conf_a = false;
+    plan_a = multiverse_plan_commit();
+    assert(plan_a != NULL);
+    for (i = 0; i < plan_a->n_functions; i++) {
+        if (plan_a->functions[i].fn == multiverse_info_fn(&func)) {
+            assert(plan_a->functions[i].changed);
+            assert(plan_a->functions[i].mvfn != NULL);
+            assert(plan_a->functions[i].n_patches > 0);
+        }
+    }
+    // Planning is a dry run
+    assert(!multiverse_is_committed(&func));
+
+    conf_a = true;
+    plan_b = multiverse_plan_commit();
+    plan_revert = multiverse_plan_revert();
+    assert(plan_b != NULL && plan_revert != NULL);
+
+    assert(multiverse_plan_apply(plan_a) == 1);
+    assert(func() == 42);
+    assert(multiverse_plan_apply(plan_a) == 0);
+
+    // Switch back and forth
+    for (i = 0; i < 10; i++) {
+        assert(multiverse_plan_apply(plan_b) == 1);
+        assert(func() == 23);
+        assert(multiverse_plan_apply(plan_a) == 1);
+        assert(func() == 42);
+    }
+
+    assert(multiverse_plan_apply(plan_revert) == 1);
+    assert(!multiverse_is_committed(&func));
+    assert(func() == 23);
+    conf_a = false;
+    assert(func() == 42);
+
+    // Plans and ordinary commits can be mixed
+    conf_a = true;
+    assert(multiverse_commit() == 1);
+    assert(multiverse_plan_apply(plan_a) == 1);
+    assert(func() == 42);
+    assert(multiverse_revert() == 1);
+
+    multiverse_plan_free(plan_a);
+    multiverse_plan_free(plan_b);
+    multiverse_plan_free(plan_revert);
+
+    return 0;
+}
@@ -0,0 +1,55 @@
+/*
+ * Data pointers are specialized for NULL and non-NULL. The non-NULL variant
+ * drops the NULL tests, but still uses the current value of the pointer.
+ */
+
+#include <stdio.h>
+#include "multiverse.h"
+#include "testsuite.h"
+
+struct tracer {
+    int count;
+};
+
+__attribute__((multiverse)) struct tracer *tracer;
+
+
+int __attribute__((multiverse)) step(int x)
+{
+    if (tracer)
+        tracer->count++;
+    return x + 1;
+}
+
+
+int main(int argc, char **argv)
+{
+    struct tracer a = {0}, b = {0};
+
+    multiverse_init();
+
+    multiverse_dump_info();
+
+    assert(desc_count(&step) == 2);
+    assert(body_count(&step) == 2);
+
+    tracer = NULL;
+    multiverse_commit_fn(&step);
+    assert(multiverse_is_committed(&step));
+    assert(step(1) == 2);
+
+    tracer = &a;
+    multiverse_commit_fn(&step);
+    assert(multiverse_is_committed(&step));
+    assert(step(1) == 2);
+    assert(a.count == 1);
+
+    // Another non-NULL pointer selects the same variant
+    tracer = &b;
+    multiverse_commit_fn(&step);
+    assert(multiverse_is_committed(&step));
+    step(1);
+    assert(a.count == 1 && b.count == 1);
+
+    return 0;
+}
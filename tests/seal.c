@@ -0,0 +1,50 @@
+/*
+ * multiverse_seal() commits all functions for the last time. Afterwards, all
+ * multiverse variables are frozen: Their functions cannot be committed to a
+ * different variant or reverted anymore. The pages of the variants that can
+ * never be selected again are given back to the operating system.
+ */
+
+#include <stdio.h>
+#include "multiverse.h"
+#include "testsuite.h"
+
+typedef enum {false, true} bool;
+
+__attribute__((multiverse("tracked"))) bool conf_a;
+
+
+int __attribute__((multiverse)) func()
+{
+    if (conf_a) {
+        return 23;
+    }
+    return 42;
+}
+
+
+int main(int argc, char **argv)
+{
+    multiverse_init();
+
+    multiverse_bind(&conf_a, 1);
+    conf_a = true;
+    assert(multiverse_seal() == 1);
+    assert(multiverse_is_committed(&func));
+    assert(func() == 23);
+
+    // The variable is frozen
+    conf_a = false;
+    assert(func() == 23);
+    assert(multiverse_commit_refs(&conf_a) == -1);
+    assert(multiverse_revert_fn(&func) == -1);
+    assert(multiverse_bind(&conf_a, 0) == -1);
+    assert(func() == 23);
+
+    // Nothing changes: the selected variant stays in place
+    conf_a = true;
+    assert(multiverse_commit() == 0);
+    assert(func() == 23);
+
+    return 0;
+}
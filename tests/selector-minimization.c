@@ -0,0 +1,75 @@
+/*
+ * The selectors of equal variants are replaced by a minimal set of boxes
+ * (an interval per variable) that covers the same assignments. Intervals
+ * only join neighboring values: a variant is not specialized for values
+ * between the enumerated ones.
+ */
+
+#include <stdio.h>
+#include "multiverse.h"
+#include "testsuite.h"
+
+typedef enum {false, true} bool;
+typedef enum {off, low, medium, high} power_t;
+typedef enum {level_none = 0, level_some = 1, level_all = 4} level_t;
+
+__attribute__((multiverse)) bool flag;
+__attribute__((multiverse)) power_t mode;
+__attribute__((multiverse)) level_t level;
+
+
+int __attribute__((multiverse)) expensive()
+{
+    if (mode >= medium && flag) {
+        printf("Do some very complex stuff\n");
+        return 1;
+    }
+    return 0;
+}
+
+
+int __attribute__((multiverse)) partial()
+{
+    return level != level_some;
+}
+
+
+int main(int argc, char **argv)
+{
+    multiverse_init();
+
+    multiverse_dump_info();
+
+    // expensive(): 8 assignments, 2 bodies. One box for mode in
+    // [medium,high] with flag set; two boxes for the rest (mode in
+    // [off,low], and flag cleared).
+    printf("desc count = %d\n", desc_count(&expensive));
+    assert(desc_count(&expensive) == 3);
+    assert(body_count(&expensive) == 2);
+    for (mode = off; mode <= high; mode++) {
+        for (flag = false; flag <= true; flag++) {
+            multiverse_commit_fn(&expensive);
+            assert(multiverse_is_committed(&expensive));
+            assert(expensive() == (mode >= medium && flag));
+        }
+    }
+
+    // partial(): level_none and level_all share a body, but 2 and 3 are
+    // no enumerated values, so their selectors stay apart.
+    printf("desc count = %d\n", desc_count(&partial));
+    assert(desc_count(&partial) == 3);
+    assert(body_count(&partial) == 2);
+
+    level = level_all;
+    multiverse_commit_fn(&partial);
+    assert(multiverse_is_committed(&partial));
+    assert(partial() == 1);
+
+    // No variant for 2: the generic body is used
+    level = 2;
+    multiverse_commit_fn(&partial);
+    assert(!multiverse_is_committed(&partial));
+    assert(partial() == 1);
+
+    return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * multiverse_get_stats() counts what the run-time system did: every commit,
+ * revert, and applied plan is a transaction, and each transaction records how
+ * many functions and patchpoints it changed. The footprint section reports the
+ * memory that is spent on the multiverse descriptors and the variants.
+ */
+
+#include <stdio.h>
+#include "multiverse.h"
+#include "testsuite.h"
+
+typedef enum {false, true} bool;
+
+__attribute__((multiverse)) bool conf_a;
+
+
+int __attribute__((multiverse)) func()
+{
+    if (conf_a) {
+        return 23;
+    }
+    return 42;
+}
+
+
+int main(int argc, char **argv)
+{
+    struct mv_stats before, after;
+    unsigned long transactions = 0;
+    int i;
+
+    multiverse_init();
+    assert(multiverse_get_stats(&before) == 0);
+    assert(before.version == MV_STATS_VERSION);
+    assert(before.size == sizeof(struct mv_stats));
+    assert(before.sequence % 2 == 0);
+
+    conf_a = true;
+    assert(multiverse_commit() == 1);
+    assert(func() == 23);
+    conf_a = false;
+    assert(multiverse_commit() == 1);
+    assert(func() == 42);
+    assert(multiverse_revert() == 1);
+
+    assert(multiverse_get_stats(&after) == 0);
+    assert(after.transactions == before.transactions + 3);
+    assert(after.sequence == before.sequence + 6);
+    assert(after.functions_changed == before.functions_changed + 3);
+    assert(after.patchpoints_written > before.patchpoints_written);
+    assert(after.mprotect_calls >= after.pages_unprotected);
+    assert(after.latency_ns_max <= after.latency_ns_total);
+    for (i = 0; i < MV_STATS_HISTOGRAM; i++) {
+        transactions += after.latency_histogram[i];
+    }
+    assert(transactions == after.transactions);
+
+    // Nothing to do is still a transaction, but nothing is changed
+    assert(multiverse_revert() == 0);
+    assert(multiverse_get_stats(&before) == 0);
+    assert(before.transactions == after.transactions + 1);
+    assert(before.functions_changed == after.functions_changed);
+
+    // The footprint
+    assert(after.descriptor_bytes > 0);
+    assert(after.patchpoint_bytes > 0);
+    assert(after.ref_bytes > 0);
+    assert(after.variant_text_bytes > 0);
+    assert(multiverse_fn_variant_bytes(&func) > 0);
+    assert(multiverse_fn_variant_bytes(&main) == -1);
+
+    return 0;
+}
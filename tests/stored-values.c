@@ -0,0 +1,73 @@
+/*
+ * Without a values attribute, an integer multiverse variable is
+ * specialized for the constants that the translation unit stores to it,
+ * and for its initial value. If the variable gets other values (or its
+ * address escapes), the plugin warns and falls back to the comparisons
+ * in the function, or to [0,1].
+ */
+
+#include <stdio.h>
+#include "multiverse.h"
+#include "testsuite.h"
+
+__attribute__((multiverse)) int level = 1;
+__attribute__((multiverse)) int other;
+
+
+int __attribute__((multiverse)) scale(int x)
+{
+    return x * level;
+}
+
+
+int __attribute__((multiverse)) limit()
+{
+    if (other == 5)
+        return 1;
+    return 0;
+}
+
+
+static void set_level(int verbose)
+{
+    if (verbose)
+        level = 8;
+    else
+        level = 3;
+}
+
+
+int main(int argc, char **argv)
+{
+    set_level(argc > 1);
+    other = argc + 4;          // Not a constant, values from the hints
+
+    multiverse_init();
+
+    multiverse_dump_info();
+
+    // level: 1 (initial value), 3, and 8
+    assert(desc_count(&scale) == 3);
+    level = 1;
+    multiverse_commit_fn(&scale);
+    assert(multiverse_is_committed(&scale) && scale(2) == 2);
+    level = 8;
+    multiverse_commit_fn(&scale);
+    assert(multiverse_is_committed(&scale) && scale(2) == 16);
+
+    // No variant for a value that the program does not store
+    char reply[256];
+    multiverse_control_exec("set level 2", reply, sizeof(reply));
+    multiverse_commit_fn(&scale);
+    assert(!multiverse_is_committed(&scale));
+    assert(scale(2) == 4);
+
+    // other: only 5 from the comparison
+    assert(desc_count(&limit) == 1);
+    other = 5;
+    multiverse_commit_fn(&limit);
+    assert(multiverse_is_committed(&limit));
+    assert(limit() == 1);
+
+    return 0;
+}
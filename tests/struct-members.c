@@ -0,0 +1,103 @@
+/*
+ * Members of global struct variables can be multiverse variables. Every
+ * struct variable has its own multiverse members, which are named after it
+ * (cfg.verbose, cfg.sub.mode); the other members stay dynamic.
+ */
+
+#include <stdio.h>
+#include "multiverse.h"
+#include "testsuite.h"
+
+typedef enum {false, true} bool;
+typedef enum {slow, fast} pace_t;
+
+struct config {
+    __attribute__((multiverse)) bool verbose;
+    int level;
+    struct {
+        __attribute__((multiverse)) pace_t mode;
+    } sub;
+};
+
+struct config cfg = { .level = 3 };
+struct config other;
+
+
+int __attribute__((multiverse)) report()
+{
+    if (cfg.verbose)
+        return cfg.level * 2;
+    return cfg.level;
+}
+
+
+int __attribute__((multiverse)) run()
+{
+    if (cfg.sub.mode == fast)
+        return 1;
+    return other.verbose ? 2 : 0;
+}
+
+
+/* Stores to the struct, or to a struct on the path, change the members */
+int __attribute__((multiverse)) reset(int level)
+{
+    struct config defaults = { .verbose = true, .level = level };
+    cfg = defaults;
+    return cfg.verbose;
+}
+
+
+int __attribute__((multiverse)) speed_up()
+{
+    typeof(cfg.sub) sub = { .mode = fast };
+    cfg.sub = sub;
+    return cfg.sub.mode == fast;
+}
+
+
+int main(int argc, char **argv)
+{
+    multiverse_init();
+
+    multiverse_dump_info();
+
+    assert(multiverse_info_var(&cfg.verbose) != NULL);
+    assert(multiverse_info_var(&cfg.sub.mode) != NULL);
+    assert(multiverse_info_var(&other.verbose) != NULL);
+    assert(multiverse_info_var(&cfg.level) == NULL);
+    assert(multiverse_info_var_by_name("cfg.sub.mode") != NULL);
+
+    // report(): cfg.verbose, cfg.level stays dynamic
+    assert(desc_count(&report) == 2);
+    cfg.verbose = true;
+    multiverse_commit_refs(&cfg.verbose);
+    assert(multiverse_is_committed(&report));
+    assert(report() == 6);
+    cfg.level = 4;
+    assert(report() == 8);
+
+    // run(): cfg.sub.mode and other.verbose
+    assert(desc_count(&run) == 4);
+    cfg.sub.mode = slow;
+    other.verbose = true;
+    multiverse_commit_fn(&run);
+    assert(multiverse_is_committed(&run));
+    assert(run() == 2);
+
+    // The variants of other.verbose are not selected by cfg.verbose
+    other.verbose = false;
+    multiverse_commit_refs(&cfg.verbose);
+    assert(run() == 2);
+    multiverse_commit_refs(&other.verbose);
+    assert(run() == 0);
+
+    // reset() and speed_up() are not specialized for the members they store
+    cfg.verbose = false;
+    cfg.sub.mode = slow;
+    multiverse_commit();
+    assert(reset(3) == true);
+    assert(speed_up() == true);
+
+    return 0;
+}
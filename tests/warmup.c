@@ -0,0 +1,58 @@
+/*
+ * With multiverse_set_warmup(MV_WARMUP_STUBS), a commit calls the registered
+ * warm-up stubs of all functions it changed before it returns.
+ */
+
+#include <stdio.h>
+#include "multiverse.h"
+#include "testsuite.h"
+
+typedef enum {false, true} bool;
+
+__attribute__((multiverse)) bool conf_a;
+
+static int warmup_calls, warmup_result;
+
+
+int __attribute__((multiverse)) func(int x)
+{
+    if (conf_a) {
+        return x + 23;
+    }
+    return x + 42;
+}
+
+
+static void func_warmup(void)
+{
+    warmup_calls++;
+    warmup_result = func(0);
+}
+
+
+int main(int argc, char **argv)
+{
+    multiverse_init();
+
+    assert(multiverse_register_warmup(&func, func_warmup) == 0);
+    assert(multiverse_register_warmup(&main, func_warmup) == -1);
+
+    // Warm-up is disabled by default
+    assert(multiverse_commit() == 1);
+    assert(warmup_calls == 0);
+
+    assert(multiverse_set_warmup(MV_WARMUP_PREFAULT | MV_WARMUP_STUBS) == 0);
+    conf_a = true;
+    assert(multiverse_commit() == 1);
+    assert(warmup_calls == 1 && warmup_result == 23);
+
+    // Nothing changed, nothing to warm up
+    assert(multiverse_commit() == 0);
+    assert(warmup_calls == 1);
+
+    conf_a = false;
+    assert(multiverse_revert() == 1);
+    assert(warmup_calls == 2 && warmup_result == 42);
+
+    return 0;
+}
@@ -0,0 +1,284 @@
+/* mv-objdump - show what the multiverse plugin emitted into an ELF file
+
+   Usage: mv-objdump [-s] file
+
+   Works on executables, shared objects, and object files (x86-64).
+   The descriptor sections are read from the file, and their pointers
+   are resolved with the relocations of the file. For every function,
+   the variants are listed with their assignment ranges, decoded type,
+   and text size, followed by the callsites that could not be decoded
+   (the run-time library skips those, so they keep calling the generic
+   function). A summary with the variant bytes per function closes the
+   output; with -s, only the summary is printed. */
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "multiverse.h"
+#include "mv_commit.h"
+#include "arch.h"
+#include "mv_elf.h"
+
+struct fn_summary {
+    const char *name;
+    int n_variants;
+    unsigned long variant_bytes;
+    unsigned n_callsites;
+    unsigned n_undecodable;
+};
+
+static struct mv_elf elf;
+static const char *file;
+
+static struct mv_info_var *vars;
+static unsigned n_vars;
+static struct mv_info_fn *fns;
+static unsigned n_fns;
+static struct mv_info_callsite *callsites;
+static unsigned n_callsites;
+
+static uintptr_t text_start, text_end;   // The __multiverse_text_ section
+
+
+static void die(const char *fmt, const char *arg) {
+    fprintf(stderr, "mv-objdump: ");
+    fprintf(stderr, fmt, arg);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+/* Copies the descriptor array of a section */
+static void *read_section(const char *name, size_t element, unsigned *n) {
+    const Elf64_Shdr *section = mv_elf_section(&elf, name);
+    void *array;
+
+    *n = section ? section->sh_size / element : 0;
+    array = calloc(*n + 1, element);
+    if (!array) die("out of memory%s", "");
+    if (*n > 0)
+        memcpy(array, mv_elf_image(&elf, mv_elf_section_addr(&elf, section),
+                                   *n * element), *n * element);
+    return array;
+}
+
+static const char *string_at(const void *addr) {
+    const char *s = mv_elf_image(&elf, (uintptr_t) addr, 1);
+    return s ? s : "?";
+}
+
+static struct mv_info_var *find_var(void *location) {
+    unsigned i;
+    for (i = 0; i < n_vars; i++) {
+        if (vars[i].variable_location == location) return &vars[i];
+    }
+    return NULL;
+}
+
+/* Size of a variant body: its symbol, or the distance to the next
+   body in the __multiverse_text_ section like multiverse_info_body_end */
+static unsigned long body_size(uintptr_t body) {
+    uintptr_t end = text_end;
+    size_t size;
+    unsigned i;
+    int f;
+
+    if (mv_elf_symbol(&elf, body, &size) && size > 0) return size;
+    if (body < text_start || body >= text_end) return 0;
+    for (i = 0; i < n_fns; i++) {
+        const struct mv_info_mvfn *mvfns;
+        if (fns[i].n_mv_functions <= 0) continue;
+        mvfns = mv_elf_image(&elf, (uintptr_t) fns[i].mv_functions,
+                             fns[i].n_mv_functions * sizeof(*mvfns));
+        for (f = 0; mvfns && f < fns[i].n_mv_functions; f++) {
+            uintptr_t other = (uintptr_t) mvfns[f].function_body;
+            if (other > body && other < end) end = other;
+        }
+    }
+    return end - body;
+}
+
+static void print_type(struct mv_info_mvfn *mvfn) {
+    struct mv_info_mvfn local = *mvfn;
+    unsigned char code[16] = {0};
+    size_t len;
+
+    // The body may end with its section
+    for (len = sizeof(code); len > 0; len--) {
+        const void *bytes = mv_elf_image(&elf, (uintptr_t) mvfn->function_body, len);
+        if (bytes) {
+            memcpy(code, bytes, len);
+            break;
+        }
+    }
+    if (len == 0) {
+        printf(" type=?");
+        return;
+    }
+    local.function_body = code;
+    multiverse_arch_decode_mvfn_body(&local);
+    printf(" type=%s", multiverse_mvfn_type_name(local.type));
+    if (local.type == MVFN_TYPE_CONSTANT) printf("(%u)", local.constant);
+}
+
+static void print_assignments(struct mv_info_mvfn *mvfn) {
+    const struct mv_info_assignment *assignments =
+        mv_elf_image(&elf, (uintptr_t) mvfn->assignments,
+                     mvfn->n_assignments * sizeof(*assignments));
+    unsigned a;
+
+    if (!assignments) {
+        printf(" assignments=?");
+        return;
+    }
+    for (a = 0; a < mvfn->n_assignments; a++) {
+        struct mv_info_var *var = find_var(assignments[a].variable.location);
+        if (!var) {
+            printf(" ?=[%u,%u]", assignments[a].lower_bound, assignments[a].upper_bound);
+            continue;
+        }
+        if (var->flag_bits) {
+            printf(" %s&%#x=%#x", string_at(var->name), assignments[a].lower_bound,
+                   assignments[a].upper_bound);
+            continue;
+        }
+        printf(" %s=[%lld,%lld]", string_at(var->name),
+               multiverse_var_extend(var, assignments[a].lower_bound),
+               multiverse_var_extend(var, assignments[a].upper_bound));
+    }
+}
+
+/* Decodes the call at a callsite like multiverse_info_fn_decode;
+   returns 0 if the run-time library cannot patch it */
+static int decode_callsite(struct mv_info_fn *fn, uintptr_t label) {
+    const unsigned char *code = mv_elf_image(&elf, label, MV_PATCHPOINT_SIZE);
+    struct mv_info_fn local = *fn;
+    struct mv_patchpoint pp;
+
+    if (!code) return 0;
+    // The decoder compares the call target relative to the code it reads
+    local.function_body = (void *) ((uintptr_t) code
+                                    + ((uintptr_t) fn->function_body - label));
+    memset(&pp, 0, sizeof(pp));
+    multiverse_arch_decode_callsite(&local, (void *) code, &pp);
+    return pp.type != PP_TYPE_INVALID;
+}
+
+static void dump_fn(struct mv_info_fn *fn, struct fn_summary *summary, int verbose) {
+    struct mv_info_mvfn *mvfns = NULL;
+    unsigned i;
+    int f;
+
+    summary->name = string_at(fn->name);
+    summary->n_variants = fn->n_mv_functions;
+    for (i = 0; i < n_callsites; i++) {
+        if (callsites[i].function_body != fn->function_body) continue;
+        summary->n_callsites++;
+        if (!decode_callsite(fn, (uintptr_t) callsites[i].call_label))
+            summary->n_undecodable++;
+    }
+
+    if (verbose) {
+        printf("function %s body=%#lx", summary->name, (uintptr_t) fn->function_body);
+        if (fn->n_mv_functions == -1) printf(" function-pointer");
+        printf(" callsites=%u undecodable=%u%s\n", summary->n_callsites,
+               summary->n_undecodable, fn->hits ? " hotness" : "");
+    }
+
+    if (fn->n_mv_functions > 0) {
+        mvfns = (struct mv_info_mvfn *) mv_elf_image(&elf, (uintptr_t) fn->mv_functions,
+                                                     fn->n_mv_functions * sizeof(*mvfns));
+    }
+    for (f = 0; mvfns && f < fn->n_mv_functions; f++) {
+        struct mv_info_mvfn *mvfn = &mvfns[f];
+        uintptr_t body = (uintptr_t) mvfn->function_body;
+        unsigned long size = body_size(body);
+        const char *symbol = mv_elf_symbol(&elf, body, NULL);
+        int g;
+
+        // Several mvfns can share a body
+        for (g = 0; g < f; g++) {
+            if (mvfns[g].function_body == mvfn->function_body) break;
+        }
+        if (g == f) summary->variant_bytes += size;
+        if (!verbose) continue;
+        printf("  variant %s %#lx size=%lu", symbol ? symbol : "?", body, size);
+        print_type(mvfn);
+        printf(":");
+        print_assignments(mvfn);
+        printf("\n");
+    }
+
+    if (!verbose) return;
+    for (i = 0; i < n_callsites; i++) {
+        uintptr_t label = (uintptr_t) callsites[i].call_label;
+        if (callsites[i].function_body != fn->function_body) continue;
+        if (!decode_callsite(fn, label))
+            printf("  callsite %#lx not decodable\n", label);
+    }
+    printf("\n");
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: mv-objdump [-s] file\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    struct fn_summary *summary, total = { .name = "total" };
+    const Elf64_Shdr *text;
+    int opt, verbose = 1;
+    unsigned i;
+
+    while ((opt = getopt(argc, argv, "s")) != -1) {
+        if (opt == 's') verbose = 0;
+        else usage();
+    }
+    if (optind + 1 != argc) usage();
+    file = argv[optind];
+
+    if (mv_elf_open(&elf, file) < 0) die("%s is no x86-64 ELF file", file);
+    if (mv_elf_load(&elf) < 0) die("cannot load %s", file);
+
+    text = mv_elf_section(&elf, "__multiverse_text_");
+    if (text) {
+        text_start = mv_elf_section_addr(&elf, text);
+        text_end = text_start + text->sh_size;
+    }
+    vars = read_section("__multiverse_var_", sizeof(*vars), &n_vars);
+    fns = read_section("__multiverse_fn_", sizeof(*fns), &n_fns);
+    callsites = read_section("__multiverse_callsite_", sizeof(*callsites), &n_callsites);
+
+    if (verbose) {
+        printf("%s: %u functions, %u variables, %u callsites\n\n",
+               file, n_fns, n_vars, n_callsites);
+        for (i = 0; i < n_vars; i++) {
+            struct mv_info_var *var = &vars[i];
+            printf("variable %s width=%u%s%s%s%s\n", string_at(var->name),
+                   var->variable_width, var->flag_signed ? " signed" : "",
+                   var->flag_tracked ? " tracked" : "",
+                   var->flag_bits ? " bits" : "",
+                   var->flag_pointer ? " pointer" : "");
+        }
+        if (n_vars > 0) printf("\n");
+    }
+
+    summary = calloc(n_fns + 1, sizeof(*summary));
+    if (!summary) die("out of memory%s", "");
+    for (i = 0; i < n_fns; i++) {
+        dump_fn(&fns[i], &summary[i], verbose);
+        total.n_variants += summary[i].n_variants > 0 ? summary[i].n_variants : 0;
+        total.variant_bytes += summary[i].variant_bytes;
+        total.n_callsites += summary[i].n_callsites;
+        total.n_undecodable += summary[i].n_undecodable;
+    }
+
+    printf("%-32s %8s %14s %10s %12s\n", "function", "variants", "variant_bytes",
+           "callsites", "undecodable");
+    for (i = 0; i <= n_fns; i++) {
+        struct fn_summary *s = i < n_fns ? &summary[i] : &total;
+        printf("%-32s %8d %14lu %10u %12u\n", s->name, s->n_variants,
+               s->variant_bytes, s->n_callsites, s->n_undecodable);
+    }
+    return 0;
+}
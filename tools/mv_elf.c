@@ -0,0 +1,210 @@
+#define _DEFAULT_SOURCE
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mv_elf.h"
+
+/* Object files have no addresses; their sections are laid out from here */
+#define OBJECT_BASE 0x10000000UL
+
+
+int mv_elf_open(struct mv_elf *elf, const char *path) {
+    struct stat st;
+    void *data;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(Elf64_Ehdr)) {
+        close(fd);
+        return -1;
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return -1;
+
+    memset(elf, 0, sizeof(*elf));
+    elf->data = data;
+    elf->size = st.st_size;
+    elf->ehdr = data;
+    if (memcmp(elf->ehdr->e_ident, ELFMAG, SELFMAG) != 0
+        || elf->ehdr->e_ident[EI_CLASS] != ELFCLASS64
+        || elf->ehdr->e_machine != EM_X86_64
+        || elf->ehdr->e_shoff == 0
+        || elf->ehdr->e_shoff + elf->ehdr->e_shnum * sizeof(Elf64_Shdr) > elf->size) {
+        munmap(data, st.st_size);
+        return -1;
+    }
+    elf->shdr = (const Elf64_Shdr *) (elf->data + elf->ehdr->e_shoff);
+    elf->phdr = (const Elf64_Phdr *) (elf->data + elf->ehdr->e_phoff);
+    return 0;
+}
+
+const Elf64_Shdr *mv_elf_section(struct mv_elf *elf, const char *name) {
+    const Elf64_Shdr *strtab = &elf->shdr[elf->ehdr->e_shstrndx];
+    unsigned i;
+
+    for (i = 0; i < elf->ehdr->e_shnum; i++) {
+        const char *s = (const char *) elf->data + strtab->sh_offset
+            + elf->shdr[i].sh_name;
+        if (strcmp(s, name) == 0) return &elf->shdr[i];
+    }
+    return NULL;
+}
+
+int mv_elf_file_bytes(struct mv_elf *elf, uintptr_t addr, void *buf, size_t len) {
+    unsigned i;
+
+    for (i = 0; i < elf->ehdr->e_phnum; i++) {
+        const Elf64_Phdr *ph = &elf->phdr[i];
+        if (ph->p_type == PT_LOAD && addr >= ph->p_vaddr
+            && addr + len <= ph->p_vaddr + ph->p_filesz) {
+            memcpy(buf, elf->data + ph->p_offset + (addr - ph->p_vaddr), len);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+
+static int is_loaded(const Elf64_Shdr *sh) {
+    // Thread-local bss overlaps with the following sections
+    return (sh->sh_flags & SHF_ALLOC)
+        && !(sh->sh_type == SHT_NOBITS && (sh->sh_flags & SHF_TLS));
+}
+
+static unsigned char *image_at(struct mv_elf *elf, uintptr_t addr, size_t len) {
+    unsigned i;
+
+    for (i = 0; i < elf->ehdr->e_shnum; i++) {
+        if (elf->image[i] && addr >= elf->addr[i]
+            && addr + len <= elf->addr[i] + elf->shdr[i].sh_size)
+            return elf->image[i] + (addr - elf->addr[i]);
+    }
+    return NULL;
+}
+
+static uint64_t symbol_value(struct mv_elf *elf, const Elf64_Shdr *symtab,
+                             unsigned index) {
+    const Elf64_Sym *sym;
+
+    if (symtab->sh_type != SHT_SYMTAB && symtab->sh_type != SHT_DYNSYM) return 0;
+    sym = (const Elf64_Sym *) (elf->data + symtab->sh_offset) + index;
+    if (sym->st_shndx == SHN_UNDEF || sym->st_shndx == SHN_COMMON) return 0;
+    if (elf->ehdr->e_type != ET_REL || sym->st_shndx == SHN_ABS) return sym->st_value;
+    if (sym->st_shndx >= elf->ehdr->e_shnum) return 0;
+    return elf->addr[sym->st_shndx] + sym->st_value;
+}
+
+static void apply_relocations(struct mv_elf *elf, const Elf64_Shdr *sh) {
+    const Elf64_Rela *rela = (const Elf64_Rela *) (elf->data + sh->sh_offset);
+    const Elf64_Shdr *symtab = &elf->shdr[sh->sh_link];
+    uintptr_t base = 0;
+    size_t i;
+
+    // In object files, the offsets are relative to the patched section
+    if (elf->ehdr->e_type == ET_REL) {
+        if (sh->sh_info >= elf->ehdr->e_shnum || !elf->image[sh->sh_info]) return;
+        base = elf->addr[sh->sh_info];
+    }
+
+    for (i = 0; i < sh->sh_size / sizeof(Elf64_Rela); i++) {
+        uintptr_t p = base + rela[i].r_offset;
+        uint64_t s = symbol_value(elf, symtab, ELF64_R_SYM(rela[i].r_info));
+        int64_t a = rela[i].r_addend;
+        unsigned char *where;
+        uint64_t value64;
+        uint32_t value32;
+
+        switch (ELF64_R_TYPE(rela[i].r_info)) {
+        case R_X86_64_64:
+            value64 = s + a;
+            break;
+        case R_X86_64_RELATIVE:
+            value64 = a;
+            break;
+        case R_X86_64_GLOB_DAT:
+        case R_X86_64_JUMP_SLOT:
+            value64 = s;
+            break;
+        case R_X86_64_PC32:
+        case R_X86_64_PLT32:
+            value32 = s + a - p;
+            if ((where = image_at(elf, p, 4)) != NULL)
+                memcpy(where, &value32, 4);
+            continue;
+        default:
+            continue;
+        }
+        if ((where = image_at(elf, p, 8)) != NULL)
+            memcpy(where, &value64, 8);
+    }
+}
+
+int mv_elf_load(struct mv_elf *elf) {
+    uintptr_t next = OBJECT_BASE;
+    unsigned i;
+
+    elf->image = calloc(elf->ehdr->e_shnum, sizeof(*elf->image));
+    elf->addr = calloc(elf->ehdr->e_shnum, sizeof(*elf->addr));
+    if (!elf->image || !elf->addr) return -1;
+
+    for (i = 0; i < elf->ehdr->e_shnum; i++) {
+        const Elf64_Shdr *sh = &elf->shdr[i];
+        if (!is_loaded(sh)) continue;
+
+        if (elf->ehdr->e_type == ET_REL) {
+            uintptr_t align = sh->sh_addralign ? sh->sh_addralign : 1;
+            next = (next + align - 1) & ~(align - 1);
+            elf->addr[i] = next;
+            next += sh->sh_size + 1;
+        } else {
+            elf->addr[i] = sh->sh_addr;
+        }
+        elf->image[i] = calloc(1, sh->sh_size + 1);
+        if (!elf->image[i]) return -1;
+        if (sh->sh_type != SHT_NOBITS) {
+            if (sh->sh_offset + sh->sh_size > elf->size) return -1;
+            memcpy(elf->image[i], elf->data + sh->sh_offset, sh->sh_size);
+        }
+    }
+
+    for (i = 0; i < elf->ehdr->e_shnum; i++) {
+        if (elf->shdr[i].sh_type == SHT_RELA) apply_relocations(elf, &elf->shdr[i]);
+    }
+    return 0;
+}
+
+uintptr_t mv_elf_section_addr(struct mv_elf *elf, const Elf64_Shdr *shdr) {
+    return elf->addr[shdr - elf->shdr];
+}
+
+const void *mv_elf_image(struct mv_elf *elf, uintptr_t addr, size_t len) {
+    return image_at(elf, addr, len);
+}
+
+const char *mv_elf_symbol(struct mv_elf *elf, uintptr_t addr, size_t *size) {
+    static const char *tables[] = {".symtab", ".dynsym"};
+    unsigned t;
+
+    for (t = 0; t < sizeof(tables) / sizeof(*tables); t++) {
+        const Elf64_Shdr *symtab = mv_elf_section(elf, tables[t]);
+        const Elf64_Sym *syms;
+        const char *strings;
+        size_t i;
+
+        if (!symtab) continue;
+        syms = (const Elf64_Sym *) (elf->data + symtab->sh_offset);
+        strings = (const char *) elf->data + elf->shdr[symtab->sh_link].sh_offset;
+        for (i = 1; i < symtab->sh_size / sizeof(Elf64_Sym); i++) {
+            unsigned type = ELF64_ST_TYPE(syms[i].st_info);
+            if (type != STT_FUNC && type != STT_OBJECT) continue;
+            if (symbol_value(elf, symtab, i) != addr) continue;
+            if (size) *size = syms[i].st_size;
+            return strings + syms[i].st_name;
+        }
+    }
+    return NULL;
+}
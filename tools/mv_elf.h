@@ -0,0 +1,46 @@
+/* Reading x86-64 ELF files for the multiverse tools */
+#ifndef __MULTIVERSE_TOOLS_MV_ELF_H
+#define __MULTIVERSE_TOOLS_MV_ELF_H
+
+#include <elf.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct mv_elf {
+    const unsigned char *data;      // The mapped file
+    size_t size;
+    const Elf64_Ehdr *ehdr;
+    const Elf64_Shdr *shdr;
+    const Elf64_Phdr *phdr;
+
+    // The allocated sections with relocations applied, see mv_elf_load
+    unsigned char **image;
+    uintptr_t *addr;
+};
+
+/* Maps the file; returns -1 if it is no x86-64 ELF file with sections */
+int mv_elf_open(struct mv_elf *elf, const char *path);
+
+/* The section header of a section, or NULL if there is none */
+const Elf64_Shdr *mv_elf_section(struct mv_elf *elf, const char *name);
+
+/* Copies the original bytes at a link-time address of a linked file;
+   returns -1 if the address is not backed by the file */
+int mv_elf_file_bytes(struct mv_elf *elf, uintptr_t addr, void *buf, size_t len);
+
+/* Lays out the allocated sections in memory and applies the
+   relocations, so that the pointers in the data can be followed with
+   mv_elf_image. The sections of an object file get distinct, made-up
+   addresses. Returns -1 on error. */
+int mv_elf_load(struct mv_elf *elf);
+
+/* The address of a section after mv_elf_load */
+uintptr_t mv_elf_section_addr(struct mv_elf *elf, const Elf64_Shdr *shdr);
+
+/* Pointer to len loaded bytes at addr, or NULL */
+const void *mv_elf_image(struct mv_elf *elf, uintptr_t addr, size_t len);
+
+/* Name and size of the function or object symbol at addr, or NULL */
+const char *mv_elf_symbol(struct mv_elf *elf, uintptr_t addr, size_t *size);
+
+#endif
@@ -0,0 +1,108 @@
+/* mvctl - command-line client for the multiverse control socket
+
+   Usage: mvctl [-s socket] command [arguments...]
+
+   The application has to start the control server with
+   multiverse_control_start(). The socket path is taken from -s, the
+   MULTIVERSE_SOCKET environment variable, or defaults to
+   /tmp/multiverse.sock. Run "mvctl help" for the list of commands. */
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define DEFAULT_SOCKET "/tmp/multiverse.sock"
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-s socket] command [arguments...]\n", prog);
+    exit(2);
+}
+
+/* The reply is finished by a line "ok" or "error ..." */
+static int last_line(const char *reply, size_t len, int *status) {
+    const char *line;
+
+    if (len == 0 || reply[len - 1] != '\n') return 0;
+    for (line = reply + len - 1; line > reply && line[-1] != '\n'; line--)
+        ;
+    if (strncmp(line, "ok\n", 3) == 0) {
+        *status = 0;
+        return 1;
+    }
+    if (strncmp(line, "error ", 6) == 0) {
+        *status = 1;
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *path = getenv("MULTIVERSE_SOCKET");
+    struct sockaddr_un addr;
+    char command[256] = "";
+    char *reply = NULL;
+    size_t len = 0, capacity = 0;
+    int fd, opt, i, status = 1;
+
+    while ((opt = getopt(argc, argv, "s:h")) != -1) {
+        if (opt == 's') path = optarg;
+        else usage(argv[0]);
+    }
+    if (optind == argc) usage(argv[0]);
+    if (!path) path = DEFAULT_SOCKET;
+
+    for (i = optind; i < argc; i++) {
+        if (strlen(command) + strlen(argv[i]) + 2 >= sizeof(command)) {
+            fprintf(stderr, "%s: command too long\n", argv[0]);
+            return 2;
+        }
+        if (i > optind) strcat(command, " ");
+        strcat(command, argv[i]);
+    }
+    strcat(command, "\n");
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", argv[0]);
+        return 2;
+    }
+    strcpy(addr.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        perror(path);
+        return 2;
+    }
+    if (write(fd, command, strlen(command)) != (ssize_t) strlen(command)) {
+        perror("write");
+        return 2;
+    }
+
+    for (;;) {
+        ssize_t n;
+        if (len + 4096 > capacity) {
+            capacity = capacity ? 2 * capacity : 8192;
+            reply = realloc(reply, capacity);
+            if (!reply) {
+                perror("realloc");
+                return 2;
+            }
+        }
+        n = read(fd, reply + len, capacity - len);
+        if (n <= 0) {
+            fprintf(stderr, "%s: connection closed\n", argv[0]);
+            return 2;
+        }
+        len += n;
+        if (last_line(reply, len, &status)) break;
+    }
+    close(fd);
+
+    fwrite(reply, 1, len, status ? stderr : stdout);
+    free(reply);
+    return status;
+}
@@ -0,0 +1,583 @@
+/* mvpatch - commit the multiverse functions of a running process from outside
+
+   Usage: mvpatch [-l] [-n] [-r] [-b] [-f] [-o object] pid
+
+   The process does not have to call multiverse_init() or to link the
+   run-time library; it only has to be compiled with the plugin. We
+   find the descriptor sections in the ELF file of the executable (or
+   of the shared object given with -o) and relocate them with the load
+   address from /proc/pid/maps. The descriptors and the variables are
+   read from the process memory, the variants are selected like
+   multiverse_commit() does, and the patch bytes are generated by the
+   x86 backend of the run-time library.
+
+   For patching, all threads are stopped with ptrace and the text is
+   written through /proc/pid/mem, which, unlike process_vm_writev(),
+   can write to read-only mappings. A thread that stopped within a
+   patchpoint is single-stepped out of it first. Reverting restores
+   the original code from the ELF file.
+
+     -l  list the functions and variables and the active variants
+     -n  print the changes, but do not patch
+     -r  revert all functions to the generic code
+     -b  treat tracked variables as bound
+     -f  patch even if the process initialized the run-time library;
+         its bookkeeping becomes stale, better use mvctl then
+     -o  path of the mapped object that contains the descriptors
+
+   Only x86-64 ELF processes are supported. Multiversed function
+   pointers are skipped. */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+#include "multiverse.h"
+#include "mv_commit.h"
+#include "arch.h"
+#include "mv_elf.h"
+
+#define MAX_NAME    128
+#define MAX_THREADS 1024
+#define MAX_STEPS   64
+
+struct remote_var {
+    struct mv_info_var desc;
+    char name[MAX_NAME];
+    mv_value_t value;
+};
+
+struct remote_fn {
+    struct mv_info_fn desc;
+    char name[MAX_NAME];
+    struct mv_info_mvfn *mvfns;     // Bodies are remote addresses
+    struct mv_info_mvfn *selected;
+};
+
+struct patch {
+    struct remote_fn *fn;
+    uintptr_t location;
+    int size;
+    unsigned char bytes[MV_PATCHPOINT_SIZE];
+};
+
+static struct {
+    pid_t pid;
+    int mem_fd;
+    struct mv_elf elf;
+    uintptr_t bias;
+
+    struct remote_var *vars;
+    unsigned n_vars;
+    uintptr_t vars_start;           // Remote address of the variable section
+    struct remote_fn *fns;
+    unsigned n_fns;
+    struct patch *patches;
+    unsigned n_patches;
+
+    pid_t threads[MAX_THREADS];
+    unsigned n_threads;
+} target;
+
+static int bind_tracked;
+
+
+static void die(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "mvpatch: ");
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    exit(1);
+}
+
+static void *xcalloc(size_t n, size_t size) {
+    void *p = calloc(n ? n : 1, size);
+    if (!p) die("out of memory");
+    return p;
+}
+
+
+/* Remote memory */
+
+static void remote_read(uintptr_t addr, void *buf, size_t len) {
+    if (pread(target.mem_fd, buf, len, addr) != (ssize_t) len)
+        die("cannot read %zu bytes at %#lx: %s", len, addr, strerror(errno));
+}
+
+static void remote_write(uintptr_t addr, const void *buf, size_t len) {
+    if (pwrite(target.mem_fd, buf, len, addr) != (ssize_t) len)
+        die("cannot write %zu bytes at %#lx: %s", len, addr, strerror(errno));
+}
+
+static void remote_string(uintptr_t addr, char *buf, size_t size) {
+    size_t i;
+    for (i = 0; i + 1 < size; i++) {
+        if (pread(target.mem_fd, &buf[i], 1, addr + i) != 1) break;
+        if (buf[i] == '\0') return;
+    }
+    buf[i] = '\0';
+}
+
+
+/* ELF file */
+
+static void elf_bytes(uintptr_t addr, void *buf, size_t len) {
+    if (mv_elf_file_bytes(&target.elf, addr, buf, len) < 0)
+        die("address %#lx is not in the file", addr);
+}
+
+/* The difference between run-time and link-time addresses */
+static void load_bias(const char *path) {
+    uintptr_t lowest = UINTPTR_MAX, start;
+    unsigned long offset;
+    char line[PATH_MAX + 128], mapped[PATH_MAX];
+    FILE *maps;
+    unsigned i;
+
+    for (i = 0; i < target.elf.ehdr->e_phnum; i++) {
+        const Elf64_Phdr *ph = &target.elf.phdr[i];
+        if (ph->p_type == PT_LOAD && ph->p_vaddr < lowest)
+            lowest = ph->p_vaddr;
+    }
+    lowest &= ~(uintptr_t)(sysconf(_SC_PAGESIZE) - 1);
+
+    snprintf(line, sizeof(line), "/proc/%d/maps", target.pid);
+    maps = fopen(line, "r");
+    if (!maps) die("cannot open %s: %s", line, strerror(errno));
+    while (fgets(line, sizeof(line), maps)) {
+        if (sscanf(line, "%lx-%*x %*s %lx %*s %*d %s", &start, &offset, mapped) != 3)
+            continue;
+        if (offset == 0 && strcmp(mapped, path) == 0) {
+            target.bias = start - lowest;
+            fclose(maps);
+            return;
+        }
+    }
+    die("%s is not mapped into process %d", path, target.pid);
+}
+
+
+/* Descriptors */
+
+static struct remote_var *find_var(void *location) {
+    unsigned i;
+    for (i = 0; i < target.n_vars; i++) {
+        if (target.vars[i].desc.variable_location == location)
+            return &target.vars[i];
+    }
+    return NULL;
+}
+
+static struct remote_fn *find_fn(void *body) {
+    unsigned i;
+    for (i = 0; i < target.n_fns; i++) {
+        if (target.fns[i].desc.function_body == body)
+            return &target.fns[i];
+    }
+    return NULL;
+}
+
+/* Reads the descriptor array of a section; the pointers in it are
+   already relocated by the dynamic loader */
+static void *read_section(const char *name, size_t element, unsigned *n,
+                          uintptr_t *start) {
+    const Elf64_Shdr *section = mv_elf_section(&target.elf, name);
+    void *array;
+
+    *n = 0;
+    if (!section) return xcalloc(1, element);
+    *n = section->sh_size / element;
+    array = xcalloc(*n, element);
+    remote_read(section->sh_addr + target.bias, array, *n * element);
+    if (start) *start = section->sh_addr + target.bias;
+    return array;
+}
+
+/* The run-time library links the assignments to the variable
+   descriptors (multiverse_init and multiverse_init_lazy). Returns
+   the variable of a linked assignment, or NULL. */
+static struct remote_var *linked_var(struct mv_info_assignment *assign) {
+    uintptr_t info = (uintptr_t) assign->variable.info;
+    uintptr_t end = target.vars_start + target.n_vars * sizeof(struct mv_info_var);
+
+    if (info < target.vars_start || info >= end) return NULL;
+    return &target.vars[(info - target.vars_start) / sizeof(struct mv_info_var)];
+}
+
+static void read_descriptors(int force) {
+    static const char initialized[] =
+        "process %d initialized the run-time library, use mvctl (or -f)";
+    struct mv_info_var *vars;
+    struct mv_info_fn *fns;
+    unsigned i, f, a;
+
+    vars = read_section("__multiverse_var_", sizeof(*vars), &target.n_vars,
+                        &target.vars_start);
+    target.vars = xcalloc(target.n_vars, sizeof(struct remote_var));
+    for (i = 0; i < target.n_vars; i++) {
+        struct remote_var *var = &target.vars[i];
+        unsigned char bytes[sizeof(void *)] = {0};
+
+        memcpy(&var->desc, &vars[i], sizeof(var->desc));
+        remote_string((uintptr_t) var->desc.name, var->name, sizeof(var->name));
+        if (var->desc.variable_width > (var->desc.flag_pointer ? sizeof(void *)
+                                        : sizeof(mv_value_t)))
+            die("variable %s has an invalid width", var->name);
+        remote_read((uintptr_t) var->desc.variable_location, bytes,
+                    var->desc.variable_width);
+        if (var->desc.flag_pointer)
+            var->value = *(void **) bytes != NULL;
+        else if (var->desc.variable_width == sizeof(unsigned char))
+            var->value = *(unsigned char *) bytes;
+        else if (var->desc.variable_width == sizeof(unsigned short))
+            var->value = *(unsigned short *) bytes;
+        else
+            var->value = *(unsigned int *) bytes;
+        if (bind_tracked && var->desc.flag_tracked)
+            var->desc.flag_bound = 1;
+    }
+    free(vars);
+
+    fns = read_section("__multiverse_fn_", sizeof(*fns), &target.n_fns, NULL);
+    target.fns = xcalloc(target.n_fns, sizeof(struct remote_fn));
+    for (i = 0; i < target.n_fns; i++) {
+        struct remote_fn *fn = &target.fns[i];
+
+        memcpy(&fn->desc, &fns[i], sizeof(fn->desc));
+        remote_string((uintptr_t) fn->desc.name, fn->name, sizeof(fn->name));
+        if (fn->desc.patchpoints_head != NULL && !force)
+            die(initialized, target.pid);
+        if (fn->desc.n_mv_functions <= 0) continue;
+
+        fn->mvfns = xcalloc(fn->desc.n_mv_functions, sizeof(struct mv_info_mvfn));
+        remote_read((uintptr_t) fn->desc.mv_functions, fn->mvfns,
+                    fn->desc.n_mv_functions * sizeof(struct mv_info_mvfn));
+        for (f = 0; f < (unsigned) fn->desc.n_mv_functions; f++) {
+            struct mv_info_mvfn *mvfn = &fn->mvfns[f];
+            struct mv_info_assignment *assignments;
+            unsigned char body[32];
+
+            assignments = xcalloc(mvfn->n_assignments, sizeof(*assignments));
+            remote_read((uintptr_t) mvfn->assignments, assignments,
+                        mvfn->n_assignments * sizeof(*assignments));
+            mvfn->assignments = assignments;
+            for (a = 0; a < mvfn->n_assignments; a++) {
+                struct remote_var *var = linked_var(&assignments[a]);
+                if (!var) continue;
+                if (!force) die(initialized, target.pid);
+                assignments[a].variable.location = var->desc.variable_location;
+            }
+
+            // The decoder looks at the first instructions of the body
+            remote_read((uintptr_t) mvfn->function_body, body, sizeof(body));
+            {
+                void *remote = mvfn->function_body;
+                mvfn->function_body = body;
+                multiverse_arch_decode_mvfn_body(mvfn);
+                mvfn->function_body = remote;
+                mvfn->cached_body = NULL;
+            }
+        }
+    }
+    free(fns);
+}
+
+
+/* Selection, as multiverse_match_mvfn() */
+
+static struct mv_info_mvfn *select_mvfn(struct remote_fn *fn) {
+    struct mv_info_mvfn *best_mvfn = NULL;
+    int f;
+
+    for (f = 0; f < fn->desc.n_mv_functions; f++) {
+        struct mv_info_mvfn *mvfn = &fn->mvfns[f];
+        unsigned good = 1;
+        unsigned a;
+        for (a = 0; a < mvfn->n_assignments; a++) {
+            struct mv_info_assignment *assign = &mvfn->assignments[a];
+            struct remote_var *var = find_var(assign->variable.location);
+            if (!var || !var->desc.flag_bound) {
+                good = 0;
+            } else if (!multiverse_var_match(&var->desc, assign, var->value)) {
+                good = 0;
+            }
+        }
+        if (good) best_mvfn = mvfn;
+    }
+    return best_mvfn;
+}
+
+
+/* Patches */
+
+static void add_patch(struct remote_fn *fn, struct mv_patchpoint *pp, int revert) {
+    struct patch *patch = &target.patches[target.n_patches];
+    void *from, *to;
+
+    multiverse_arch_patchpoint_size(pp, &from, &to);
+    patch->fn = fn;
+    patch->location = (uintptr_t) from;
+    patch->size = (char *) to - (char *) from;
+    if (revert || fn->selected == NULL) {
+        elf_bytes(patch->location - target.bias, patch->bytes, patch->size);
+    } else {
+        patch->size = multiverse_arch_patchpoint_bytes(fn->selected, pp, patch->bytes);
+    }
+    target.n_patches++;
+}
+
+static void plan_patches(int revert) {
+    struct mv_info_callsite *callsites;
+    unsigned n_callsites, i;
+
+    callsites = read_section("__multiverse_callsite_", sizeof(*callsites),
+                             &n_callsites, NULL);
+    target.patches = xcalloc(target.n_fns + n_callsites, sizeof(struct patch));
+
+    for (i = 0; i < target.n_fns; i++) {
+        struct remote_fn *fn = &target.fns[i];
+        struct mv_patchpoint pp;
+
+        if (fn->desc.n_mv_functions == -1) continue;
+        fn->selected = revert ? NULL : select_mvfn(fn);
+        memset(&pp, 0, sizeof(pp));
+        multiverse_arch_decode_function(&fn->desc, &pp);
+        add_patch(fn, &pp, revert);
+    }
+
+    for (i = 0; i < n_callsites; i++) {
+        struct remote_fn *fn = find_fn(callsites[i].function_body);
+        uintptr_t label = (uintptr_t) callsites[i].call_label;
+        unsigned char code[MV_PATCHPOINT_SIZE];
+        struct mv_info_fn local;
+        struct mv_patchpoint pp;
+
+        if (!fn || fn->desc.n_mv_functions == -1) continue;
+
+        // Decode the original call from the file, as seen from a local copy
+        elf_bytes(label - target.bias, code, sizeof(code));
+        memcpy(&local, &fn->desc, sizeof(local));
+        local.function_body = (void *)((uintptr_t) code
+                                       + ((uintptr_t) fn->desc.function_body - label));
+        memset(&pp, 0, sizeof(pp));
+        multiverse_arch_decode_callsite(&local, code, &pp);
+        if (pp.type == PP_TYPE_INVALID) continue;
+        pp.location = (void *) label;
+        add_patch(fn, &pp, revert);
+    }
+    free(callsites);
+}
+
+
+/* Threads */
+
+static int is_stopped(pid_t tid) {
+    unsigned i;
+    for (i = 0; i < target.n_threads; i++) {
+        if (target.threads[i] == tid) return 1;
+    }
+    return 0;
+}
+
+/* Stops all threads; threads that are created meanwhile are caught by
+   scanning the task list until it does not change */
+static void stop_threads(void) {
+    char path[64];
+    int added;
+
+    snprintf(path, sizeof(path), "/proc/%d/task", target.pid);
+    do {
+        struct dirent *entry;
+        DIR *dir = opendir(path);
+        if (!dir) die("cannot open %s: %s", path, strerror(errno));
+
+        added = 0;
+        while ((entry = readdir(dir)) != NULL) {
+            pid_t tid = atoi(entry->d_name);
+            int status;
+
+            if (tid <= 0 || is_stopped(tid)) continue;
+            if (target.n_threads == MAX_THREADS) die("too many threads");
+            if (ptrace(PTRACE_SEIZE, tid, NULL, NULL) < 0) {
+                if (errno == ESRCH) continue;  // Exited in the meantime
+                die("cannot attach to %d: %s", tid, strerror(errno));
+            }
+            target.threads[target.n_threads++] = tid;
+            if (ptrace(PTRACE_INTERRUPT, tid, NULL, NULL) < 0
+                || waitpid(tid, &status, __WALL) < 0)
+                die("cannot stop %d: %s", tid, strerror(errno));
+            added = 1;
+        }
+        closedir(dir);
+    } while (added);
+}
+
+static void resume_threads(void) {
+    unsigned i;
+    for (i = 0; i < target.n_threads; i++)
+        ptrace(PTRACE_DETACH, target.threads[i], NULL, NULL);
+    target.n_threads = 0;
+}
+
+static struct patch *patch_at(uintptr_t ip) {
+    unsigned i;
+    for (i = 0; i < target.n_patches; i++) {
+        struct patch *patch = &target.patches[i];
+        if (ip > patch->location && ip < patch->location + patch->size)
+            return patch;
+    }
+    return NULL;
+}
+
+/* No thread may continue in the middle of a rewritten instruction */
+static void leave_patches(void) {
+    unsigned i, steps;
+
+    for (i = 0; i < target.n_threads; i++) {
+        pid_t tid = target.threads[i];
+        for (steps = 0; steps < MAX_STEPS; steps++) {
+            struct user_regs_struct regs;
+            int status;
+
+            if (ptrace(PTRACE_GETREGS, tid, NULL, &regs) < 0)
+                die("cannot read the registers of %d: %s", tid, strerror(errno));
+            if (!patch_at(regs.rip)) break;
+            if (ptrace(PTRACE_SINGLESTEP, tid, NULL, NULL) < 0
+                || waitpid(tid, &status, __WALL) < 0)
+                die("cannot single-step %d: %s", tid, strerror(errno));
+        }
+        if (steps == MAX_STEPS)
+            die("thread %d does not leave the patchpoint", tid);
+    }
+}
+
+
+/* Output */
+
+static const char *body_name(struct remote_fn *fn, uintptr_t body) {
+    static char buf[32];
+    if (body == (uintptr_t) fn->desc.function_body) return "generic";
+    snprintf(buf, sizeof(buf), "%#lx", body);
+    return buf;
+}
+
+static void list(void) {
+    unsigned i;
+
+    for (i = 0; i < target.n_fns; i++) {
+        struct remote_fn *fn = &target.fns[i];
+        uintptr_t entry = (uintptr_t) fn->desc.function_body;
+        unsigned char code[5];
+        uintptr_t active = entry;
+
+        if (fn->desc.n_mv_functions == -1) {
+            printf("%s variants=pointer\n", fn->name);
+            continue;
+        }
+        // A committed function jumps from its entry to the variant
+        remote_read(entry, code, sizeof(code));
+        if (code[0] == 0xe9) {
+            int32_t offset;
+            memcpy(&offset, code + 1, sizeof(offset));
+            active = entry + 5 + offset;
+        }
+        printf("%s active=%s variants=%d\n", fn->name, body_name(fn, active),
+               fn->desc.n_mv_functions);
+    }
+    for (i = 0; i < target.n_vars; i++) {
+        struct remote_var *var = &target.vars[i];
+        printf("%s value=%u width=%u tracked=%d bound=%d\n", var->name,
+               (unsigned) var->value, var->desc.variable_width,
+               var->desc.flag_tracked, var->desc.flag_bound);
+    }
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: mvpatch [-l] [-n] [-r] [-b] [-f] [-o object] pid\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int opt, do_list = 0, dry_run = 0, revert = 0, force = 0;
+    char exe[PATH_MAX], path[64];
+    const char *object = NULL;
+    unsigned i, changed = 0;
+    ssize_t len;
+
+    while ((opt = getopt(argc, argv, "lnrbfo:")) != -1) {
+        switch (opt) {
+        case 'l': do_list = 1; break;
+        case 'n': dry_run = 1; break;
+        case 'r': revert = 1; break;
+        case 'b': bind_tracked = 1; break;
+        case 'f': force = 1; break;
+        case 'o': object = optarg; break;
+        default: usage();
+        }
+    }
+    if (optind + 1 != argc) usage();
+    target.pid = atoi(argv[optind]);
+    if (target.pid <= 0) usage();
+
+    // The maps show the resolved path of the object
+    if (object) {
+        if (!realpath(object, exe)) die("cannot resolve %s", object);
+        if (mv_elf_open(&target.elf, exe) < 0) die("%s is no x86-64 ELF file", exe);
+    } else {
+        snprintf(path, sizeof(path), "/proc/%d/exe", target.pid);
+        len = readlink(path, exe, sizeof(exe) - 1);
+        if (len < 0) die("cannot resolve %s: %s", path, strerror(errno));
+        exe[len] = '\0';
+        if (mv_elf_open(&target.elf, path) < 0) die("%s is no x86-64 ELF file", exe);
+    }
+    load_bias(exe);
+
+    snprintf(path, sizeof(path), "/proc/%d/mem", target.pid);
+    target.mem_fd = open(path, O_RDWR);
+    if (target.mem_fd < 0) die("cannot open %s: %s", path, strerror(errno));
+
+    read_descriptors(force || do_list);
+    if (do_list) {
+        list();
+        return 0;
+    }
+
+    stop_threads();
+    plan_patches(revert);
+    for (i = 0; i < target.n_patches; i++) {
+        struct patch *patch = &target.patches[i];
+        unsigned char current[MV_PATCHPOINT_SIZE];
+
+        remote_read(patch->location, current, patch->size);
+        patch->size = memcmp(current, patch->bytes, patch->size) ? patch->size : 0;
+    }
+    leave_patches();
+
+    for (i = 0; i < target.n_patches; i++) {
+        struct patch *patch = &target.patches[i];
+        if (patch->size == 0) continue;
+        if (patch->location == (uintptr_t) patch->fn->desc.function_body) {
+            printf("%s: %s\n", patch->fn->name,
+                   patch->fn->selected
+                   ? body_name(patch->fn, (uintptr_t) patch->fn->selected->function_body)
+                   : "generic");
+            changed++;
+        }
+        if (!dry_run) remote_write(patch->location, patch->bytes, patch->size);
+    }
+    resume_threads();
+
+    printf("%u functions %s\n", changed, dry_run ? "would change" : "changed");
+    return 0;
+}